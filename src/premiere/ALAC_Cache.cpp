@@ -0,0 +1,245 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Cache.h"
+
+#include "ALAC_SharedCache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+ALAC_PacketCache::ALAC_PacketCache(int channels, size_t max_bytes, uint64_t shared_id) :
+	_channels(channels),
+	_max_bytes(max_bytes),
+	_shared_id(shared_id),
+	_bytes(0),
+	_clock(0)
+{
+	assert(_channels > 0);
+}
+
+
+ALAC_PacketCache::~ALAC_PacketCache()
+{
+	for(EntryMap::iterator i = _entries.begin(); i != _entries.end(); ++i)
+	{
+		free(i->second.buf);
+	}
+}
+
+
+bool
+ALAC_PacketCache::Has(uint32_t packet)
+{
+	{
+		ALAC_Lock lock(_mutex);
+		
+		if(_entries.find(packet) != _entries.end())
+			return true;
+	}
+	
+	return ALAC_SharedCache::Instance().Has(_shared_id, packet, _channels);
+}
+
+
+int
+ALAC_PacketCache::Read(uint32_t packet, float **out, int64_t out_pos, int skip, int samples)
+{
+	{
+		ALAC_Lock lock(_mutex);
+		
+		EntryMap::iterator i = _entries.find(packet);
+		
+		if(i != _entries.end())
+			return Copy(i->second, out, out_pos, skip, samples);
+	}
+	
+	
+	// maybe another process decoded it
+	if(_shared_id == 0 || _channels > 6)
+		return -1;
+	
+	const int max_samples = ALAC_SharedCache::Instance().MaxSamples(_channels);
+	
+	float *buf = (float *)malloc(sizeof(float) * _channels * max_samples);
+	
+	if(buf == NULL)
+		return -1;
+	
+	float *bufs[6];
+	
+	for(int c=0; c < _channels; c++)
+		bufs[c] = &buf[c * max_samples];
+	
+	const int shared_samples = ALAC_SharedCache::Instance().Read(_shared_id, packet, _channels, bufs, max_samples);
+	
+	if(shared_samples <= 0)
+	{
+		free(buf);
+		
+		return -1;
+	}
+	
+	// pack the channels together the way we store them
+	for(int c=1; c < _channels; c++)
+		memmove(&buf[c * shared_samples], bufs[c], sizeof(float) * shared_samples);
+	
+	// and only keep as much as the budget counts
+	if(shared_samples < max_samples)
+	{
+		float *fitted = (float *)realloc(buf, sizeof(float) * _channels * shared_samples);
+		
+		if(fitted != NULL)
+			buf = fitted;
+	}
+	
+	
+	ALAC_Lock lock(_mutex);
+	
+	Entry &entry = Insert(packet, buf, shared_samples);
+	
+	const int copied = Copy(entry, out, out_pos, skip, samples);
+	
+	Trim();
+	
+	return copied;
+}
+
+
+int
+ALAC_PacketCache::Copy(Entry &entry, float **out, int64_t out_pos, int skip, int samples)
+{
+	// mutex must be locked
+	entry.last_used = ++_clock;
+	
+	if(samples > entry.samples - skip)
+		samples = entry.samples - skip;
+	
+	if(samples <= 0)
+		return 0;
+	
+	for(int c=0; c < _channels; c++)
+	{
+		memcpy(&out[c][out_pos], &entry.buf[(c * entry.samples) + skip], sizeof(float) * samples);
+	}
+	
+	return samples;
+}
+
+
+void
+ALAC_PacketCache::Store(uint32_t packet, const float * const *in, int samples)
+{
+	const size_t size = sizeof(float) * _channels * samples;
+
+	if(samples <= 0 || size > _max_bytes)
+		return;
+	
+	float *buf = (float *)malloc(size);
+	
+	if(buf == NULL)
+		return;
+	
+	for(int c=0; c < _channels; c++)
+	{
+		memcpy(&buf[c * samples], in[c], sizeof(float) * samples);
+	}
+	
+	{
+		ALAC_Lock lock(_mutex);
+		
+		Insert(packet, buf, samples);
+		
+		Trim();
+	}
+	
+	ALAC_SharedCache::Instance().Store(_shared_id, packet, _channels, in, samples);
+}
+
+
+ALAC_PacketCache::Entry &
+ALAC_PacketCache::Insert(uint32_t packet, float *buf, int samples)
+{
+	// mutex must be locked
+	EntryMap::iterator i = _entries.find(packet);
+	
+	if(i != _entries.end())
+	{
+		// somebody else got here first
+		free(buf);
+		
+		i->second.last_used = ++_clock;
+		
+		return i->second;
+	}
+	
+	Entry entry;
+	entry.buf = buf;
+	entry.samples = samples;
+	entry.last_used = ++_clock;
+	
+	_bytes += sizeof(float) * _channels * samples;
+	
+	return (_entries[packet] = entry);
+}
+
+
+void
+ALAC_PacketCache::Trim()
+{
+	// linear search for the oldest, but there are never very many packets in here
+	while(_bytes > _max_bytes && !_entries.empty())
+	{
+		EntryMap::iterator oldest = _entries.begin();
+		
+		for(EntryMap::iterator i = _entries.begin(); i != _entries.end(); ++i)
+		{
+			if(i->second.last_used < oldest->second.last_used)
+				oldest = i;
+		}
+		
+		_bytes -= sizeof(float) * _channels * oldest->second.samples;
+		
+		free(oldest->second.buf);
+		
+		_entries.erase(oldest);
+	}
+}
\ No newline at end of file
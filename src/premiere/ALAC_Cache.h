@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_CACHE_H
+#define ALAC_CACHE_H
+
+
+#include "ALAC_Thread.h"
+
+#include <stdint.h>
+
+#include <map>
+
+
+// Decoded packets, stored as planar float in Premiere's channel order,
+// so they can be copied straight into an imImportAudioRec7 buffer.
+// Oldest packets get thrown out when we go over budget.
+// If given a file ID, we also share packets with other processes
+// through ALAC_SharedCache.
+// Safe to use from more than one thread.
+
+class ALAC_PacketCache
+{
+  public:
+	ALAC_PacketCache(int channels, size_t max_bytes, uint64_t shared_id = 0);
+	~ALAC_PacketCache();
+	
+	bool Has(uint32_t packet);
+	
+	// Copies samples out of a packet, starting at skip.
+	// Returns the number of samples copied, or -1 if the packet isn't here.
+	int Read(uint32_t packet, float **out, int64_t out_pos, int skip, int samples);
+	
+	void Store(uint32_t packet, const float * const *in, int samples);
+	
+  private:
+	typedef struct
+	{
+		float		*buf;
+		int			samples;
+		uint32_t	last_used;
+	} Entry;
+	
+	typedef std::map<uint32_t, Entry> EntryMap;
+	
+	int Copy(Entry &entry, float **out, int64_t out_pos, int skip, int samples);
+	Entry & Insert(uint32_t packet, float *buf, int samples);
+	void Trim();
+	
+	const int _channels;
+	const size_t _max_bytes;
+	const uint64_t _shared_id;
+	
+	size_t _bytes;
+	uint32_t _clock;
+	EntryMap _entries;
+	
+	ALAC_Mutex _mutex;
+};
+
+
+#endif // ALAC_CACHE_H
\ No newline at end of file
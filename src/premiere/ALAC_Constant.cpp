@@ -0,0 +1,894 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Constant.h"
+
+#include "ALACDecoder.h"
+#include "ALACBitUtilities.h"
+
+#include <string.h>
+
+#include <vector>
+
+
+// These come from Apple's adaptive Golomb coder (ag_enc.c and ag_dec.c)
+// and have to match it exactly
+#define AG_QBSHIFT			9
+#define AG_QB				(1 << AG_QBSHIFT)
+#define AG_MMULSHIFT		2
+#define AG_MDENSHIFT		(AG_QBSHIFT - AG_MMULSHIFT - 1)
+#define AG_MOFF				(1 << (AG_MDENSHIFT - 2))
+#define AG_BITOFF			24
+#define AG_MAX_PREFIX		9
+#define AG_ESCAPE_BITS_16	16
+#define AG_MAX_CODE_BITS	25
+#define AG_MEAN_CLAMP		0xffff
+#define AG_MAX_RUN			65535
+
+// What ALACEncoder puts in a channel header
+#define ALAC_DENSHIFT		9
+#define ALAC_PB_FACTOR		4
+
+
+// Apple's channel layouts, as the element that starts at each channel
+static const uint32_t channel_maps[kALACMaxChannels] =
+{
+	ID_SCE,
+	ID_CPE,
+	(ID_CPE << 3) | (ID_SCE),
+	(ID_SCE << 9) | (ID_CPE << 3) | (ID_SCE),
+	(ID_CPE << 9) | (ID_CPE << 3) | (ID_SCE),
+	(ID_SCE << 15) | (ID_CPE << 9) | (ID_CPE << 3) | (ID_SCE),
+	(ID_SCE << 18) | (ID_SCE << 15) | (ID_CPE << 9) | (ID_CPE << 3) | (ID_SCE),
+	(ID_SCE << 21) | (ID_CPE << 15) | (ID_CPE << 9) | (ID_CPE << 3) | (ID_SCE)
+};
+
+
+static inline int
+Lead(uint32_t x)
+{
+	int zeros = 0;
+	
+	for(uint32_t bit = 0x80000000; bit != 0 && !(x & bit); bit >>= 1)
+		zeros++;
+	
+	return zeros;
+}
+
+
+static inline uint32_t
+RiceK(uint32_t mb, uint32_t kb)
+{
+	const uint32_t k = 31 - Lead((mb >> AG_QBSHIFT) + 3);
+	
+	return (k > kb ? kb : k);
+}
+
+
+static inline uint32_t
+RunK(uint32_t mb)
+{
+	return Lead(mb) - AG_BITOFF + ((mb + AG_MOFF) >> AG_MDENSHIFT);
+}
+
+
+static inline int32_t
+SignExtend(int32_t value, int bits)
+{
+	return (bits >= 32 ? value : (int32_t)((uint32_t)value << (32 - bits)) >> (32 - bits));
+}
+
+
+class BitWriter
+{
+  public:
+	BitWriter(uint8_t *buf, int32_t size) : _buf(buf), _bits((uint32_t)size * 8), _pos(0) { memset(buf, 0, size); }
+	
+	void Write(uint32_t value, int count);
+	
+	bool Overflow() const { return (_pos > _bits); }
+	int32_t Bytes() const { return (_pos + 7) / 8; }
+	
+  private:
+	uint8_t * const _buf;
+	const uint32_t _bits;
+	uint32_t _pos;
+};
+
+
+void
+BitWriter::Write(uint32_t value, int count)
+{
+	for(int i = count - 1; i >= 0; i--, _pos++)
+	{
+		if(_pos < _bits && ((value >> i) & 1))
+			_buf[_pos >> 3] |= (0x80 >> (_pos & 7));
+	}
+}
+
+
+// Past the end reads as zeros, check Overrun() when it matters
+class BitReader
+{
+  public:
+	BitReader(const uint8_t *buf, uint32_t size) : _buf(buf), _bits(size * 8), _pos(0) {}
+	
+	uint32_t Peek(int count) const;
+	uint32_t Read(int count) { const uint32_t value = Peek(count); _pos += count; return value; }
+	void Skip(uint32_t count) { _pos += count; }
+	
+	// 1 bits in a row, up to max
+	int Ones(int max) const;
+	
+	bool Overrun() const { return (_pos > _bits); }
+	uint32_t Bytes() const { return (_pos + 7) / 8; }
+	
+  private:
+	bool Bit(uint32_t pos) const { return (pos < _bits && (_buf[pos >> 3] & (0x80 >> (pos & 7)))); }
+	
+	const uint8_t * const _buf;
+	const uint32_t _bits;
+	uint32_t _pos;
+};
+
+
+uint32_t
+BitReader::Peek(int count) const
+{
+	uint32_t value = 0;
+	
+	for(int i=0; i < count; i++)
+		value = (value << 1) | (Bit(_pos + i) ? 1 : 0);
+	
+	return value;
+}
+
+
+int
+BitReader::Ones(int max) const
+{
+	int ones = 0;
+	
+	while(ones < max && Bit(_pos + ones))
+		ones++;
+	
+	return ones;
+}
+
+
+// dyn_code_32bit() and dyn_code() in ag_enc.c, the only difference
+// is how many bits an escaped value gets
+static void
+WriteCode(BitWriter &bits, uint32_t m, uint32_t k, uint32_t n, int escape_bits)
+{
+	const uint32_t division = n / m;
+	
+	if(division < AG_MAX_PREFIX)
+	{
+		const uint32_t modulo = n - (m * division);
+		const uint32_t de = (modulo == 0);
+		const uint32_t num_bits = division + k + 1 - de;
+		
+		if(num_bits <= AG_MAX_CODE_BITS)
+		{
+			bits.Write((((1u << division) - 1) << (num_bits - division)) + modulo + 1 - de, num_bits);
+			
+			return;
+		}
+	}
+	
+	bits.Write((1u << AG_MAX_PREFIX) - 1, AG_MAX_PREFIX);
+	bits.Write(n, escape_bits);
+}
+
+
+// dyn_get_32bit() in ag_dec.c
+static uint32_t
+ReadCode32(BitReader &bits, uint32_t m, uint32_t k, int escape_bits)
+{
+	const int prefix = bits.Ones(AG_MAX_PREFIX);
+	
+	if(prefix >= AG_MAX_PREFIX)
+	{
+		bits.Skip(AG_MAX_PREFIX);
+		
+		return bits.Read(escape_bits);
+	}
+	
+	bits.Skip(prefix + 1);
+	
+	if(k == 1)
+		return prefix;
+	
+	const uint32_t v = bits.Peek(k);
+	
+	bits.Skip(v >= 2 ? k : k - 1);
+	
+	return (prefix * m) + (v >= 2 ? v - 1 : 0);
+}
+
+
+// dyn_get() in ag_dec.c, for zero runs
+static uint32_t
+ReadCode16(BitReader &bits, uint32_t m, uint32_t k)
+{
+	const int prefix = bits.Ones(AG_MAX_PREFIX);
+	
+	if(prefix >= AG_MAX_PREFIX)
+	{
+		bits.Skip(AG_MAX_PREFIX);
+		
+		return bits.Read(AG_ESCAPE_BITS_16);
+	}
+	
+	bits.Skip(prefix + 1);
+	
+	const uint32_t v = bits.Peek(k);
+	
+	bits.Skip(v >= 2 ? k : k - 1);
+	
+	return (prefix * m) + (v >= 2 ? v - 1 : 0);
+}
+
+
+// What dyn_comp() makes of one value and then zeros
+static bool
+WriteResidual(BitWriter &bits, const ALACSpecificConfig &config, int32_t value, int samples, int chan_bits)
+{
+	const uint32_t pb = (config.pb * ALAC_PB_FACTOR) / 4;
+	const uint32_t kb = config.kb;
+	const uint32_t wb = (1u << kb) - 1;
+	
+	uint32_t mb = config.mb;
+	
+	int c = 0;
+	
+	while(c < samples)
+	{
+		const int32_t del = (c == 0 ? value : 0);
+		
+		const uint32_t n = (del < 0 ? ((uint32_t)-del << 1) - 1 : (uint32_t)del << 1);
+		
+		const uint32_t k = RiceK(mb, kb);
+		
+		WriteCode(bits, (1u << k) - 1, k, n, chan_bits);
+		
+		c++;
+		
+		mb = (pb * n) + mb - ((pb * mb) >> AG_QBSHIFT);
+		
+		if(n > AG_MEAN_CLAMP)
+			mb = AG_MEAN_CLAMP;
+		
+		if((mb << AG_MMULSHIFT) < AG_QB && c < samples)
+		{
+			// only zeros left
+			const uint32_t run = (samples - c > AG_MAX_RUN ? AG_MAX_RUN : samples - c);
+			
+			const uint32_t run_k = RunK(mb);
+			const uint32_t m = ((1u << run_k) - 1) & wb;
+			
+			if(m == 0)
+				return false;
+			
+			WriteCode(bits, m, run_k, run, AG_ESCAPE_BITS_16);
+			
+			c += run;
+			
+			mb = 0;
+		}
+	}
+	
+	return true;
+}
+
+
+// Follows dyn_decomp() as long as the residual is a first value and then
+// zeros.  The first time it isn't, the packet isn't constant.
+static bool
+ReadResidual(BitReader &bits, const ALACSpecificConfig &config, uint32_t pb_factor,
+				int samples, int chan_bits, int32_t &first)
+{
+	const uint32_t pb = (config.pb * pb_factor) / 4;
+	const uint32_t kb = config.kb;
+	const uint32_t wb = (1u << kb) - 1;
+	
+	uint32_t mb = config.mb;
+	uint32_t zmode = 0;
+	
+	first = 0;
+	
+	int c = 0;
+	
+	while(c < samples)
+	{
+		const uint32_t k = RiceK(mb, kb);
+		
+		const uint32_t n = ReadCode32(bits, (1u << k) - 1, k, chan_bits);
+		
+		const uint32_t ndecode = n + zmode;
+		
+		const int32_t del = (int32_t)((ndecode + 1) >> 1) * ((ndecode & 1) ? -1 : 1);
+		
+		if(c == 0)
+			first = del;
+		else if(del != 0)
+			return false;
+		
+		c++;
+		
+		mb = (pb * ndecode) + mb - ((pb * mb) >> AG_QBSHIFT);
+		
+		if(n > AG_MEAN_CLAMP)
+			mb = AG_MEAN_CLAMP;
+		
+		zmode = 0;
+		
+		if((mb << AG_MMULSHIFT) < AG_QB && c < samples)
+		{
+			zmode = 1;
+			
+			const uint32_t run_k = RunK(mb);
+			
+			const uint32_t run = ReadCode16(bits, ((1u << run_k) - 1) & wb, run_k);
+			
+			if(run > (uint32_t)(samples - c))
+				return false;
+			
+			c += run;
+			
+			if(run >= AG_MAX_RUN)
+				zmode = 0;
+			
+			mb = 0;
+		}
+		
+		if( bits.Overrun() )
+			return false;
+	}
+	
+	return true;
+}
+
+
+// Does unpc_block() turn a residual of first and then zeros into a constant?
+static bool
+Carried(int32_t first, uint32_t mode, uint32_t num, uint32_t den_shift, int samples, int chan_bits)
+{
+	// only the first sample gets to skip being cut down to chanBits
+	if(first != SignExtend(first, chan_bits))
+		return false;
+	
+	// the predictor rounds with 1 << (denShift - 1)
+	if(num != 0 && num != 31 && den_shift == 0)
+		return false;
+	
+	if(first == 0 || samples == 1)
+		return true;
+	
+	// mode 0 carries the first sample forward with any predictor, the
+	// other mode sums the residual first, so it needs no predictor after
+	return (mode == 0 ? num != 0 : num == 0);
+}
+
+
+// One sample of one channel in the encoder's input format
+static inline int32_t
+ReadInput(const uint8_t *input, int n, int bit_depth)
+{
+	if(bit_depth == 16)
+		return ((const int16_t *)input)[n];
+	
+	// 3 bytes, little-endian, 20-bit is left-justified
+	const uint8_t *in = input + (n * 3);
+	
+	const int32_t val = SignExtend(in[0] | (in[1] << 8) | (in[2] << 16), 24);
+	
+	return (bit_depth == 20 ? val >> 4 : val);
+}
+
+
+static inline void
+WriteInput(uint8_t *input, int n, int bit_depth, int32_t value)
+{
+	if(bit_depth == 16)
+	{
+		((int16_t *)input)[n] = value;
+	}
+	else
+	{
+		const uint32_t val = (uint32_t)value << (bit_depth == 20 ? 4 : 0);
+		
+		uint8_t *in = input + (n * 3);
+		
+		in[0] = val & 0xff;
+		in[1] = (val >> 8) & 0xff;
+		in[2] = (val >> 16) & 0xff;
+	}
+}
+
+
+// Does ALACDecoder get these interleaved values back from the packet?
+static bool
+DecodesTo(ALACDecoder &decoder, uint8_t *packet, int32_t size, const int32_t *values, int samples)
+{
+	const ALACSpecificConfig &config = decoder.mConfig;
+	
+	const int channels = config.numChannels;
+	const size_t sample_bytes = channels * (config.bitDepth == 16 ? 2 : 3);
+	
+	std::vector<uint8_t> decoded(config.frameLength * channels * 4);
+	std::vector<uint8_t> expected(samples * sample_bytes);
+	
+	BitBuffer bits;
+	BitBufferInit(&bits, packet, size);
+	
+	uint32_t decoded_samples = 0;
+	
+	if(decoder.Decode(&bits, &decoded[0], config.frameLength, channels, &decoded_samples) != 0 ||
+		decoded_samples != (uint32_t)samples)
+	{
+		return false;
+	}
+	
+	for(int i=0; i < samples; i++)
+		ALAC_ConstantCoder::DecodedSample(config, values + (i * channels), &expected[i * sample_bytes]);
+	
+	return (memcmp(&decoded[0], &expected[0], samples * sample_bytes) == 0);
+}
+
+
+ALAC_ConstantCoder::ALAC_ConstantCoder() :
+	_ready(false),
+	_ok(false),
+	_escape_ok(false)
+{
+	memset(&_config, 0, sizeof(_config));
+}
+
+
+void
+ALAC_ConstantCoder::Init(const void *magic_cookie, uint32_t magic_cookie_size)
+{
+	_ready = true;
+	_ok = false;
+	_escape_ok = false;
+	
+	ALACDecoder decoder;
+	
+	if(decoder.Init((void *)magic_cookie, magic_cookie_size) != 0)
+		return;
+	
+	_config = decoder.mConfig;
+	
+	const int bit_depth = _config.bitDepth;
+	const int channels = _config.numChannels;
+	const int frame_length = _config.frameLength;
+	
+	// 32-bit would need 33 bits for a pair, which ALACEncoder doesn't do either
+	if((bit_depth != 16 && bit_depth != 20 && bit_depth != 24) ||
+		channels < 1 || channels > kALACMaxChannels ||
+		frame_length < 1 || _config.kb < 1 || _config.kb > 16)
+	{
+		return;
+	}
+	
+	// Build some packets and make sure ALACDecoder gets back what went in,
+	// at full length and short
+	const int32_t max_value = (1 << (bit_depth - 1)) - 1;
+	const int32_t min_value = -max_value - 1;
+	
+	const int bytes_per_sample = (bit_depth == 16 ? 2 : 3);
+	
+	std::vector<uint8_t> input(frame_length * channels * bytes_per_sample);
+	std::vector<uint8_t> packet(input.size() + (kALACMaxEscapeHeaderBytes * kALACMaxChannels));
+	std::vector<int32_t> values(frame_length * channels);
+	
+	const int lengths[] = { frame_length, (frame_length / 2) + 1, 1 };
+	
+	bool ok = true;
+	bool escape_ok = true;
+	
+	for(int l=0; l < 3; l++)
+	{
+		const int samples = lengths[l];
+		
+		// Constant packets, and Decode() has to agree too
+		for(int p=0; p < 4 && ok; p++)
+		{
+			int32_t value[kALACMaxChannels];
+			
+			for(int c=0; c < channels; c++)
+			{
+				const bool odd = (c & 1);
+				
+				value[c] = (p == 0 ? 0 :
+							p == 1 ? (odd ? -(c + 1) : (c + 1)) :
+							p == 2 ? (odd ? min_value : max_value) :
+							(odd ? max_value : min_value) / (c + 2));
+			}
+			
+			for(int i=0; i < samples; i++)
+				memcpy(&values[i * channels], value, channels * sizeof(int32_t));
+			
+			const int32_t size = Build(value, samples, &packet[0], packet.size());
+			
+			int32_t parsed[kALACMaxChannels];
+			int parsed_samples = 0;
+			
+			ok = (size > 0 && DecodesTo(decoder, &packet[0], size, &values[0], samples) &&
+					Parse(&packet[0], size, parsed, parsed_samples) && parsed_samples == samples &&
+					memcmp(parsed, value, channels * sizeof(int32_t)) == 0);
+		}
+		
+		// Escaped packets, with the extremes and something noisy in between
+		if(escape_ok)
+		{
+			uint32_t noise = 12345;
+			
+			for(int n=0; n < samples * channels; n++)
+			{
+				noise = (noise * 1103515245) + 12345;
+				
+				values[n] = (n % 7 == 0 ? max_value :
+								n % 7 == 1 ? min_value :
+								SignExtend(noise >> 8, bit_depth));
+				
+				WriteInput(&input[0], n, bit_depth, values[n]);
+			}
+			
+			const int32_t size = BuildEscape(&input[0], samples, &packet[0], packet.size());
+			
+			escape_ok = (size > 0 && DecodesTo(decoder, &packet[0], size, &values[0], samples));
+		}
+	}
+	
+	_ok = ok;
+	_escape_ok = escape_ok;
+}
+
+
+int32_t
+ALAC_ConstantCoder::Encode(const uint8_t *input, int samples, uint8_t *output, int32_t size) const
+{
+	if(!_ok || samples < 1 || samples > (int)_config.frameLength)
+		return 0;
+	
+	const int channels = _config.numChannels;
+	const int sample_bytes = channels * (_config.bitDepth == 16 ? 2 : 3);
+	
+	// every sample is the same as the one before it
+	if(memcmp(input, input + sample_bytes, (samples - 1) * sample_bytes) != 0)
+		return 0;
+	
+	int32_t value[kALACMaxChannels];
+	
+	for(int c=0; c < channels; c++)
+		value[c] = ReadInput(input, c, _config.bitDepth);
+	
+	return Build(value, samples, output, size);
+}
+
+
+int32_t
+ALAC_ConstantCoder::Escape(const uint8_t *input, int samples, uint8_t *output, int32_t size) const
+{
+	if(!_escape_ok || samples < 1 || samples > (int)_config.frameLength)
+		return 0;
+	
+	return BuildEscape(input, samples, output, size);
+}
+
+
+// What ALACEncoder's EncodeStereoEscape() and the escape in EncodeMono()
+// write: the element header with the escape bit, then the samples,
+// interleaved within the element, at the file's bit depth
+int32_t
+ALAC_ConstantCoder::BuildEscape(const uint8_t *input, int samples, uint8_t *output, int32_t size) const
+{
+	BitWriter bits(output, size);
+	
+	const int channels = _config.numChannels;
+	const int bit_depth = _config.bitDepth;
+	const bool partial = (samples != (int)_config.frameLength);
+	
+	int mono_tag = 0;
+	int stereo_tag = 0;
+	
+	for(int channel=0; channel < channels; )
+	{
+		const uint32_t tag = (channel_maps[channels - 1] >> (channel * 3)) & 0x7;
+		
+		const int n = (tag == ID_CPE ? 2 : 1);
+		
+		bits.Write(tag, 3);
+		bits.Write(tag == ID_CPE ? stereo_tag++ : mono_tag++, 4);
+		
+		bits.Write(0, 12);
+		bits.Write((partial ? (1 << 3) : 0) | 0x1, 4);
+		
+		if(partial)
+			bits.Write(samples, 32);
+		
+		for(int i=0; i < samples; i++)
+		{
+			for(int k=0; k < n; k++)
+				bits.Write(ReadInput(input, (i * channels) + channel + k, bit_depth), bit_depth);
+		}
+		
+		channel += n;
+	}
+	
+	bits.Write(ID_END, 3);
+	
+	return (bits.Overflow() ? 0 : bits.Bytes());
+}
+
+
+int32_t
+ALAC_ConstantCoder::Build(const int32_t value[], int samples, uint8_t *output, int32_t size) const
+{
+	BitWriter bits(output, size);
+	
+	const int channels = _config.numChannels;
+	const bool partial = (samples != (int)_config.frameLength);
+	
+	int mono_tag = 0;
+	int stereo_tag = 0;
+	
+	for(int channel=0; channel < channels; )
+	{
+		const uint32_t tag = (channel_maps[channels - 1] >> (channel * 3)) & 0x7;
+		
+		const int n = (tag == ID_CPE ? 2 : 1);
+		
+		bits.Write(tag, 3);
+		bits.Write(tag == ID_CPE ? stereo_tag++ : mono_tag++, 4);
+		
+		bits.Write(0, 12);
+		bits.Write(partial ? (1 << 3) : 0, 4); // no shift, not escaped
+		
+		if(partial)
+			bits.Write(samples, 32);
+		
+		// no mixing
+		bits.Write(0, 8);
+		bits.Write(0, 8);
+		
+		// Mode 0 with one coefficient of 0 carries the first sample
+		// all the way through.  Zeros don't need even that.
+		for(int k=0; k < n; k++)
+		{
+			const bool carry = (value[channel + k] != 0 && samples > 1);
+			
+			bits.Write((0 << 4) | ALAC_DENSHIFT, 8);
+			bits.Write((ALAC_PB_FACTOR << 5) | (carry ? 1 : 0), 8);
+			
+			if(carry)
+				bits.Write(0, 16);
+		}
+		
+		const int chan_bits = _config.bitDepth + (n - 1);
+		
+		for(int k=0; k < n; k++)
+		{
+			if( !WriteResidual(bits, _config, value[channel + k], samples, chan_bits) )
+				return 0;
+		}
+		
+		channel += n;
+	}
+	
+	bits.Write(ID_END, 3);
+	
+	return (bits.Overflow() ? 0 : bits.Bytes());
+}
+
+
+bool
+ALAC_ConstantCoder::Decode(const uint8_t *packet, uint32_t size, int32_t value[], int &samples) const
+{
+	return (_ok && Parse(packet, size, value, samples));
+}
+
+
+bool
+ALAC_ConstantCoder::Parse(const uint8_t *packet, uint32_t size, int32_t value[], int &samples) const
+{
+	// keeps the bit positions in 32 bits
+	if(size > 0x10000000)
+		return false;
+	
+	BitReader bits(packet, size);
+	
+	const int channels = _config.numChannels;
+	const int bit_depth = _config.bitDepth;
+	
+	int frame_samples = 0;
+	int channel = 0;
+	
+	while(true)
+	{
+		const uint32_t tag = bits.Read(3);
+		
+		if(tag == ID_END)
+			break;
+		
+		if(tag != ID_SCE && tag != ID_LFE && tag != ID_CPE)
+			return false;
+		
+		const int n = (tag == ID_CPE ? 2 : 1);
+		
+		if(channel + n > channels)
+			return false;
+		
+		bits.Skip(4); // instance tag
+		
+		if(bits.Read(12) != 0)
+			return false;
+		
+		const uint32_t header = bits.Read(4);
+		
+		const uint32_t shift = ((header >> 1) & 0x3) * 8;
+		
+		// escaped is just PCM, that's for the decoder
+		if((header & 0x1) || shift == 24 || (shift != 0 && bit_depth < 24))
+			return false;
+		
+		const uint32_t count = ((header & 0x8) ? bits.Read(32) : _config.frameLength);
+		
+		if(count < 1 || count > _config.frameLength || (frame_samples != 0 && count != (uint32_t)frame_samples))
+			return false;
+		
+		frame_samples = count;
+		
+		const int mix_bits = bits.Read(8);
+		const int mix_res = (int8_t)bits.Read(8);
+		
+		if(n == 2 && mix_res != 0 && mix_bits > 31)
+			return false;
+		
+		uint32_t mode[2], den_shift[2], pb_factor[2], num[2];
+		
+		for(int k=0; k < n; k++)
+		{
+			const uint32_t mode_byte = bits.Read(8);
+			const uint32_t pb_byte = bits.Read(8);
+			
+			mode[k] = mode_byte >> 4;
+			den_shift[k] = mode_byte & 0xf;
+			pb_factor[k] = pb_byte >> 5;
+			num[k] = pb_byte & 0x1f;
+			
+			bits.Skip(num[k] * 16);
+		}
+		
+		// The shift bits come first, but the residual is what usually says
+		// this isn't constant, so come back to them
+		BitReader shift_bits = bits;
+		
+		bits.Skip(shift * n * count);
+		
+		const int chan_bits = bit_depth - shift + (n - 1);
+		
+		int32_t mixed[2];
+		
+		for(int k=0; k < n; k++)
+		{
+			if(!ReadResidual(bits, _config, pb_factor[k], count, chan_bits, mixed[k]) ||
+				!Carried(mixed[k], mode[k], num[k], den_shift[k], count, chan_bits))
+			{
+				return false;
+			}
+		}
+		
+		uint32_t low[2] = { 0, 0 };
+		
+		if(shift != 0)
+		{
+			for(int k=0; k < n; k++)
+				low[k] = shift_bits.Read(shift);
+			
+			for(uint32_t i=1; i < count; i++)
+			{
+				for(int k=0; k < n; k++)
+				{
+					if(shift_bits.Read(shift) != low[k])
+						return false;
+				}
+			}
+		}
+		
+		// unmix16() and friends
+		int32_t out[2] = { mixed[0], mixed[1] };
+		
+		if(n == 2 && mix_res != 0)
+		{
+			const int32_t product = (int32_t)((uint32_t)mix_res * (uint32_t)mixed[1]);
+			
+			out[0] = mixed[0] + mixed[1] - (product >> mix_bits);
+			out[1] = out[0] - mixed[1];
+		}
+		
+		for(int k=0; k < n; k++)
+		{
+			const int32_t val = (shift != 0 ? (int32_t)(((uint32_t)out[k] << shift) | low[k]) : out[k]);
+			
+			value[channel + k] = SignExtend(val, bit_depth);
+		}
+		
+		channel += n;
+	}
+	
+	// ALACEncoder ends with ID_END and pads to a byte
+	if(channel != channels || bits.Overrun() || bits.Bytes() != size)
+		return false;
+	
+	samples = frame_samples;
+	
+	return true;
+}
+
+
+void
+ALAC_ConstantCoder::DecodedSample(const ALACSpecificConfig &config, const int32_t value[], uint8_t *out)
+{
+	for(int c=0; c < config.numChannels; c++)
+	{
+		if(config.bitDepth == 16)
+		{
+			((int16_t *)out)[c] = value[c];
+		}
+		else if(config.bitDepth == 32)
+		{
+			((int32_t *)out)[c] = value[c];
+		}
+		else
+		{
+			// the other way around from ALAC_Sample<>::Read()
+			int32_t val = (uint32_t)value[c] << (32 - config.bitDepth);
+			
+			const uint8_t *buf = (const uint8_t *)&val;
+			
+			out[(c * 3) + 0] = buf[1];
+			out[(c * 3) + 1] = buf[2];
+			out[(c * 3) + 2] = buf[3];
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_CONSTANT_H
+#define ALAC_CONSTANT_H
+
+
+#include "ALACAudioTypes.h"
+
+#include <stdint.h>
+
+
+// A frame where every channel holds one value all the way through (digital
+// silence, mostly) doesn't need ALACEncoder's search.  With no mixing, a
+// predictor that carries the first sample forward leaves one residual and
+// then zeros, which the entropy coder sends as a single run.  So that packet
+// can be written straight from the ALAC frame format, and going the other
+// way, the element headers and the start of the residual say whether a
+// packet is one of these before anything gets decoded.
+//
+// It also writes escaped packets, the PCM with element headers, for a
+// frame there's no time to encode (see ALAC_EncodePipeline's budgets).
+//
+// The packets are run past ALACDecoder once for each config before any are
+// used, and if they don't come back right, OK() is false and everything
+// goes through the codec like before.  That only depends on the config, so
+// every encoder with the same settings makes the same choice.
+
+class ALAC_ConstantCoder
+{
+  public:
+	ALAC_ConstantCoder();
+	~ALAC_ConstantCoder() {}
+	
+	// Checks the packets against ALACDecoder, using the encoder's cookie
+	void Init(const void *magic_cookie, uint32_t magic_cookie_size);
+	
+	bool Ready() const { return _ready; }
+	bool OK() const { return _ok; }
+	bool EscapeOK() const { return _escape_ok; }
+	
+	// input is interleaved, the way ALACEncoder takes it.  Returns the
+	// packet size, or 0 if the frame isn't constant or can't be done here.
+	int32_t Encode(const uint8_t *input, int samples, uint8_t *output, int32_t size) const;
+	
+	// Any frame as an escaped packet, returns the size or 0
+	int32_t Escape(const uint8_t *input, int samples, uint8_t *output, int32_t size) const;
+	
+	// If the packet decodes to one value per channel, gets the values
+	// and the number of samples.  Values are at the file's bit depth.
+	bool Decode(const uint8_t *packet, uint32_t size, int32_t value[], int &samples) const;
+	
+	// One interleaved sample the way ALACDecoder writes them
+	static void DecodedSample(const ALACSpecificConfig &config, const int32_t value[], uint8_t *out);
+	
+  private:
+	int32_t Build(const int32_t value[], int samples, uint8_t *output, int32_t size) const;
+	int32_t BuildEscape(const uint8_t *input, int samples, uint8_t *output, int32_t size) const;
+	bool Parse(const uint8_t *packet, uint32_t size, int32_t value[], int &samples) const;
+	
+	ALACSpecificConfig _config;
+	bool _ready;
+	bool _ok;
+	bool _escape_ok;
+};
+
+
+#endif // ALAC_CONSTANT_H
\ No newline at end of file
@@ -0,0 +1,689 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Decode.h"
+#include "ALAC_Constant.h"
+
+#include "ALACBitUtilities.h"
+#include "ALACDecoder.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+
+// Leave some CPU for Premiere
+#define ALAC_DECODE_MAX_WORKERS		8
+
+// If a worker sees more cookies than this, it starts over
+#define ALAC_DECODERS_PER_WORKER	32
+
+
+// for surround channels
+// Premiere uses Left, Right, Left Rear, Right Rear, Center, LFE
+// ALAC uses Center, Left, Right, Left Rear, Right Rear, LFE
+// http://alac.macosforge.org/trac/browser/trunk/ReadMe.txt
+static const int surround_swizzle[] = {4, 0, 1, 2, 3, 5};
+
+
+// Sample n of the decoder's interleaved output as a float.
+// Dividing by a power of two is exact, so multiplying by the inverse
+// gives the same answer the division would.
+template <int BITDEPTH>
+struct ALAC_Sample
+{
+	// Apparently with ALAC, 20-bit and 24-bit audio is packed into 3 bytes.
+	// Put 20/24 bit sample into 32-bits and then convert to float.
+	static inline float Read(const uint8_t *in, int n)
+	{
+		in += 3 * n;
+		
+		int32_t val = 0;
+		
+		uint8_t *buf = (uint8_t *)&val;
+		
+		// This is endian-dependant
+		buf[1] = in[0];
+		buf[2] = in[1];
+		buf[3] = in[2];
+		
+		// fill lower bits with high bits
+		uint32_t uval = val;
+		
+		uval |= (uval & 0x7fffffff) >> (BITDEPTH - 1);
+		
+		return (double)(int32_t)uval * (1.0 / 2147483648.0);
+	}
+};
+
+template <>
+struct ALAC_Sample<16>
+{
+	static inline float Read(const uint8_t *in, int n)
+	{
+		return (double)((const int16_t *)in)[n] * (1.0 / 32768.0);
+	}
+};
+
+template <>
+struct ALAC_Sample<32>
+{
+	static inline float Read(const uint8_t *in, int n)
+	{
+		return (double)((const int32_t *)in)[n] * (1.0 / 2147483648.0);
+	}
+};
+
+
+// With the bit depth and channel count fixed, the compiler can unroll
+// the channel loop and there's nothing left to decide per sample
+template <int BITDEPTH, int CHANNELS>
+static void
+ConvertSamples(const uint8_t *in, float **out, int samples)
+{
+	float *out_buffers[CHANNELS];
+	
+	for(int c=0; c < CHANNELS; c++)
+		out_buffers[c] = out[CHANNELS == 6 ? surround_swizzle[c] : c];
+	
+	for(int i=0; i < samples; i++)
+	{
+		for(int c=0; c < CHANNELS; c++)
+		{
+			out_buffers[c][i] = ALAC_Sample<BITDEPTH>::Read(in, (i * CHANNELS) + c);
+		}
+	}
+}
+
+
+typedef void (*ConvertFunc)(const uint8_t *in, float **out, int samples);
+
+
+template <int BITDEPTH>
+static ConvertFunc
+GetConvertFunc(int channels)
+{
+	return (channels == 1 ? ConvertSamples<BITDEPTH, 1> :
+			channels == 2 ? ConvertSamples<BITDEPTH, 2> :
+			channels == 6 ? ConvertSamples<BITDEPTH, 6> :
+			NULL);
+}
+
+
+// Picked once for each decoder, NULL if we don't have a kernel for it
+static ConvertFunc
+GetConvertFunc(const ALACSpecificConfig &config)
+{
+	return (config.bitDepth == 16 ? GetConvertFunc<16>(config.numChannels) :
+			config.bitDepth == 20 ? GetConvertFunc<20>(config.numChannels) :
+			config.bitDepth == 24 ? GetConvertFunc<24>(config.numChannels) :
+			config.bitDepth == 32 ? GetConvertFunc<32>(config.numChannels) :
+			NULL);
+}
+
+
+// Anything else Premiere won't play anyway, but we'll still decode it
+static void
+ConvertSamplesGeneric(const uint8_t *in, float **out, int channels, int bitDepth, int samples)
+{
+	// Only 5.1 gets reordered, every other layout (up to ALAC's 8 channels)
+	// goes straight through.  surround_swizzle only has 6 entries.
+	const bool surround = (channels == 6);
+	
+	for(int i=0; i < samples; i++)
+	{
+		for(int c=0; c < channels; c++)
+		{
+			const int n = (i * channels) + c;
+			
+			const int o = (surround ? surround_swizzle[c] : c);
+			
+			out[o][i] = (bitDepth == 16 ? ALAC_Sample<16>::Read(in, n) :
+							bitDepth == 32 ? ALAC_Sample<32>::Read(in, n) :
+							bitDepth == 20 ? ALAC_Sample<20>::Read(in, n) :
+							ALAC_Sample<24>::Read(in, n));
+		}
+	}
+}
+
+
+static size_t
+DecodeBufferSize(const ALACSpecificConfig &config)
+{
+	const size_t bytes_per_sample = (config.bitDepth <= 16 ? 2 : 4);
+	
+	return (config.frameLength * config.numChannels * bytes_per_sample) + kALACMaxEscapeHeaderBytes;
+}
+
+
+// Decode a whole packet into planar float buffers, Premiere channel order
+static bool
+DecodePacket(ALACDecoder &alac, ConvertFunc convert, const uint8_t *data, uint32_t data_size, uint8_t *alac_buffer,
+				float **out, int &samples)
+{
+	const int channels = alac.mConfig.numChannels;
+	
+	
+	BitBuffer bits;
+	BitBufferInit(&bits, (uint8_t *)data, data_size);
+
+	uint32_t outSamples = 0;
+
+	int32_t alac_result = alac.Decode(&bits, alac_buffer, alac.mConfig.frameLength, channels, &outSamples);
+	
+	if(alac_result != 0)
+		return false;
+	
+	
+	if(convert != NULL)
+	{
+		convert(alac_buffer, out, outSamples);
+	}
+	else
+	{
+		assert(alac.mConfig.bitDepth == 16 || alac.mConfig.bitDepth == 20 ||
+				alac.mConfig.bitDepth == 24 || alac.mConfig.bitDepth == 32);
+		
+		ConvertSamplesGeneric(alac_buffer, out, channels, alac.mConfig.bitDepth, outSamples);
+	}
+	
+	samples = outSamples;
+	
+	return true;
+}
+
+
+// A constant packet as floats, one for each channel in Premiere order.
+// Goes through the same conversion as a decoded sample.
+static void
+ConstantSamples(const ALACSpecificConfig &config, ConvertFunc convert, const int32_t value[], float result[])
+{
+	uint8_t sample[kALACMaxChannels * 4];
+	
+	ALAC_ConstantCoder::DecodedSample(config, value, sample);
+	
+	float *out[kALACMaxChannels];
+	
+	for(int c=0; c < kALACMaxChannels; c++)
+		out[c] = &result[c];
+	
+	if(convert != NULL)
+		convert(sample, out, 1);
+	else
+		ConvertSamplesGeneric(sample, out, config.numChannels, config.bitDepth, 1);
+}
+
+
+static int
+NumWorkers()
+{
+	const int workers = ALAC_Thread::Processors() - 1;
+	
+	return (workers < 2 ? 2 : workers > ALAC_DECODE_MAX_WORKERS ? ALAC_DECODE_MAX_WORKERS : workers);
+}
+
+
+class ALAC_DecodePool::Worker : public ALAC_Thread
+{
+  public:
+	Worker(ALAC_DecodePool &pool) : _pool(pool) {}
+	virtual ~Worker();
+	
+	bool Decode(const std::string &cookie, ALAC_DecodeJob &job);
+	
+  protected:
+	virtual void Run() { _pool.WorkerLoop(*this); }
+	
+  private:
+	typedef struct
+	{
+		ALACDecoder			*alac;
+		ConvertFunc			convert;
+		uint8_t				*buffer;
+		ALAC_ConstantCoder	*constant;
+		bool				constant_checked;
+	} Decoder;
+	
+	typedef std::map<std::string, Decoder> DecoderMap;
+	
+	void Clear();
+	
+	ALAC_DecodePool &_pool;
+	DecoderMap _decoders;
+};
+
+
+ALAC_DecodePool::Worker::~Worker()
+{
+	Join();
+	
+	Clear();
+}
+
+
+void
+ALAC_DecodePool::Worker::Clear()
+{
+	for(DecoderMap::iterator i = _decoders.begin(); i != _decoders.end(); ++i)
+	{
+		delete i->second.alac;
+		delete i->second.constant;
+		
+		free(i->second.buffer);
+	}
+	
+	_decoders.clear();
+}
+
+
+bool
+ALAC_DecodePool::Worker::Decode(const std::string &cookie, ALAC_DecodeJob &job)
+{
+	job.ok = false;
+	job.samples = 0;
+	
+	try
+	{
+		DecoderMap::iterator i = _decoders.find(cookie);
+		
+		if(i == _decoders.end())
+		{
+			if(_decoders.size() >= ALAC_DECODERS_PER_WORKER)
+				Clear();
+			
+			Decoder decoder;
+			
+			decoder.alac = new ALACDecoder;
+			decoder.convert = NULL;
+			decoder.buffer = NULL;
+			decoder.constant = NULL;
+			decoder.constant_checked = false;
+			
+			int32_t alac_result = decoder.alac->Init((void *)cookie.data(), cookie.size());
+			
+			if(alac_result == 0)
+			{
+				decoder.convert = GetConvertFunc(decoder.alac->mConfig);
+				decoder.buffer = (uint8_t *)malloc(DecodeBufferSize(decoder.alac->mConfig));
+				
+				decoder.constant = new ALAC_ConstantCoder;
+				decoder.constant->Init(cookie.data(), cookie.size());
+			}
+			
+			if(alac_result != 0 || decoder.buffer == NULL)
+			{
+				delete decoder.alac;
+				delete decoder.constant;
+				
+				if(decoder.buffer)
+					free(decoder.buffer);
+				
+				return false;
+			}
+			
+			i = _decoders.insert(DecoderMap::value_type(cookie, decoder)).first;
+		}
+		
+		Decoder &decoder = i->second;
+		
+		const int channels = decoder.alac->mConfig.numChannels;
+		
+		// A constant packet (silence, mostly) says so in its headers,
+		// so it can be filled in without decoding
+		int32_t value[kALACMaxChannels];
+		int samples = 0;
+		
+		if(decoder.constant != NULL && decoder.constant->Decode(job.data, job.size, value, samples))
+		{
+			float result[kALACMaxChannels];
+			
+			ConstantSamples(decoder.alac->mConfig, decoder.convert, value, result);
+			
+			if(decoder.constant_checked)
+			{
+				for(int c=0; c < channels; c++)
+				{
+					float *buf = job.out[c];
+					
+					for(int s=0; s < samples; s++)
+						*buf++ = result[c];
+				}
+				
+				job.samples = samples;
+				job.ok = true;
+			}
+			else
+			{
+				// The first one for this cookie gets decoded anyway, in case
+				// whatever wrote the file does something Decode() doesn't know
+				job.ok = DecodePacket(*decoder.alac, decoder.convert, job.data, job.size, decoder.buffer, job.out, job.samples);
+				
+				bool same = (job.ok && job.samples == samples);
+				
+				for(int c=0; c < channels && same; c++)
+				{
+					for(int s=0; s < samples && same; s++)
+						same = (job.out[c][s] == result[c]);
+				}
+				
+				if(job.ok)
+				{
+					if(!same)
+					{
+						delete decoder.constant;
+						decoder.constant = NULL;
+					}
+					
+					decoder.constant_checked = true;
+				}
+			}
+		}
+		else
+		{
+			job.ok = DecodePacket(*decoder.alac, decoder.convert, job.data, job.size, decoder.buffer, job.out, job.samples);
+		}
+	}
+	catch(...)
+	{
+		job.ok = false;
+	}
+	
+	return job.ok;
+}
+
+
+ALAC_DecodePool ALAC_DecodePool::_instance;
+
+
+ALAC_DecodePool::ALAC_DecodePool() :
+	_busy_background(0),
+	_quit(false),
+	_refs(0)
+{
+	for(int p=0; p < ALAC_PRIORITY_COUNT; p++)
+	{
+		_stats[p].packets = 0;
+		_stats[p].wait_ms = 0.0;
+		_stats[p].max_wait_ms = 0.0;
+		_stats[p].decode_ms = 0.0;
+	}
+}
+
+
+ALAC_DecodePool::~ALAC_DecodePool()
+{
+	assert(_workers.empty()); // somebody didn't Release()
+}
+
+
+void
+ALAC_DecodePool::Retain()
+{
+	ALAC_Lock refs_lock(_refs_mutex);
+	
+	if(_refs++ == 0)
+	{
+		const int count = NumWorkers();
+		
+		ALAC_Lock lock(_mutex);
+		
+		for(int i=0; i < count; i++)
+		{
+			Worker *worker = new Worker(*this);
+			
+			if( worker->Start() )
+				_workers.push_back(worker);
+			else
+				delete worker;
+		}
+	}
+}
+
+
+void
+ALAC_DecodePool::Release()
+{
+	ALAC_Lock refs_lock(_refs_mutex);
+	
+	assert(_refs > 0);
+	
+	if(--_refs == 0)
+	{
+		std::vector<Worker *> workers;
+		
+		{
+			ALAC_Lock lock(_mutex);
+			
+			_quit = true;
+			
+			workers.swap(_workers);
+			
+			_work_cond.Broadcast();
+		}
+		
+		for(std::vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i)
+		{
+			delete *i;
+		}
+		
+		ALAC_Lock lock(_mutex);
+		
+		_quit = false;
+	}
+}
+
+
+bool
+ALAC_DecodePool::Decode(const void *magic_cookie, size_t magic_cookie_size,
+						ALAC_DecodeJob *jobs, int count, ALAC_Priority priority)
+{
+	if(count <= 0)
+		return true;
+	
+	assert(priority >= 0 && priority < ALAC_PRIORITY_COUNT);
+	
+	Batch batch;
+	
+	batch.cookie.assign((const char *)magic_cookie, magic_cookie_size);
+	batch.remaining = count;
+	
+	bool pooled = false;
+	
+	{
+		ALAC_Lock lock(_mutex);
+		
+		if( !_workers.empty() )
+		{
+			const double now = ALAC_NowMs();
+			
+			for(int i=0; i < count; i++)
+			{
+				Task task;
+				
+				task.job = &jobs[i];
+				task.batch = &batch;
+				task.queued = now;
+				
+				_queues[priority].push_back(task);
+			}
+			
+			_work_cond.Broadcast();
+			
+			while(batch.remaining > 0)
+				_done_cond.Wait(_mutex);
+			
+			pooled = true;
+		}
+	}
+	
+	if(!pooled)
+	{
+		// no workers, do it ourselves
+		Worker worker(*this);
+		
+		for(int i=0; i < count; i++)
+		{
+			const double started = ALAC_NowMs();
+			
+			worker.Decode(batch.cookie, jobs[i]);
+			
+			const double finished = ALAC_NowMs();
+			
+			ALAC_Lock lock(_mutex);
+			
+			_stats[priority].packets++;
+			_stats[priority].decode_ms += (finished - started);
+		}
+	}
+	
+	bool ok = true;
+	
+	for(int i=0; i < count; i++)
+	{
+		if(!jobs[i].ok)
+			ok = false;
+	}
+	
+	return ok;
+}
+
+
+void
+ALAC_DecodePool::GetStats(ALAC_Priority priority, Stats &stats)
+{
+	assert(priority >= 0 && priority < ALAC_PRIORITY_COUNT);
+	
+	ALAC_Lock lock(_mutex);
+	
+	stats = _stats[priority];
+}
+
+
+bool
+ALAC_DecodePool::TakeTask(Task &task, ALAC_Priority &priority)
+{
+	// mutex must be locked
+	if( !_queues[ALAC_PRIORITY_PLAYBACK].empty() )
+	{
+		task = _queues[ALAC_PRIORITY_PLAYBACK].front();
+		_queues[ALAC_PRIORITY_PLAYBACK].pop_front();
+		
+		priority = ALAC_PRIORITY_PLAYBACK;
+		
+		return true;
+	}
+	
+	// everything else has to leave a worker free for playback
+	const int background_workers = (_workers.size() > 1 ? _workers.size() - 1 : 1);
+	
+	if(_busy_background < background_workers)
+	{
+		for(int p = ALAC_PRIORITY_RENDER; p < ALAC_PRIORITY_COUNT; p++)
+		{
+			if( !_queues[p].empty() )
+			{
+				task = _queues[p].front();
+				_queues[p].pop_front();
+				
+				priority = (ALAC_Priority)p;
+				
+				_busy_background++;
+				
+				return true;
+			}
+		}
+	}
+	
+	return false;
+}
+
+
+void
+ALAC_DecodePool::WorkerLoop(Worker &worker)
+{
+	ALAC_Lock lock(_mutex);
+	
+	while(true)
+	{
+		Task task;
+		ALAC_Priority priority = ALAC_PRIORITY_BACKGROUND;
+		
+		while(!_quit && !TakeTask(task, priority))
+			_work_cond.Wait(_mutex);
+		
+		if(_quit)
+			break;
+		
+		const double started = ALAC_NowMs();
+		
+		_mutex.Unlock();
+		
+		worker.Decode(task.batch->cookie, *task.job);
+		
+		const double finished = ALAC_NowMs();
+		
+		_mutex.Lock();
+		
+		
+		Stats &stats = _stats[priority];
+		
+		const double wait = started - task.queued;
+		
+		stats.packets++;
+		stats.wait_ms += wait;
+		stats.decode_ms += (finished - started);
+		
+		if(wait > stats.max_wait_ms)
+			stats.max_wait_ms = wait;
+		
+		
+		if(priority != ALAC_PRIORITY_PLAYBACK)
+		{
+			// somebody else might be waiting for this slot
+			_busy_background--;
+			
+			_work_cond.Broadcast();
+		}
+		
+		if(--task.batch->remaining == 0)
+			_done_cond.Broadcast();
+	}
+}
\ No newline at end of file
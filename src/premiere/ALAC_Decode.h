@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_DECODE_H
+#define ALAC_DECODE_H
+
+
+#include "ALAC_Thread.h"
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+
+// All the decoding for every open clip happens on one pool of threads,
+// so background work (warm start, scrub proxy) can never get in the way
+// of playback.  Playback jobs always go first and one worker is kept free
+// for them.  Each worker keeps its own ALACDecoder for every magic cookie
+// it has seen.
+
+typedef struct
+{
+	const uint8_t	*data;
+	uint32_t		size;
+	float			**out;		// planar, Premiere channel order, room for frameLength samples
+	int				samples;	// filled in
+	bool			ok;			// filled in
+} ALAC_DecodeJob;
+
+
+class ALAC_DecodePool
+{
+  public:
+	static ALAC_DecodePool & Instance() { return _instance; }
+	
+	// Workers start with the first clip opened and go away with the last one closed
+	void Retain();
+	void Release();
+	
+	// Decodes all the jobs, returns when they're done
+	bool Decode(const void *magic_cookie, size_t magic_cookie_size,
+				ALAC_DecodeJob *jobs, int count, ALAC_Priority priority);
+	
+	typedef struct
+	{
+		uint64_t	packets;
+		double		wait_ms;		// total time sitting in the queue
+		double		max_wait_ms;
+		double		decode_ms;		// total time actually decoding
+	} Stats;
+	
+	void GetStats(ALAC_Priority priority, Stats &stats);
+	
+  private:
+	ALAC_DecodePool();
+	~ALAC_DecodePool();
+	
+	class Worker;
+	friend class Worker;
+	
+	typedef struct
+	{
+		std::string		cookie;
+		int				remaining;
+	} Batch;
+	
+	typedef struct
+	{
+		ALAC_DecodeJob	*job;
+		Batch			*batch;
+		double			queued;
+	} Task;
+	
+	typedef std::deque<Task> TaskQueue;
+	
+	bool TakeTask(Task &task, ALAC_Priority &priority);
+	void WorkerLoop(Worker &worker);
+	
+	TaskQueue _queues[ALAC_PRIORITY_COUNT];
+	Stats _stats[ALAC_PRIORITY_COUNT];
+	
+	std::vector<Worker *> _workers;
+	int _busy_background;
+	bool _quit;
+	
+	ALAC_Mutex _mutex;
+	ALAC_Condition _work_cond;
+	ALAC_Condition _done_cond;
+	
+	int _refs;
+	ALAC_Mutex _refs_mutex;
+	
+	static ALAC_DecodePool _instance;
+};
+
+
+#endif // ALAC_DECODE_H
\ No newline at end of file
@@ -0,0 +1,880 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Demux.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+
+
+// Nobody's moov is bigger than this
+#define ALAC_MAX_MOOV_SIZE		(64 * 1024 * 1024)
+
+// ...or moof
+#define ALAC_MAX_MOOF_SIZE		(16 * 1024 * 1024)
+
+// tfhd flags
+#define ALAC_TFHD_BASE_DATA_OFFSET			0x000001
+#define ALAC_TFHD_SAMPLE_DESCRIPTION_INDEX	0x000002
+#define ALAC_TFHD_DEFAULT_SAMPLE_DURATION	0x000008
+#define ALAC_TFHD_DEFAULT_SAMPLE_SIZE		0x000010
+#define ALAC_TFHD_DEFAULT_SAMPLE_FLAGS		0x000020
+#define ALAC_TFHD_DEFAULT_BASE_IS_MOOF		0x020000
+
+// trun flags
+#define ALAC_TRUN_DATA_OFFSET				0x000001
+#define ALAC_TRUN_FIRST_SAMPLE_FLAGS		0x000004
+#define ALAC_TRUN_SAMPLE_DURATION			0x000100
+#define ALAC_TRUN_SAMPLE_SIZE				0x000200
+#define ALAC_TRUN_SAMPLE_FLAGS				0x000400
+#define ALAC_TRUN_SAMPLE_COMPOSITION		0x000800
+
+
+static inline uint16_t
+Get16(const uint8_t *p)
+{
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+
+static inline uint32_t
+Get32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+static inline uint64_t
+Get64(const uint8_t *p)
+{
+	return ((uint64_t)Get32(p) << 32) | Get32(p + 4);
+}
+
+
+// Steps through the boxes in [data, end), returns false when there are no more
+static bool
+NextBox(const uint8_t *&data, const uint8_t *end, uint32_t &type, const uint8_t *&body, const uint8_t *&body_end)
+{
+	if(end - data < 8)
+		return false;
+	
+	uint64_t size = Get32(data);
+	size_t header_size = 8;
+	
+	type = Get32(data + 4);
+	
+	if(size == 1)
+	{
+		if(end - data < 16)
+			return false;
+		
+		size = Get64(data + 8);
+		header_size = 16;
+	}
+	else if(size == 0)
+		size = end - data;
+	
+	if(size < header_size || size > (uint64_t)(end - data))
+		return false;
+	
+	body = data + header_size;
+	body_end = data + size;
+	
+	data = body_end;
+	
+	return true;
+}
+
+
+ALAC_PacketIndex::ALAC_PacketIndex() :
+	_time_scale(0),
+	_duration(0)
+{
+
+}
+
+
+bool
+ALAC_PacketIndex::Parse(AP4_ByteStream &stream)
+{
+	AP4_LargeSize file_size = 0;
+	
+	if(AP4_FAILED(stream.GetSize(file_size)))
+		return false;
+	
+	FragmentInfo info;
+	
+	bool got_movie = false;
+	
+	uint64_t pos = 0;
+	
+	while(pos + 8 <= file_size)
+	{
+		// Once we have the moov, we're only looking for fragments.  If the
+		// rest of the file is cut off or garbage, we have what we have.
+		uint8_t header[16];
+		
+		if(AP4_FAILED(stream.Seek(pos)) || AP4_FAILED(stream.Read(header, 8)))
+		{
+			if(got_movie)
+				break;
+			
+			return false;
+		}
+		
+		uint64_t size = Get32(header);
+		size_t header_size = 8;
+		
+		const uint32_t type = Get32(header + 4);
+		
+		if(size == 1)
+		{
+			if(AP4_FAILED(stream.Read(header + 8, 8)))
+			{
+				if(got_movie)
+					break;
+				
+				return false;
+			}
+			
+			size = Get64(header + 8);
+			header_size = 16;
+		}
+		else if(size == 0)
+			size = file_size - pos;
+		
+		if(size < header_size)
+		{
+			if(got_movie)
+				break;
+			
+			return false;
+		}
+		
+		if(type == AP4_ATOM_TYPE('m','o','o','v') && !got_movie)
+		{
+			if(size == header_size || size > ALAC_MAX_MOOV_SIZE)
+				return false;
+			
+			std::vector<uint8_t> moov(size - header_size);
+			
+			if(AP4_FAILED(stream.Read(&moov[0], moov.size())))
+				return false;
+			
+			if( !ParseMovie(&moov[0], &moov[0] + moov.size(), info) )
+				return false;
+			
+			if(!info.fragmented)
+				return true;
+			
+			got_movie = true;
+		}
+		else if(type == AP4_ATOM_TYPE('m','o','o','f') && got_movie)
+		{
+			// a moof that isn't all there is the end of the line
+			if(size == header_size || size > ALAC_MAX_MOOF_SIZE || size > file_size - pos)
+				break;
+			
+			std::vector<uint8_t> moof(size - header_size);
+			
+			if(AP4_FAILED(stream.Read(&moof[0], moof.size())))
+				break;
+			
+			if( !ParseFragment(&moof[0], &moof[0] + moof.size(), pos, file_size, info) )
+				break;
+		}
+		
+		pos += size;
+	}
+	
+	if(!got_movie || _packets.empty())
+		return false;
+	
+	// the mdhd of a fragmented file doesn't know how long it'll be
+	_duration = _packets.back().dts + _packets.back().duration;
+	
+	// we didn't know how many packets there'd be, so give back the extra room
+	std::vector<ALAC_Packet>(_packets).swap(_packets);
+	
+	return true;
+}
+
+
+bool
+ALAC_PacketIndex::ParseMovie(const uint8_t *data, const uint8_t *end, FragmentInfo &info)
+{
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	info.fragmented = false;
+	info.track_id = 0;
+	info.default_duration = 0;
+	info.default_size = 0;
+	
+	bool got_track = false;
+	
+	const uint8_t *mvex = NULL, *mvex_end = NULL;
+	
+	while( NextBox(data, end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('t','r','a','k') && !got_track)
+		{
+			// first ALAC track wins
+			got_track = ParseTrack(body, body_end, info.track_id);
+			
+			if(!got_track)
+			{
+				_magic_cookie.clear();
+				_packets.clear();
+			}
+		}
+		else if(type == AP4_ATOM_TYPE('m','v','e','x'))
+		{
+			mvex = body;
+			mvex_end = body_end;
+		}
+	}
+	
+	if(!got_track)
+		return false;
+	
+	if(mvex != NULL)
+	{
+		info.fragmented = true;
+		
+		while( NextBox(mvex, mvex_end, type, body, body_end) )
+		{
+			// version/flags, track_ID, default_sample_description_index,
+			// default_sample_duration, default_sample_size, default_sample_flags
+			if(type == AP4_ATOM_TYPE('t','r','e','x') && body_end - body >= 24 && Get32(body + 4) == info.track_id)
+			{
+				info.default_duration = Get32(body + 12);
+				info.default_size = Get32(body + 16);
+			}
+		}
+	}
+	
+	// without fragments, an empty track is no good
+	return (info.fragmented || !_packets.empty());
+}
+
+
+bool
+ALAC_PacketIndex::ParseTrack(const uint8_t *data, const uint8_t *end, uint32_t &track_id)
+{
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	const uint8_t *mdia = NULL, *mdia_end = NULL;
+	
+	track_id = 0;
+	
+	while( NextBox(data, end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('t','k','h','d'))
+		{
+			// version/flags, creation_time, modification_time, track_ID
+			if(body_end - body >= 24 && body[0] == 1)
+				track_id = Get32(body + 20);
+			else if(body_end - body >= 16 && body[0] == 0)
+				track_id = Get32(body + 12);
+		}
+		else if(type == AP4_ATOM_TYPE('m','d','i','a'))
+		{
+			mdia = body;
+			mdia_end = body_end;
+		}
+	}
+	
+	if(mdia == NULL)
+		return false;
+	
+	
+	uint32_t handler = 0;
+	uint32_t time_scale = 0;
+	uint64_t duration = 0;
+	
+	const uint8_t *stbl = NULL, *stbl_end = NULL;
+	
+	while( NextBox(mdia, mdia_end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('h','d','l','r'))
+		{
+			// version/flags, pre_defined, handler_type
+			if(body_end - body >= 12)
+				handler = Get32(body + 8);
+		}
+		else if(type == AP4_ATOM_TYPE('m','d','h','d'))
+		{
+			if(body_end - body >= 32 && body[0] == 1)
+			{
+				time_scale = Get32(body + 20);
+				duration = Get64(body + 24);
+			}
+			else if(body_end - body >= 20 && body[0] == 0)
+			{
+				time_scale = Get32(body + 12);
+				duration = Get32(body + 16);
+			}
+		}
+		else if(type == AP4_ATOM_TYPE('m','i','n','f'))
+		{
+			const uint8_t *minf = body, *minf_end = body_end;
+			
+			while( NextBox(minf, minf_end, type, body, body_end) )
+			{
+				if(type == AP4_ATOM_TYPE('s','t','b','l'))
+				{
+					stbl = body;
+					stbl_end = body_end;
+				}
+			}
+		}
+	}
+	
+	if(handler != AP4_ATOM_TYPE('s','o','u','n') || time_scale == 0 || stbl == NULL)
+		return false;
+	
+	_time_scale = time_scale;
+	_duration = duration;
+	
+	return ParseSampleTable(stbl, stbl_end);
+}
+
+
+// The cookie is in an alac box after the sample entry, or in a wave box in
+// QuickTime files.  Either way it starts after the version/flags.
+static bool
+FindCookie(const uint8_t *data, const uint8_t *end, const uint8_t *&cookie, const uint8_t *&cookie_end)
+{
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	while( NextBox(data, end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('a','l','a','c') && body_end - body > 4)
+		{
+			cookie = body + 4;
+			cookie_end = body_end;
+			
+			return true;
+		}
+		else if(type == AP4_ATOM_TYPE('w','a','v','e'))
+		{
+			if( FindCookie(body, body_end, cookie, cookie_end) )
+				return true;
+		}
+	}
+	
+	return false;
+}
+
+
+bool
+ALAC_PacketIndex::ParseSampleDescription(const uint8_t *data, const uint8_t *end)
+{
+	// version/flags, entry_count
+	if(end - data < 8 || Get32(data + 4) < 1)
+		return false;
+	
+	data += 8;
+	
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	if( !NextBox(data, end, type, body, body_end) || type != AP4_ATOM_TYPE('a','l','a','c') )
+		return false;
+	
+	// reserved, data_reference_index, then the sound sample entry,
+	// which is longer for QuickTime versions 1 and 2
+	if(body_end - body < 28)
+		return false;
+	
+	const uint16_t version = Get16(body + 8);
+	
+	const ptrdiff_t entry_size = 28 + (version == 1 ? 16 : version == 2 ? 36 : 0);
+	
+	if(body_end - body < entry_size)
+		return false;
+	
+	const uint8_t *cookie = NULL, *cookie_end = NULL;
+	
+	if( !FindCookie(body + entry_size, body_end, cookie, cookie_end) )
+		return false;
+	
+	_magic_cookie.assign(cookie, cookie_end);
+	
+	return true;
+}
+
+
+bool
+ALAC_PacketIndex::ParseSampleTable(const uint8_t *data, const uint8_t *end)
+{
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	const uint8_t *stts = NULL, *stts_end = NULL;
+	const uint8_t *stsc = NULL, *stsc_end = NULL;
+	const uint8_t *stsz = NULL, *stsz_end = NULL;
+	const uint8_t *stco = NULL, *stco_end = NULL;
+	bool co64 = false;
+	
+	bool got_description = false;
+	
+	while( NextBox(data, end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('s','t','s','d'))
+		{
+			got_description = ParseSampleDescription(body, body_end);
+		}
+		else if(type == AP4_ATOM_TYPE('s','t','t','s'))
+		{
+			stts = body;
+			stts_end = body_end;
+		}
+		else if(type == AP4_ATOM_TYPE('s','t','s','c'))
+		{
+			stsc = body;
+			stsc_end = body_end;
+		}
+		else if(type == AP4_ATOM_TYPE('s','t','s','z'))
+		{
+			stsz = body;
+			stsz_end = body_end;
+		}
+		else if(type == AP4_ATOM_TYPE('s','t','c','o') || type == AP4_ATOM_TYPE('c','o','6','4'))
+		{
+			stco = body;
+			stco_end = body_end;
+			co64 = (type == AP4_ATOM_TYPE('c','o','6','4'));
+		}
+	}
+	
+	if(!got_description || stts == NULL || stsc == NULL || stsz == NULL || stco == NULL)
+		return false;
+	
+	
+	// make sure all the tables are as big as they say they are
+	if(stts_end - stts < 8 || stsc_end - stsc < 8 || stsz_end - stsz < 12 || stco_end - stco < 8)
+		return false;
+	
+	const uint32_t stts_count = Get32(stts + 4);
+	const uint32_t stsc_count = Get32(stsc + 4);
+	const uint32_t sample_size = Get32(stsz + 4);
+	const uint32_t sample_count = Get32(stsz + 8);
+	const uint32_t chunk_count = Get32(stco + 4);
+	
+	const uint8_t *stts_table = stts + 8;
+	const uint8_t *stsc_table = stsc + 8;
+	const uint8_t *stsz_table = stsz + 12;
+	const uint8_t *stco_table = stco + 8;
+	
+	if((uint64_t)(stts_end - stts_table) < (uint64_t)stts_count * 8 ||
+		(uint64_t)(stsc_end - stsc_table) < (uint64_t)stsc_count * 12 ||
+		(sample_size == 0 && (uint64_t)(stsz_end - stsz_table) < (uint64_t)sample_count * 4) ||
+		(uint64_t)(stco_end - stco_table) < (uint64_t)chunk_count * (co64 ? 8 : 4))
+	{
+		return false;
+	}
+	
+	// a fragmented file's packets are all in the fragments
+	if(sample_count == 0)
+		return true;
+	
+	if(stts_count == 0 || stsc_count == 0)
+		return false;
+	
+	
+	_packets.reserve(sample_count);
+	
+	uint32_t stts_entry = 0;
+	uint32_t stts_left = Get32(stts_table);
+	uint32_t delta = Get32(stts_table + 4);
+	
+	uint32_t stsc_entry = 0;
+	
+	uint64_t dts = 0;
+	uint32_t sample = 0;
+	
+	for(uint32_t chunk = 0; chunk < chunk_count && sample < sample_count; chunk++)
+	{
+		// stsc chunk numbers start at 1
+		while(stsc_entry + 1 < stsc_count && Get32(stsc_table + ((stsc_entry + 1) * 12)) <= chunk + 1)
+			stsc_entry++;
+		
+		const uint32_t samples_per_chunk = Get32(stsc_table + (stsc_entry * 12) + 4);
+		
+		uint64_t offset = (co64 ? Get64(stco_table + (chunk * 8)) : Get32(stco_table + (chunk * 4)));
+		
+		for(uint32_t i=0; i < samples_per_chunk && sample < sample_count; i++, sample++)
+		{
+			while(stts_left == 0 && stts_entry + 1 < stts_count)
+			{
+				stts_entry++;
+				
+				stts_left = Get32(stts_table + (stts_entry * 8));
+				delta = Get32(stts_table + (stts_entry * 8) + 4);
+			}
+			
+			if(stts_left > 0)
+				stts_left--;
+			
+			ALAC_Packet packet;
+			
+			packet.offset = offset;
+			packet.dts = dts;
+			packet.size = (sample_size != 0 ? sample_size : Get32(stsz_table + (sample * 4)));
+			packet.duration = delta;
+			
+			_packets.push_back(packet);
+			
+			offset += packet.size;
+			dts += delta;
+		}
+	}
+	
+	if(sample != sample_count)
+		return false;
+	
+	if(_duration == 0)
+		_duration = dts;
+	
+	return true;
+}
+
+
+bool
+ALAC_PacketIndex::ParseFragment(const uint8_t *data, const uint8_t *end, uint64_t moof_offset, uint64_t file_size, const FragmentInfo &info)
+{
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	// if a traf doesn't say where its data is, it's right after the last one's
+	uint64_t data_end = moof_offset;
+	
+	while( NextBox(data, end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('t','r','a','f'))
+		{
+			if( !ParseTrackFragment(body, body_end, moof_offset, data_end, file_size, info) )
+				return false;
+		}
+	}
+	
+	return true;
+}
+
+
+bool
+ALAC_PacketIndex::ParseTrackFragment(const uint8_t *data, const uint8_t *end, uint64_t moof_offset, uint64_t &data_end,
+										uint64_t file_size, const FragmentInfo &info)
+{
+	uint32_t type;
+	const uint8_t *body, *body_end;
+	
+	const uint8_t *tfhd = NULL, *tfhd_end = NULL;
+	const uint8_t *tfdt = NULL, *tfdt_end = NULL;
+	
+	const uint8_t *box = data;
+	
+	while( NextBox(box, end, type, body, body_end) )
+	{
+		if(type == AP4_ATOM_TYPE('t','f','h','d'))
+		{
+			tfhd = body;
+			tfhd_end = body_end;
+		}
+		else if(type == AP4_ATOM_TYPE('t','f','d','t'))
+		{
+			tfdt = body;
+			tfdt_end = body_end;
+		}
+	}
+	
+	if(tfhd == NULL || tfhd_end - tfhd < 8)
+		return false;
+	
+	if(Get32(tfhd + 4) != info.track_id)
+		return true; // not our track
+	
+	
+	// version/flags, track_ID, then whatever the flags say is there
+	const uint32_t tfhd_flags = Get32(tfhd) & 0xffffff;
+	
+	const ptrdiff_t tfhd_size = 8 + ((tfhd_flags & ALAC_TFHD_BASE_DATA_OFFSET) ? 8 : 0) +
+									((tfhd_flags & ALAC_TFHD_SAMPLE_DESCRIPTION_INDEX) ? 4 : 0) +
+									((tfhd_flags & ALAC_TFHD_DEFAULT_SAMPLE_DURATION) ? 4 : 0) +
+									((tfhd_flags & ALAC_TFHD_DEFAULT_SAMPLE_SIZE) ? 4 : 0) +
+									((tfhd_flags & ALAC_TFHD_DEFAULT_SAMPLE_FLAGS) ? 4 : 0);
+	
+	if(tfhd_end - tfhd < tfhd_size)
+		return false;
+	
+	const uint8_t *field = tfhd + 8;
+	
+	uint64_t base = (data_end == moof_offset || (tfhd_flags & ALAC_TFHD_DEFAULT_BASE_IS_MOOF)) ? moof_offset : data_end;
+	
+	if(tfhd_flags & ALAC_TFHD_BASE_DATA_OFFSET)
+	{
+		base = Get64(field);
+		field += 8;
+	}
+	
+	if(tfhd_flags & ALAC_TFHD_SAMPLE_DESCRIPTION_INDEX)
+		field += 4;
+	
+	uint32_t default_duration = info.default_duration;
+	uint32_t default_size = info.default_size;
+	
+	if(tfhd_flags & ALAC_TFHD_DEFAULT_SAMPLE_DURATION)
+	{
+		default_duration = Get32(field);
+		field += 4;
+	}
+	
+	if(tfhd_flags & ALAC_TFHD_DEFAULT_SAMPLE_SIZE)
+		default_size = Get32(field);
+	
+	
+	// Without a tfdt, this fragment picks up where the last one left off.
+	// If it says it goes back in time, something's wrong.
+	const uint64_t last_end = (_packets.empty() ? 0 : _packets.back().dts + _packets.back().duration);
+	
+	uint64_t dts = last_end;
+	
+	if(tfdt != NULL)
+	{
+		if(tfdt_end - tfdt >= 12 && tfdt[0] == 1)
+			dts = Get64(tfdt + 4);
+		else if(tfdt_end - tfdt >= 8 && tfdt[0] == 0)
+			dts = Get32(tfdt + 4);
+		else
+			return false;
+		
+		if(dts < last_end)
+			return false;
+	}
+	
+	
+	uint64_t offset = base;
+	
+	while( NextBox(data, end, type, body, body_end) )
+	{
+		if(type != AP4_ATOM_TYPE('t','r','u','n'))
+			continue;
+		
+		// version/flags, sample_count, then the optional fields and the table
+		if(body_end - body < 8)
+			return false;
+		
+		const uint32_t trun_flags = Get32(body) & 0xffffff;
+		const uint32_t count = Get32(body + 4);
+		
+		const uint8_t *p = body + 8;
+		
+		if(trun_flags & ALAC_TRUN_DATA_OFFSET)
+		{
+			if(body_end - p < 4)
+				return false;
+			
+			const int32_t data_offset = (int32_t)Get32(p);
+			
+			if(data_offset < 0 && (uint64_t)(-(int64_t)data_offset) > base)
+				return false;
+			
+			offset = base + data_offset;
+			p += 4;
+		}
+		
+		if(trun_flags & ALAC_TRUN_FIRST_SAMPLE_FLAGS)
+			p += 4;
+		
+		const ptrdiff_t entry_size = ((trun_flags & ALAC_TRUN_SAMPLE_DURATION) ? 4 : 0) +
+										((trun_flags & ALAC_TRUN_SAMPLE_SIZE) ? 4 : 0) +
+										((trun_flags & ALAC_TRUN_SAMPLE_FLAGS) ? 4 : 0) +
+										((trun_flags & ALAC_TRUN_SAMPLE_COMPOSITION) ? 4 : 0);
+		
+		if(p > body_end || (uint64_t)(body_end - p) < (uint64_t)count * entry_size)
+			return false;
+		
+		for(uint32_t i=0; i < count; i++, p += entry_size)
+		{
+			const uint8_t *entry = p;
+			
+			ALAC_Packet packet;
+			
+			packet.offset = offset;
+			packet.dts = dts;
+			packet.duration = default_duration;
+			packet.size = default_size;
+			
+			if(trun_flags & ALAC_TRUN_SAMPLE_DURATION)
+			{
+				packet.duration = Get32(entry);
+				entry += 4;
+			}
+			
+			if(trun_flags & ALAC_TRUN_SAMPLE_SIZE)
+				packet.size = Get32(entry);
+			
+			// stop at the first packet that got cut off
+			if(packet.size == 0 || packet.duration == 0 || offset + packet.size > file_size)
+				return false;
+			
+			_packets.push_back(packet);
+			
+			offset += packet.size;
+			dts += packet.duration;
+		}
+	}
+	
+	data_end = offset;
+	
+	return true;
+}
+
+
+void
+ALAC_PacketIndex::SetFormat(const void *magic_cookie, size_t magic_cookie_size, uint32_t time_scale, uint64_t duration)
+{
+	const uint8_t *cookie = (const uint8_t *)magic_cookie;
+
+	_magic_cookie.assign(cookie, cookie + magic_cookie_size);
+	_time_scale = time_scale;
+	_duration = duration;
+}
+
+
+void
+ALAC_PacketIndex::AddPacket(uint64_t offset, uint32_t size, uint64_t dts, uint32_t duration)
+{
+	ALAC_Packet packet;
+	
+	packet.offset = offset;
+	packet.dts = dts;
+	packet.size = size;
+	packet.duration = duration;
+	
+	_packets.push_back(packet);
+}
+
+
+bool
+ALAC_PacketIndex::Append(const ALAC_PacketIndex &next)
+{
+	if(next._magic_cookie != _magic_cookie || next._time_scale != _time_scale || next._packets.empty())
+		return false;
+	
+	// the next file starts where the last packet of this one ends
+	const uint64_t start = (_packets.empty() ? 0 : _packets.back().dts + _packets.back().duration);
+	
+	_segment_starts.push_back(_packets.size());
+	
+	_packets.reserve(_packets.size() + next._packets.size());
+	
+	for(std::vector<ALAC_Packet>::const_iterator i = next._packets.begin(); i != next._packets.end(); ++i)
+	{
+		ALAC_Packet packet = *i;
+		
+		packet.dts += start;
+		
+		_packets.push_back(packet);
+	}
+	
+	_duration = start + next._duration;
+	
+	return true;
+}
+
+
+void *
+ALAC_PacketIndex::GetMagicCookie(size_t &size)
+{
+	size = _magic_cookie.size();
+	
+	return (_magic_cookie.empty() ? NULL : &_magic_cookie[0]);
+}
+
+
+static bool
+PacketBefore(uint64_t time, const ALAC_Packet &packet)
+{
+	return (time < packet.dts);
+}
+
+
+bool
+ALAC_PacketIndex::FindPacket(uint64_t time, uint32_t &index) const
+{
+	if(_packets.empty())
+		return false;
+	
+	const ALAC_Packet &last = _packets.back();
+	
+	if(time >= last.dts + last.duration)
+		return false;
+	
+	// first packet that starts after time, then back one
+	std::vector<ALAC_Packet>::const_iterator i = std::upper_bound(_packets.begin(), _packets.end(), time, PacketBefore);
+	
+	index = (i == _packets.begin() ? 0 : (i - _packets.begin()) - 1);
+	
+	return true;
+}
+
+
+uint32_t
+ALAC_PacketIndex::GetSegment(uint32_t i) const
+{
+	return (std::upper_bound(_segment_starts.begin(), _segment_starts.end(), i) - _segment_starts.begin());
+}
+
+
+size_t
+ALAC_PacketIndex::GetMemorySize() const
+{
+	return sizeof(*this) +
+			_magic_cookie.capacity() +
+			(_packets.capacity() * sizeof(ALAC_Packet)) +
+			(_segment_starts.capacity() * sizeof(uint32_t));
+}
\ No newline at end of file
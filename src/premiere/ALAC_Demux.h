@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_DEMUX_H
+#define ALAC_DEMUX_H
+
+
+#include "Ap4.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+
+typedef struct
+{
+	uint64_t	offset;
+	uint64_t	dts;		// in the track's time scale
+	uint32_t	size;
+	uint32_t	duration;
+} ALAC_Packet;
+
+
+// Everything the importer needs to know about an ALAC track: the magic
+// cookie and where every packet is.  Once it's built it doesn't change,
+// so any thread can look at it without a lock.
+//
+// Parse() is our own MP4 reader.  All we need are a few atoms from moov,
+// so we read moov in one go and pick through it.  If that doesn't work,
+// the index can be filled in from Bento4 instead.
+//
+// Fragmented files have an empty sample table, so when the moov has an
+// mvex we keep going and read the packets out of every moof after it.
+// A file that got cut off partway through a fragment plays up to the
+// last packet that's all there.
+
+class ALAC_PacketIndex
+{
+  public:
+	ALAC_PacketIndex();
+	~ALAC_PacketIndex() {}
+	
+	bool Parse(AP4_ByteStream &stream);
+	
+	// for building the index some other way
+	void SetFormat(const void *magic_cookie, size_t magic_cookie_size, uint32_t time_scale, uint64_t duration);
+	void AddPacket(uint64_t offset, uint32_t size, uint64_t dts, uint32_t duration);
+	
+	// Tacks the packets from the next file in a series onto the end.
+	// The format has to be the same.
+	bool Append(const ALAC_PacketIndex &next);
+	
+	void *GetMagicCookie(size_t &size);
+	
+	uint32_t GetTimeScale() const { return _time_scale; }
+	uint64_t GetDuration() const { return _duration; }
+	
+	uint32_t GetPacketCount() const { return _packets.size(); }
+	const ALAC_Packet & GetPacket(uint32_t i) const { return _packets[i]; }
+	
+	// the packet that's playing at time, false if we're past the end
+	bool FindPacket(uint64_t time, uint32_t &index) const;
+	
+	// which file packet i is in, 0 unless we've Append()ed
+	uint32_t GetSegmentCount() const { return _segment_starts.size() + 1; }
+	uint32_t GetSegment(uint32_t i) const;
+	
+	// how much memory the index is using
+	size_t GetMemorySize() const;
+	
+  private:
+	// what the moov tells us about reading fragments
+	typedef struct
+	{
+		bool		fragmented;		// there's an mvex
+		uint32_t	track_id;
+		uint32_t	default_duration;	// from the trex
+		uint32_t	default_size;
+	} FragmentInfo;
+	
+	bool ParseMovie(const uint8_t *data, const uint8_t *end, FragmentInfo &info);
+	bool ParseTrack(const uint8_t *data, const uint8_t *end, uint32_t &track_id);
+	bool ParseSampleDescription(const uint8_t *data, const uint8_t *end);
+	bool ParseSampleTable(const uint8_t *data, const uint8_t *end);
+	
+	bool ParseFragment(const uint8_t *data, const uint8_t *end, uint64_t moof_offset, uint64_t file_size, const FragmentInfo &info);
+	bool ParseTrackFragment(const uint8_t *data, const uint8_t *end, uint64_t moof_offset, uint64_t &data_end,
+							uint64_t file_size, const FragmentInfo &info);
+	
+	std::vector<uint8_t> _magic_cookie;
+	uint32_t _time_scale;
+	uint64_t _duration;
+	
+	std::vector<ALAC_Packet> _packets;
+	
+	std::vector<uint32_t> _segment_starts; // first packet of every file after the first
+};
+
+
+#endif // ALAC_DEMUX_H
\ No newline at end of file
@@ -0,0 +1,721 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Encode.h"
+
+#include "ALACEncoder.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+// Leave some CPU for Premiere's audio render
+#define ALAC_ENCODE_MAX_WORKERS		8
+
+// Frames in the ring for each worker, so nobody is waiting on the renderer
+#define ALAC_ENCODE_SLOTS_PER_WORKER	2
+
+// Adaptive effort keeps the fast packet if it's at most this much of the PCM
+#define ALAC_ADAPTIVE_RATIO		0.6
+
+// A frame whose samples step this far on average (in 16-bit terms) is about
+// as noisy as audio gets, and tends to come out escaped (stored uncompressed)
+// however hard the encoder tries, so it only gets one fast encode
+#define ALAC_NOISY_STEP		((1 << 16) >> 3)
+
+// With a deadline, a skipped encode's timing comes down this much every
+// frame, so it gets tried again if things speed up
+#define ALAC_DEADLINE_DECAY		0.95
+
+// Choosing a frame size, don't take one that's this much slower than the fastest
+#define ALAC_FRAME_SIZE_MAX_SLOWDOWN	1.25
+
+
+class ALAC_EncodePipeline::Worker : public ALAC_Thread
+{
+  public:
+	Worker(ALAC_EncodePipeline &pipeline, ALACEncoder *encoder) : _pipeline(pipeline), _encoder(encoder) {}
+	virtual ~Worker() { Join(); delete _encoder; }
+	
+	ALACEncoder * Encoder() { return _encoder; }
+	ALAC_EncodeScratch & Scratch() { return _scratch; }
+	
+  protected:
+	virtual void Run() { _pipeline.WorkerLoop(*this); }
+	
+  private:
+	ALAC_EncodePipeline &_pipeline;
+	ALACEncoder *_encoder;
+	ALAC_EncodeScratch _scratch;
+};
+
+
+static ALACEncoder *
+NewEncoder(const AudioFormatDescription &output_format, int frame_size)
+{
+	ALACEncoder *encoder = new ALACEncoder;
+	
+	encoder->SetFrameSize(frame_size);
+	
+	if(encoder->InitializeEncoder(output_format) != 0)
+	{
+		delete encoder;
+		
+		return NULL;
+	}
+	
+	return encoder;
+}
+
+
+ALAC_EncodePipeline::ALAC_EncodePipeline(const AudioFormatDescription &input_format,
+											const AudioFormatDescription &output_format,
+											int frame_size, ALAC_Effort effort, int workers) :
+	_input_format(input_format),
+	_output_format(output_format),
+	_effort(effort),
+	_head(0),
+	_count(0),
+	_encoder(NULL),
+	_quit(false)
+{
+	const size_t frame_bytes = frame_size * input_format.mBytesPerPacket;
+	
+	// an escaped (uncompressed) packet is a little bigger than the frame,
+	// with a header for every element
+	const size_t packet_bytes = frame_bytes + (kALACMaxEscapeHeaderBytes * kALACMaxChannels);
+	
+	memset(&_deadline_stats, 0, sizeof(_deadline_stats));
+	
+	const int slots = (workers > 0 ? workers * ALAC_ENCODE_SLOTS_PER_WORKER : 1);
+	
+	_slots.resize(slots);
+	
+	for(std::vector<Slot>::iterator i = _slots.begin(); i != _slots.end(); ++i)
+	{
+		i->input.resize(frame_bytes);
+		i->output.resize(packet_bytes);
+		i->samples = 0;
+		i->size = 0;
+		i->ok = false;
+		i->state = SLOT_EMPTY;
+		i->started = 0.0;
+		i->budget_ms = 0.0;
+		i->result = ALAC_FRAME_FULL;
+	}
+	
+	
+	for(int i=0; i < workers; i++)
+	{
+		ALACEncoder *encoder = NewEncoder(output_format, frame_size);
+		
+		if(encoder != NULL)
+		{
+			Worker *worker = new Worker(*this, encoder);
+			
+			if( worker->Start() )
+				_workers.push_back(worker);
+			else
+				delete worker;
+		}
+	}
+	
+	if(_workers.empty())
+		_encoder = NewEncoder(output_format, frame_size);
+}
+
+
+ALAC_EncodePipeline::~ALAC_EncodePipeline()
+{
+	{
+		ALAC_Lock lock(_mutex);
+		
+		_quit = true;
+		
+		_work_cond.Broadcast();
+	}
+	
+	for(std::vector<Worker *>::iterator i = _workers.begin(); i != _workers.end(); ++i)
+	{
+		delete *i;
+	}
+	
+	delete _encoder;
+}
+
+
+// Encodes the audio at one frame size, to see how it does
+class FrameSizeTrial
+{
+  public:
+	FrameSizeTrial(const AudioFormatDescription &input_format, const AudioFormatDescription &output_format,
+					ALAC_Effort effort, uint8_t *pcm, int samples, int frame_size);
+	~FrameSizeTrial() {}
+	
+	void Encode();
+	
+	int FrameSize() const { return _frame_size; }
+	bool OK() const { return _ok; }
+	uint64_t Bytes() const { return _bytes; }
+	double Milliseconds() const { return _ms; }
+	
+  private:
+	const AudioFormatDescription _input_format;
+	const AudioFormatDescription _output_format;
+	const ALAC_Effort _effort;
+	uint8_t * const _pcm;
+	const int _samples;
+	const int _frame_size;
+	
+	bool _ok;
+	uint64_t _bytes;
+	double _ms;
+};
+
+
+FrameSizeTrial::FrameSizeTrial(const AudioFormatDescription &input_format, const AudioFormatDescription &output_format,
+								ALAC_Effort effort, uint8_t *pcm, int samples, int frame_size) :
+	_input_format(input_format),
+	_output_format(output_format),
+	_effort(effort),
+	_pcm(pcm),
+	_samples(samples),
+	_frame_size(frame_size),
+	_ok(false),
+	_bytes(0),
+	_ms(0.0)
+{
+
+}
+
+
+void
+FrameSizeTrial::Encode()
+{
+	ALACEncoder *encoder = NewEncoder(_output_format, _frame_size);
+	
+	if(encoder == NULL)
+		return;
+	
+	std::vector<uint8_t> output((_frame_size * _input_format.mBytesPerPacket) + kALACMaxEscapeHeaderBytes);
+	ALAC_EncodeScratch scratch;
+	
+	_ok = true;
+	
+	const double started = ALAC_NowMs();
+	
+	for(int pos=0; pos < _samples && _ok; pos += _frame_size)
+	{
+		const int samples = (_samples - pos < _frame_size ? _samples - pos : _frame_size);
+		
+		int32_t size = output.size();
+		
+		_ok = ALAC_EncodePipeline::EncodeFrame(*encoder, _effort, _input_format, _output_format,
+												_pcm + (pos * _input_format.mBytesPerPacket), samples,
+												&output[0], size, scratch);
+		
+		_bytes += size;
+	}
+	
+	_ms = ALAC_NowMs() - started;
+	
+	delete encoder;
+}
+
+
+int
+ALAC_EncodePipeline::ChooseFrameSize(const AudioFormatDescription &input_format,
+										const AudioFormatDescription &output_format,
+										ALAC_Effort effort, uint8_t *pcm, int samples,
+										const int frame_sizes[], int count,
+										std::vector<FrameSizeResult> *results)
+{
+	// One at a time, so each one has the CPU to itself and the times
+	// can be compared.  Run together, they'd mostly be timing the scheduler.
+	std::vector<FrameSizeTrial *> trials;
+	
+	bool any_ok = false;
+	double fastest = 0.0;
+	
+	for(int i=0; i < count; i++)
+	{
+		FrameSizeTrial *trial = new FrameSizeTrial(input_format, output_format, effort, pcm, samples, frame_sizes[i]);
+		
+		trial->Encode();
+		
+		if(trial->OK() && (!any_ok || trial->Milliseconds() < fastest))
+		{
+			fastest = trial->Milliseconds();
+			any_ok = true;
+		}
+		
+		trials.push_back(trial);
+	}
+	
+	int frame_size = kALACDefaultFramesPerPacket;
+	uint64_t smallest = 0;
+	bool chosen = false;
+	
+	for(std::vector<FrameSizeTrial *>::iterator i = trials.begin(); i != trials.end(); ++i)
+	{
+		FrameSizeTrial *trial = *i;
+		
+		if(trial->OK() && trial->Milliseconds() <= fastest * ALAC_FRAME_SIZE_MAX_SLOWDOWN &&
+			(!chosen || trial->Bytes() < smallest))
+		{
+			frame_size = trial->FrameSize();
+			smallest = trial->Bytes();
+			chosen = true;
+		}
+		
+		if(results != NULL)
+		{
+			FrameSizeResult result;
+			
+			result.frame_size = trial->FrameSize();
+			result.ok = trial->OK();
+			result.bytes = trial->Bytes();
+			result.ms = trial->Milliseconds();
+			
+			results->push_back(result);
+		}
+		
+		delete trial;
+	}
+	
+	return frame_size;
+}
+
+
+bool
+ALAC_EncodePipeline::TrialEncode(const AudioFormatDescription &input_format,
+									const AudioFormatDescription &output_format,
+									ALAC_Effort effort, uint8_t *pcm, int samples, int frame_size,
+									uint64_t &bytes, double &ms)
+{
+	FrameSizeTrial trial(input_format, output_format, effort, pcm, samples, frame_size);
+	
+	trial.Encode();
+	
+	bytes = trial.Bytes();
+	ms = trial.Milliseconds();
+	
+	return trial.OK();
+}
+
+
+int
+ALAC_EncodePipeline::DefaultWorkers()
+{
+	const int workers = ALAC_Thread::Processors() - 1;
+	
+	return (workers < 2 ? 0 : workers > ALAC_ENCODE_MAX_WORKERS ? ALAC_ENCODE_MAX_WORKERS : workers);
+}
+
+
+uint8_t *
+ALAC_EncodePipeline::FrameBuffer()
+{
+	assert(!Full());
+	
+	Slot &slot = _slots[(_head + _count) % _slots.size()];
+	
+	assert(slot.state == SLOT_EMPTY);
+	
+	return &slot.input[0];
+}
+
+
+// One encode in fast or normal mode, timed if there's a deadline
+static bool
+TimedEncode(ALACEncoder &encoder, bool fast, bool timed,
+			const AudioFormatDescription &input_format,
+			const AudioFormatDescription &output_format,
+			uint8_t *input, int samples,
+			uint8_t *output, int32_t &bytes,
+			ALAC_EncodeScratch &scratch)
+{
+	const double started = (timed ? ALAC_NowMs() : 0.0);
+	
+	encoder.SetFastMode(fast);
+	
+	if(encoder.Encode(input_format, output_format, input, output, &bytes) != 0)
+		return false;
+	
+	if(timed && samples > 0)
+		scratch.ms_per_sample[fast ? 1 : 0] = (ALAC_NowMs() - started) / samples;
+	
+	return true;
+}
+
+
+// Only looks at the frame itself, so it doesn't matter which encoder gets
+// it or what it did before: the file comes out the same either way.
+static bool
+LooksLikeNoise(const AudioFormatDescription &input_format, const uint8_t *input, int samples)
+{
+	const int channels = input_format.mChannelsPerFrame;
+	const int bytes = input_format.mBytesPerPacket / channels;
+	
+	if(samples < 2 || channels < 1 || channels > kALACMaxChannels)
+		return false;
+	
+	uint64_t steps = 0;
+	
+	int32_t last[kALACMaxChannels];
+	
+	for(int i=0; i < samples; i++)
+	{
+		for(int c=0; c < channels; c++)
+		{
+			const uint8_t *in = input + (((i * channels) + c) * bytes);
+			
+			// the top 16 bits
+			const int32_t val = (bytes == 2 ? *(const int16_t *)in :
+									bytes == 3 ? (int16_t)(in[1] | (in[2] << 8)) :
+									*(const int32_t *)in >> 16);
+			
+			if(i > 0)
+				steps += (val > last[c] ? val - last[c] : last[c] - val);
+			
+			last[c] = val;
+		}
+	}
+	
+	return (steps >= (uint64_t)ALAC_NOISY_STEP * (samples - 1) * channels);
+}
+
+
+bool
+ALAC_EncodePipeline::EncodeFrame(ALACEncoder &encoder, ALAC_Effort effort,
+									const AudioFormatDescription &input_format,
+									const AudioFormatDescription &output_format,
+									uint8_t *input, int samples,
+									uint8_t *output, int32_t &size,
+									ALAC_EncodeScratch &scratch,
+									double deadline, ALAC_FrameResult *frame_result)
+{
+	// The encoder gets the frame size from the number of bytes,
+	// so a short last frame is encoded as a short packet.
+	const int32_t pcm_bytes = samples * input_format.mBytesPerPacket;
+	
+	assert(size >= pcm_bytes + kALACMaxEscapeHeaderBytes);
+	
+	// A frame where every sample is the same as the last one (silence,
+	// mostly) gets its packet written straight out, see ALAC_Constant.h
+	if( !scratch.constant.Ready() )
+	{
+		uint32_t cookie_size = encoder.GetMagicCookieSize(output_format.mChannelsPerFrame);
+		
+		std::vector<uint8_t> cookie(cookie_size);
+		
+		encoder.GetMagicCookie(&cookie[0], &cookie_size);
+		
+		scratch.constant.Init(&cookie[0], cookie_size);
+	}
+	
+	const int32_t constant_size = scratch.constant.Encode(input, samples, output, size);
+	
+	if(constant_size > 0)
+	{
+		size = constant_size;
+		
+		return true;
+	}
+	
+	// ALACEncoder codes the whole frame before it finds out it would have
+	// been smaller uncompressed, so don't spend more than a fast encode
+	// on a frame that's going to end up that way.
+	const bool hurry = LooksLikeNoise(input_format, input, samples);
+	
+	bool fast = (hurry || effort == ALAC_EFFORT_FAST || effort == ALAC_EFFORT_ADAPTIVE);
+	
+	// With a deadline, guess how long each encode will take from the last
+	// one like it, and don't start one that would run past the deadline
+	const bool timed = (deadline > 0.0);
+	
+	ALAC_FrameResult result = ALAC_FRAME_FULL;
+	
+	if(timed)
+	{
+		const double left = deadline - ALAC_NowMs();
+		
+		if(!fast && scratch.ms_per_sample[0] * samples > left)
+		{
+			scratch.ms_per_sample[0] *= ALAC_DEADLINE_DECAY;
+			
+			fast = true;
+			result = ALAC_FRAME_LOWERED;
+		}
+		
+		if(fast && scratch.ms_per_sample[1] * samples > left)
+		{
+			const int32_t escaped_size = scratch.constant.Escape(input, samples, output, size);
+			
+			if(escaped_size > 0)
+			{
+				scratch.ms_per_sample[1] *= ALAC_DEADLINE_DECAY;
+				
+				if(frame_result != NULL)
+					*frame_result = ALAC_FRAME_ESCAPED;
+				
+				size = escaped_size;
+				
+				return true;
+			}
+		}
+	}
+	
+	int32_t bytes = pcm_bytes;
+	
+	if( !TimedEncode(encoder, fast, timed, input_format, output_format, input, samples, output, bytes, scratch) )
+		return false;
+	
+	if(!hurry &&
+		(effort == ALAC_EFFORT_EXHAUSTIVE ||
+		(effort == ALAC_EFFORT_ADAPTIVE && bytes > pcm_bytes * ALAC_ADAPTIVE_RATIO)))
+	{
+		// try it the other way
+		const bool other_fast = !fast;
+		
+		if(timed && ALAC_NowMs() + (scratch.ms_per_sample[other_fast ? 1 : 0] * samples) > deadline)
+		{
+			scratch.ms_per_sample[other_fast ? 1 : 0] *= ALAC_DEADLINE_DECAY;
+			
+			result = ALAC_FRAME_LOWERED;
+		}
+		else
+		{
+			scratch.trial.resize(size);
+			
+			int32_t other_bytes = pcm_bytes;
+			
+			if( !TimedEncode(encoder, other_fast, timed, input_format, output_format, input, samples, &scratch.trial[0], other_bytes, scratch) )
+				return false;
+			
+			if(other_bytes < bytes)
+			{
+				memcpy(output, &scratch.trial[0], other_bytes);
+				
+				bytes = other_bytes;
+			}
+		}
+	}
+	
+	if(frame_result != NULL)
+		*frame_result = result;
+	
+	size = bytes;
+	
+	return true;
+}
+
+
+void
+ALAC_EncodePipeline::Encode(int samples, double budget_ms)
+{
+	assert(!Full());
+	
+	Slot &slot = _slots[(_head + _count) % _slots.size()];
+	
+	slot.samples = samples;
+	slot.started = (budget_ms > 0.0 ? ALAC_NowMs() : 0.0);
+	slot.budget_ms = budget_ms;
+	
+	_count++;
+	
+	if(_workers.empty())
+	{
+		EncodeSlot(_encoder, _scratch, slot);
+		
+		slot.state = SLOT_DONE;
+		
+		if(budget_ms > 0.0)
+		{
+			ALAC_Lock lock(_mutex);
+			
+			CountDeadline(slot);
+		}
+	}
+	else
+	{
+		ALAC_Lock lock(_mutex);
+		
+		slot.state = SLOT_QUEUED;
+		
+		_queue.push_back(&slot);
+		
+		_work_cond.Signal();
+	}
+}
+
+
+bool
+ALAC_EncodePipeline::Packet(const uint8_t *&data, int32_t &size, int &samples)
+{
+	assert(!Empty());
+	
+	Slot &slot = _slots[_head];
+	
+	{
+		ALAC_Lock lock(_mutex);
+		
+		while(slot.state != SLOT_DONE)
+			_done_cond.Wait(_mutex);
+	}
+	
+	data = &slot.output[0];
+	size = slot.size;
+	samples = slot.samples;
+	
+	return slot.ok;
+}
+
+
+void
+ALAC_EncodePipeline::Pop()
+{
+	assert(!Empty());
+	
+	Slot &slot = _slots[_head];
+	
+	assert(slot.state == SLOT_DONE);
+	
+	slot.state = SLOT_EMPTY;
+	
+	_head = (_head + 1) % _slots.size();
+	_count--;
+}
+
+
+bool
+ALAC_EncodePipeline::EncodeSlot(ALACEncoder *encoder, ALAC_EncodeScratch &scratch, Slot &slot)
+{
+	slot.ok = false;
+	slot.size = 0;
+	
+	if(encoder != NULL)
+	{
+		try
+		{
+			int32_t size = slot.output.size();
+			
+			slot.result = ALAC_FRAME_FULL;
+			
+			if( EncodeFrame(*encoder, _effort, _input_format, _output_format,
+							&slot.input[0], slot.samples, &slot.output[0], size, scratch,
+							(slot.budget_ms > 0.0 ? slot.started + slot.budget_ms : 0.0), &slot.result) )
+			{
+				slot.size = size;
+				slot.ok = true;
+			}
+		}
+		catch(...)
+		{
+			slot.ok = false;
+		}
+	}
+	
+	return slot.ok;
+}
+
+
+void
+ALAC_EncodePipeline::WorkerLoop(Worker &worker)
+{
+	ALAC_Lock lock(_mutex);
+	
+	while(!_quit)
+	{
+		if(_queue.empty())
+		{
+			_work_cond.Wait(_mutex);
+		}
+		else
+		{
+			Slot *slot = _queue.front();
+			
+			_queue.pop_front();
+			
+			_mutex.Unlock();
+			
+			EncodeSlot(worker.Encoder(), worker.Scratch(), *slot);
+			
+			_mutex.Lock();
+			
+			CountDeadline(*slot);
+			
+			slot->state = SLOT_DONE;
+			
+			_done_cond.Broadcast();
+		}
+	}
+}
+
+
+void
+ALAC_EncodePipeline::CountDeadline(const Slot &slot)
+{
+	if(slot.budget_ms <= 0.0)
+		return;
+	
+	const double ms = ALAC_NowMs() - slot.started;
+	
+	_deadline_stats.frames++;
+	
+	if(slot.result == ALAC_FRAME_LOWERED)
+		_deadline_stats.lowered++;
+	else if(slot.result == ALAC_FRAME_ESCAPED)
+		_deadline_stats.escaped++;
+	
+	if(ms > slot.budget_ms)
+		_deadline_stats.late++;
+	
+	if(ms > _deadline_stats.max_ms)
+		_deadline_stats.max_ms = ms;
+}
+
+
+ALAC_EncodePipeline::DeadlineStats
+ALAC_EncodePipeline::GetDeadlineStats()
+{
+	ALAC_Lock lock(_mutex);
+	
+	return _deadline_stats;
+}
\ No newline at end of file
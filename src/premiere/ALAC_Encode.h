@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_ENCODE_H
+#define ALAC_ENCODE_H
+
+
+#include "ALAC_Thread.h"
+#include "ALAC_Constant.h"
+
+#include "ALACAudioTypes.h"
+
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+
+class ALACEncoder;
+
+
+// How hard the encoder works.  ALACEncoder only has a fast mode and its
+// normal search, so exhaustive tries both and keeps the smaller packet,
+// and adaptive uses fast mode unless the packet doesn't compress well.
+// Real-time is the default effort, but each frame gets a budget of as
+// long as it plays (see ALAC_EncodePipeline::Encode()).
+typedef enum
+{
+	ALAC_EFFORT_FAST = 0,
+	ALAC_EFFORT_DEFAULT,
+	ALAC_EFFORT_EXHAUSTIVE,
+	ALAC_EFFORT_ADAPTIVE,
+	ALAC_EFFORT_REALTIME
+} ALAC_Effort;
+
+
+// How a frame with a deadline came out
+typedef enum
+{
+	ALAC_FRAME_FULL = 0,	// got the effort asked for
+	ALAC_FRAME_LOWERED,		// got less, to be done in time
+	ALAC_FRAME_ESCAPED		// no time for any encode, stored as PCM
+} ALAC_FrameResult;
+
+
+// What EncodeFrame() keeps for one encoder: room to try a frame twice,
+// the coder that writes constant frames (silence, usually) itself, and
+// how long each kind of encode has been taking.  Only the timing changes
+// how the next frame gets encoded, and only when it has a deadline.
+struct ALAC_EncodeScratch
+{
+	ALAC_EncodeScratch() { ms_per_sample[0] = ms_per_sample[1] = 0.0; }
+	
+	std::vector<uint8_t>	trial;
+	
+	ALAC_ConstantCoder		constant;
+	
+	double					ms_per_sample[2];	// normal and fast encodes
+};
+
+
+// Every ALAC packet is encoded on its own, so while the export thread
+// renders the next frame, a few workers (each with its own ALACEncoder)
+// can be compressing the ones before it.  Frames go into a ring and
+// packets come out of it in the same order, so the file is the same
+// byte for byte as if one encoder had done it all.
+//
+// With no workers, Encode() just does the work right there.
+
+class ALAC_EncodePipeline
+{
+  public:
+	ALAC_EncodePipeline(const AudioFormatDescription &input_format,
+						const AudioFormatDescription &output_format,
+						int frame_size, ALAC_Effort effort, int workers);
+	~ALAC_EncodePipeline();
+	
+	// How many workers it would make sense to use
+	static int DefaultWorkers();
+	
+	// Encode one frame at the given effort, scratch belongs to the encoder.
+	// size goes in as the room in output and comes back as the packet size.
+	// With a deadline (an ALAC_NowMs() time), it gets less effort if it
+	// wouldn't be done by then.
+	static bool EncodeFrame(ALACEncoder &encoder, ALAC_Effort effort,
+							const AudioFormatDescription &input_format,
+							const AudioFormatDescription &output_format,
+							uint8_t *input, int samples,
+							uint8_t *output, int32_t &size,
+							ALAC_EncodeScratch &scratch,
+							double deadline = 0.0, ALAC_FrameResult *frame_result = NULL);
+	
+	// How one frame size did in ChooseFrameSize()
+	typedef struct
+	{
+		int			frame_size;
+		bool		ok;
+		uint64_t	bytes;
+		double		ms;
+	} FrameSizeResult;
+	
+	// Encodes some audio at each frame size, one after another, and picks the
+	// one that comes out smallest without taking a lot longer than the fastest.
+	// pcm is interleaved, like FrameBuffer().  How each one did goes in
+	// results, if you want to know.
+	static int ChooseFrameSize(const AudioFormatDescription &input_format,
+								const AudioFormatDescription &output_format,
+								ALAC_Effort effort, uint8_t *pcm, int samples,
+								const int frame_sizes[], int count,
+								std::vector<FrameSizeResult> *results = NULL);
+	
+	// Encodes some audio at one frame size and effort, one frame after
+	// another on this thread, and says how big it came out and how long
+	// it took.  For comparing efforts.
+	static bool TrialEncode(const AudioFormatDescription &input_format,
+							const AudioFormatDescription &output_format,
+							ALAC_Effort effort, uint8_t *pcm, int samples, int frame_size,
+							uint64_t &bytes, double &ms);
+	
+	bool Full() const { return (_count == _slots.size()); }
+	bool Empty() const { return (_count == 0); }
+	
+	// Where to render the next frame, only when not Full().  ALACEncoder
+	// only takes interleaved integer samples, so Premiere's audio should be
+	// quantized straight into this, not into a buffer of its own first.
+	// There's no planar float way in: ALACEncoder de-interleaves into its
+	// mix buffers inside EncodeStereo() and EncodeMono(), again for every
+	// mixRes it tries, and that's all in ext/alac.  Taking planar input
+	// would mean changing the library, so this is as close as it gets.
+	uint8_t * FrameBuffer();
+	
+	// Encode what was put in FrameBuffer(), samples can be less than frame_size
+	void Encode(int samples) { Encode(samples, 0.0); }
+	
+	// For capture and other real-time use: the frame has to be encoded
+	// within budget_ms of now.  If it wouldn't make it, it gets a fast
+	// encode instead, and with no time even for that, it goes in as PCM.
+	// Either way it's still a good ALAC packet.
+	void Encode(int samples, double budget_ms);
+	
+	// Waits for the oldest packet, only when not Empty().
+	// Returns false if the encoder didn't like it.
+	bool Packet(const uint8_t *&data, int32_t &size, int &samples);
+	
+	// Done with the oldest packet
+	void Pop();
+	
+	// How the frames with a budget have done so far
+	typedef struct
+	{
+		uint64_t	frames;
+		uint64_t	lowered;	// ALAC_FRAME_LOWERED
+		uint64_t	escaped;	// ALAC_FRAME_ESCAPED
+		uint64_t	late;		// took longer than the budget anyway
+		double		max_ms;		// longest from Encode() to done
+	} DeadlineStats;
+	
+	DeadlineStats GetDeadlineStats();
+	
+  private:
+	class Worker;
+	friend class Worker;
+	
+	typedef enum
+	{
+		SLOT_EMPTY = 0,
+		SLOT_QUEUED,
+		SLOT_DONE
+	} SlotState;
+	
+	typedef struct
+	{
+		std::vector<uint8_t>	input;
+		std::vector<uint8_t>	output;
+		int			samples;
+		int32_t		size;
+		bool		ok;
+		SlotState	state;
+		double		started;
+		double		budget_ms;
+		ALAC_FrameResult result;
+	} Slot;
+	
+	bool EncodeSlot(ALACEncoder *encoder, ALAC_EncodeScratch &scratch, Slot &slot);
+	void WorkerLoop(Worker &worker);
+	void CountDeadline(const Slot &slot); // with _mutex
+	
+	const AudioFormatDescription _input_format;
+	const AudioFormatDescription _output_format;
+	const ALAC_Effort _effort;
+	
+	std::vector<Slot> _slots;
+	size_t _head;
+	size_t _count;
+	
+	ALACEncoder *_encoder;	// if there are no workers
+	ALAC_EncodeScratch _scratch;
+	
+	std::vector<Worker *> _workers;
+	std::deque<Slot *> _queue;
+	bool _quit;
+	
+	DeadlineStats _deadline_stats;
+	
+	ALAC_Mutex _mutex;
+	ALAC_Condition _work_cond;
+	ALAC_Condition _done_cond;
+	
+	ALAC_EncodePipeline(const ALAC_EncodePipeline &);
+	ALAC_EncodePipeline & operator = (const ALAC_EncodePipeline &);
+};
+
+
+#endif // ALAC_ENCODE_H
\ No newline at end of file
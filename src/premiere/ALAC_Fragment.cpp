@@ -0,0 +1,232 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Fragment.h"
+
+#include <assert.h>
+
+
+// Boxes get built in memory and written all at once
+static void
+Put32(std::vector<uint8_t> &buf, uint32_t val)
+{
+	buf.push_back(val >> 24);
+	buf.push_back(val >> 16);
+	buf.push_back(val >> 8);
+	buf.push_back(val);
+}
+
+
+static void
+Put64(std::vector<uint8_t> &buf, uint64_t val)
+{
+	Put32(buf, val >> 32);
+	Put32(buf, val & 0xffffffff);
+}
+
+
+static void
+PutHeader(std::vector<uint8_t> &buf, uint32_t size, uint32_t type, uint32_t version_flags)
+{
+	Put32(buf, size);
+	Put32(buf, type);
+	Put32(buf, version_flags);
+}
+
+
+ALAC_FragmentWriter::ALAC_FragmentWriter(AP4_ByteStream &stream, AP4_UI32 track_id, AP4_UI32 fragment_duration) :
+	_stream(stream),
+	_track_id(track_id),
+	_fragment_duration(fragment_duration),
+	_fragment_time(0),
+	_fragment_length(0),
+	_sequence(0)
+{
+
+}
+
+
+AP4_Result
+ALAC_FragmentWriter::AddPacket(const void *data, AP4_Size size, AP4_UI32 duration)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	
+	_data.insert(_data.end(), bytes, bytes + size);
+	
+	_sizes.push_back(size);
+	_durations.push_back(duration);
+	
+	_fragment_length += duration;
+	
+	return (_fragment_length >= _fragment_duration ? WriteFragment() : AP4_SUCCESS);
+}
+
+
+AP4_Result
+ALAC_FragmentWriter::WriteFragment()
+{
+	const AP4_UI32 count = _sizes.size();
+	
+	if(count == 0)
+		return AP4_SUCCESS;
+	
+	
+	AP4_Position moof_offset = 0;
+	
+	AP4_Result result = _stream.Tell(moof_offset);
+	
+	if(result != AP4_SUCCESS)
+		return result;
+	
+	
+	const AP4_UI32 mfhd_size = 16;
+	const AP4_UI32 tfhd_size = 16;
+	const AP4_UI32 tfdt_size = 20;
+	const AP4_UI32 trun_size = 20 + (8 * count);
+	const AP4_UI32 traf_size = 8 + tfhd_size + tfdt_size + trun_size;
+	const AP4_UI32 moof_size = 8 + mfhd_size + traf_size;
+	
+	std::vector<uint8_t> boxes;
+	
+	boxes.reserve(moof_size + 8);
+	
+	Put32(boxes, moof_size);
+	Put32(boxes, AP4_ATOM_TYPE('m','o','o','f'));
+	
+	PutHeader(boxes, mfhd_size, AP4_ATOM_TYPE('m','f','h','d'), 0);
+	Put32(boxes, ++_sequence);
+	
+	Put32(boxes, traf_size);
+	Put32(boxes, AP4_ATOM_TYPE('t','r','a','f'));
+	
+	// default-base-is-moof
+	PutHeader(boxes, tfhd_size, AP4_ATOM_TYPE('t','f','h','d'), 0x00020000);
+	Put32(boxes, _track_id);
+	
+	// version 1, 64-bit decode time
+	PutHeader(boxes, tfdt_size, AP4_ATOM_TYPE('t','f','d','t'), 0x01000000);
+	Put64(boxes, _fragment_time);
+	
+	// data offset, sample duration, sample size
+	PutHeader(boxes, trun_size, AP4_ATOM_TYPE('t','r','u','n'), 0x00000301);
+	Put32(boxes, count);
+	Put32(boxes, moof_size + 8);
+	
+	for(AP4_UI32 i=0; i < count; i++)
+	{
+		Put32(boxes, _durations[i]);
+		Put32(boxes, _sizes[i]);
+	}
+	
+	assert(boxes.size() == moof_size);
+	
+	Put32(boxes, 8 + _data.size());
+	Put32(boxes, AP4_ATOM_TYPE_MDAT);
+	
+	
+	result = _stream.Write(&boxes[0], boxes.size());
+	
+	if(result == AP4_SUCCESS)
+		result = _stream.Write(&_data[0], _data.size());
+	
+	if(result == AP4_SUCCESS)
+	{
+		Fragment fragment;
+		
+		fragment.time = _fragment_time;
+		fragment.moof_offset = moof_offset;
+		
+		_fragments.push_back(fragment);
+	}
+	
+	_fragment_time += _fragment_length;
+	_fragment_length = 0;
+	
+	_data.clear();
+	_sizes.clear();
+	_durations.clear();
+	
+	return result;
+}
+
+
+AP4_Result
+ALAC_FragmentWriter::Finish()
+{
+	AP4_Result result = WriteFragment();
+	
+	if(result != AP4_SUCCESS)
+		return result;
+	
+	
+	const AP4_UI32 entry_size = 8 + 8 + 1 + 1 + 1;
+	const AP4_UI32 tfra_size = 24 + (entry_size * _fragments.size());
+	const AP4_UI32 mfro_size = 16;
+	const AP4_UI32 mfra_size = 8 + tfra_size + mfro_size;
+	
+	std::vector<uint8_t> boxes;
+	
+	boxes.reserve(mfra_size);
+	
+	Put32(boxes, mfra_size);
+	Put32(boxes, AP4_ATOM_TYPE('m','f','r','a'));
+	
+	// version 1, 64-bit times and offsets
+	PutHeader(boxes, tfra_size, AP4_ATOM_TYPE('t','f','r','a'), 0x01000000);
+	Put32(boxes, _track_id);
+	Put32(boxes, 0); // traf, trun, and sample numbers are 1 byte each
+	Put32(boxes, _fragments.size());
+	
+	for(std::vector<Fragment>::const_iterator i = _fragments.begin(); i != _fragments.end(); ++i)
+	{
+		Put64(boxes, i->time);
+		Put64(boxes, i->moof_offset);
+		
+		boxes.push_back(1); // traf_number
+		boxes.push_back(1); // trun_number
+		boxes.push_back(1); // sample_number
+	}
+	
+	PutHeader(boxes, mfro_size, AP4_ATOM_TYPE('m','f','r','o'), 0);
+	Put32(boxes, mfra_size);
+	
+	assert(boxes.size() == mfra_size);
+	
+	return _stream.Write(&boxes[0], boxes.size());
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_FRAGMENT_H
+#define ALAC_FRAGMENT_H
+
+
+#include "Ap4.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+
+// Writes the packets as a series of moof+mdat fragments, with an mfra
+// at the end so players can find them.  The moov (with an mvex) has to
+// be written first, and it has no samples in it.  If the export never
+// finishes, everything up to the last fragment still plays.
+
+class ALAC_FragmentWriter
+{
+  public:
+	ALAC_FragmentWriter(AP4_ByteStream &stream, AP4_UI32 track_id, AP4_UI32 fragment_duration);
+	~ALAC_FragmentWriter() {}
+	
+	AP4_Result AddPacket(const void *data, AP4_Size size, AP4_UI32 duration);
+	
+	// writes the last fragment and the mfra
+	AP4_Result Finish();
+	
+  private:
+	AP4_Result WriteFragment();
+	
+	AP4_ByteStream &_stream;
+	const AP4_UI32 _track_id;
+	const AP4_UI32 _fragment_duration;	// in the track's time scale
+	
+	// the fragment we're working on
+	std::vector<uint8_t> _data;
+	std::vector<AP4_UI32> _sizes;
+	std::vector<AP4_UI32> _durations;
+	AP4_UI64 _fragment_time;
+	AP4_UI64 _fragment_length;
+	
+	AP4_UI32 _sequence;
+	
+	// for the mfra
+	typedef struct
+	{
+		AP4_UI64	time;
+		AP4_UI64	moof_offset;
+	} Fragment;
+	
+	std::vector<Fragment> _fragments;
+};
+
+
+#endif // ALAC_FRAGMENT_H
\ No newline at end of file
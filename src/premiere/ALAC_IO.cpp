@@ -0,0 +1,337 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_IO.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+
+// Read through gaps up to this size instead of seeking over them
+#define ALAC_IO_MERGE_GAP		(64 * 1024)
+
+// but don't make any one read bigger than this
+#define ALAC_IO_MAX_SPAN		(4 * 1024 * 1024)
+
+
+ALAC_IOScheduler ALAC_IOScheduler::_instance;
+
+
+ALAC_IOScheduler::ALAC_IOScheduler()
+{
+	for(int p=0; p < ALAC_PRIORITY_COUNT; p++)
+	{
+		_stats[p].batches = 0;
+		_stats[p].ranges = 0;
+		_stats[p].wait_ms = 0.0;
+		_stats[p].max_wait_ms = 0.0;
+	}
+	
+	_read_stats.reads = 0;
+	_read_stats.bytes = 0;
+	_read_stats.read_ms = 0.0;
+	_read_stats.max_files = 0;
+}
+
+
+bool
+ALAC_IOScheduler::Read(imFileRef file, ALAC_IORange *ranges, int count, ALAC_Priority priority)
+{
+	if(count <= 0)
+		return true;
+	
+	Batch batch;
+	batch.file = file;
+	batch.ranges = ranges;
+	batch.count = count;
+	batch.priority = priority;
+	batch.done = false;
+	batch.ok = true;
+	
+	const double started = ALAC_NowMs();
+	
+	ALAC_Lock lock(_mutex);
+	
+	_queue.push_back(&batch);
+	
+	while(!batch.done)
+	{
+		if( FileBusy(file) )
+		{
+			// somebody's reading this file, they might take us along
+			_cond.Wait(_mutex);
+		}
+		else
+		{
+			// our turn to do the reading for this file
+			_busy_files.push_back(file);
+			
+			if((int)_busy_files.size() > _read_stats.max_files)
+				_read_stats.max_files = _busy_files.size();
+			
+			BatchList work;
+			
+			TakeWork(file, work);
+			
+			_mutex.Unlock();
+			
+			ReadStats stats;
+			
+			DoWork(work, stats);
+			
+			_mutex.Lock();
+			
+			for(BatchList::iterator i = work.begin(); i != work.end(); ++i)
+				(*i)->done = true;
+			
+			_busy_files.erase(std::find(_busy_files.begin(), _busy_files.end(), file));
+			
+			_read_stats.reads += stats.reads;
+			_read_stats.bytes += stats.bytes;
+			_read_stats.read_ms += stats.read_ms;
+			
+			_cond.Broadcast();
+		}
+	}
+	
+	const double wait = ALAC_NowMs() - started;
+	
+	Stats &stats = _stats[priority];
+	
+	stats.batches++;
+	stats.ranges += count;
+	stats.wait_ms += wait;
+	
+	if(wait > stats.max_wait_ms)
+		stats.max_wait_ms = wait;
+	
+	return batch.ok;
+}
+
+
+void
+ALAC_IOScheduler::GetStats(ALAC_Priority priority, Stats &stats)
+{
+	assert(priority >= 0 && priority < ALAC_PRIORITY_COUNT);
+	
+	ALAC_Lock lock(_mutex);
+	
+	stats = _stats[priority];
+}
+
+
+void
+ALAC_IOScheduler::GetReadStats(ReadStats &stats)
+{
+	ALAC_Lock lock(_mutex);
+	
+	stats = _read_stats;
+}
+
+
+bool
+ALAC_IOScheduler::FileBusy(imFileRef file) const
+{
+	// mutex must be locked
+	return (std::find(_busy_files.begin(), _busy_files.end(), file) != _busy_files.end());
+}
+
+
+void
+ALAC_IOScheduler::TakeWork(imFileRef file, BatchList &work)
+{
+	// mutex must be locked
+	assert(!_queue.empty());
+	
+	// everything that wants this file goes together
+	BatchList::iterator i = _queue.begin();
+	
+	while(i != _queue.end())
+	{
+		if((*i)->file == file)
+		{
+			work.push_back(*i);
+			
+			i = _queue.erase(i);
+		}
+		else
+			++i;
+	}
+}
+
+
+static bool
+ReadAt(imFileRef file, uint64_t offset, uint32_t size, uint8_t *buf)
+{
+	// positional reads, the file mark doesn't matter
+#ifdef PRWIN_ENV
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	
+	overlapped.Offset = (DWORD)(offset & 0xffffffff);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	
+	DWORD count = 0;
+	
+	BOOL result = ReadFile(file, buf, size, &count, &overlapped);
+	
+	return (result && count == size);
+#else
+	ByteCount count = 0;
+	
+	OSErr result = FSReadFork(CAST_REFNUM(file), fsFromStart, offset, size, buf, &count);
+	
+	return (result == noErr && count == size);
+#endif
+}
+
+
+typedef struct
+{
+	uint64_t	offset;
+	uint32_t	size;
+	uint8_t		*buf;
+	bool		*ok;
+} IOEntry;
+
+
+static bool
+EntryBefore(const IOEntry &a, const IOEntry &b)
+{
+	return (a.offset < b.offset);
+}
+
+
+void
+ALAC_IOScheduler::DoWork(BatchList &work, ReadStats &stats)
+{
+	stats.reads = 0;
+	stats.bytes = 0;
+	stats.read_ms = 0.0;
+	stats.max_files = 0;
+	
+	const double started = ALAC_NowMs();
+	
+	try
+	{
+		assert(!work.empty());
+	
+		const imFileRef file = work.front()->file;
+		
+		std::vector<IOEntry> entries;
+		
+		for(BatchList::iterator b = work.begin(); b != work.end(); ++b)
+		{
+			assert((*b)->file == file);
+			
+			for(int i=0; i < (*b)->count; i++)
+			{
+				IOEntry entry;
+				
+				entry.offset = (*b)->ranges[i].offset;
+				entry.size = (*b)->ranges[i].size;
+				entry.buf = (*b)->ranges[i].buf;
+				entry.ok = &(*b)->ok;
+				
+				entries.push_back(entry);
+			}
+		}
+		
+		std::sort(entries.begin(), entries.end(), EntryBefore);
+		
+		
+		std::vector<uint8_t> span_buf;
+		
+		size_t first = 0;
+		
+		while(first < entries.size())
+		{
+			// grow the span as long as the next entry is close enough
+			uint64_t span_start = entries[first].offset;
+			uint64_t span_end = span_start + entries[first].size;
+			
+			size_t last = first + 1;
+			
+			while(last < entries.size() &&
+					entries[last].offset <= span_end + ALAC_IO_MERGE_GAP &&
+					entries[last].offset + entries[last].size - span_start <= ALAC_IO_MAX_SPAN)
+			{
+				if(entries[last].offset + entries[last].size > span_end)
+					span_end = entries[last].offset + entries[last].size;
+				
+				last++;
+			}
+			
+			
+			stats.reads++;
+			stats.bytes += (span_end - span_start);
+			
+			if(last == first + 1)
+			{
+				if( !ReadAt(file, span_start, entries[first].size, entries[first].buf) )
+					*entries[first].ok = false;
+			}
+			else
+			{
+				span_buf.resize(span_end - span_start);
+				
+				const bool ok = ReadAt(file, span_start, span_end - span_start, &span_buf[0]);
+				
+				for(size_t i = first; i < last; i++)
+				{
+					if(ok)
+						memcpy(entries[i].buf, &span_buf[entries[i].offset - span_start], entries[i].size);
+					else
+						*entries[i].ok = false;
+				}
+			}
+			
+			first = last;
+		}
+	}
+	catch(...)
+	{
+		for(BatchList::iterator b = work.begin(); b != work.end(); ++b)
+			(*b)->ok = false;
+	}
+	
+	stats.read_ms = ALAC_NowMs() - started;
+}
\ No newline at end of file
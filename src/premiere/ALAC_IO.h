@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_IO_H
+#define ALAC_IO_H
+
+
+#include "ALAC_Premiere_Import.h"
+
+#include "ALAC_Thread.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+
+// With a lot of clips playing at once, each one going off and reading its
+// own packets makes the disk (or the file server) jump all over the place.
+// Instead, everybody hands their reads to this one scheduler.  Reads of the
+// same file wait for each other and then go together, in offset order,
+// merging reads that are close together.  Different files never wait on
+// each other, they could be on different drives.
+//
+// There's no I/O thread: whoever is waiting when their file is free does
+// the reads for everybody else waiting on that file.
+
+typedef struct
+{
+	uint64_t	offset;
+	uint32_t	size;
+	uint8_t		*buf;
+} ALAC_IORange;
+
+
+class ALAC_IOScheduler
+{
+  public:
+	static ALAC_IOScheduler & Instance() { return _instance; }
+	
+	// Reads all the ranges from the file, returns when they're done
+	bool Read(imFileRef file, ALAC_IORange *ranges, int count, ALAC_Priority priority);
+	
+	typedef struct
+	{
+		uint64_t	batches;		// calls to Read()
+		uint64_t	ranges;
+		double		wait_ms;		// total time in Read(), reading included
+		double		max_wait_ms;
+	} Stats;
+	
+	typedef struct
+	{
+		uint64_t	reads;			// what actually went to the file, after merging
+		uint64_t	bytes;
+		double		read_ms;
+		int			max_files;		// most files being read at the same time
+	} ReadStats;
+	
+	void GetStats(ALAC_Priority priority, Stats &stats);
+	void GetReadStats(ReadStats &stats);
+	
+  private:
+	ALAC_IOScheduler();
+	~ALAC_IOScheduler() {}
+	
+	typedef struct
+	{
+		imFileRef		file;
+		ALAC_IORange	*ranges;
+		int				count;
+		ALAC_Priority	priority;
+		bool			done;
+		bool			ok;
+	} Batch;
+	
+	typedef std::vector<Batch *> BatchList;
+	
+	bool FileBusy(imFileRef file) const;
+	void TakeWork(imFileRef file, BatchList &work);
+	static void DoWork(BatchList &work, ReadStats &stats);
+	
+	BatchList _queue;
+	std::vector<imFileRef> _busy_files;
+	
+	Stats _stats[ALAC_PRIORITY_COUNT];
+	ReadStats _read_stats;
+	
+	ALAC_Mutex _mutex;
+	ALAC_Condition _cond;
+	
+	static ALAC_IOScheduler _instance;
+};
+
+
+#endif // ALAC_IO_H
\ No newline at end of file
@@ -0,0 +1,403 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Mux.h"
+
+#include <assert.h>
+
+
+// Boxes get built in memory and written all at once
+static void
+Put16(std::vector<uint8_t> &buf, uint16_t val)
+{
+	buf.push_back(val >> 8);
+	buf.push_back(val);
+}
+
+
+static void
+Put32(std::vector<uint8_t> &buf, uint32_t val)
+{
+	buf.push_back(val >> 24);
+	buf.push_back(val >> 16);
+	buf.push_back(val >> 8);
+	buf.push_back(val);
+}
+
+
+static void
+Put64(std::vector<uint8_t> &buf, uint64_t val)
+{
+	Put32(buf, val >> 32);
+	Put32(buf, val & 0xffffffff);
+}
+
+
+static void
+PutZeros(std::vector<uint8_t> &buf, size_t count)
+{
+	buf.insert(buf.end(), count, 0);
+}
+
+
+// Starts a box, the size gets filled in by EndBox()
+static size_t
+BeginBox(std::vector<uint8_t> &buf, uint32_t type)
+{
+	const size_t start = buf.size();
+	
+	Put32(buf, 0);
+	Put32(buf, type);
+	
+	return start;
+}
+
+
+static size_t
+BeginFullBox(std::vector<uint8_t> &buf, uint32_t type, uint8_t version, uint32_t flags)
+{
+	const size_t start = BeginBox(buf, type);
+	
+	Put32(buf, ((uint32_t)version << 24) | (flags & 0xffffff));
+	
+	return start;
+}
+
+
+static void
+EndBox(std::vector<uint8_t> &buf, size_t start)
+{
+	const uint32_t size = buf.size() - start;
+	
+	buf[start + 0] = size >> 24;
+	buf[start + 1] = size >> 16;
+	buf[start + 2] = size >> 8;
+	buf[start + 3] = size;
+}
+
+
+static void
+PutMatrix(std::vector<uint8_t> &buf)
+{
+	Put32(buf, 0x00010000); Put32(buf, 0); Put32(buf, 0);
+	Put32(buf, 0); Put32(buf, 0x00010000); Put32(buf, 0);
+	Put32(buf, 0); Put32(buf, 0); Put32(buf, 0x40000000);
+}
+
+
+// Version 1 boxes have 64-bit times, only needed for a really long file
+static void
+PutTimes(std::vector<uint8_t> &buf, bool version1, uint32_t middle, uint64_t duration)
+{
+	if(version1)
+	{
+		Put64(buf, 0); // creation_time
+		Put64(buf, 0); // modification_time
+		Put32(buf, middle);
+		Put64(buf, duration);
+	}
+	else
+	{
+		Put32(buf, 0);
+		Put32(buf, 0);
+		Put32(buf, middle);
+		Put32(buf, duration);
+	}
+}
+
+
+ALAC_MovieWriter::ALAC_MovieWriter(const void *magic_cookie, size_t magic_cookie_size,
+									uint32_t sample_rate, uint16_t channels, uint16_t bit_depth,
+									uint32_t chunk_size) :
+	_magic_cookie((const uint8_t *)magic_cookie, (const uint8_t *)magic_cookie + magic_cookie_size),
+	_sample_rate(sample_rate),
+	_channels(channels),
+	_bit_depth(bit_depth),
+	_chunk_size(chunk_size),
+	_data_size(0),
+	_duration(0)
+{
+	assert(_chunk_size > 0);
+}
+
+
+AP4_Result
+ALAC_MovieWriter::WriteFileType(AP4_ByteStream &stream)
+{
+	std::vector<uint8_t> box;
+	
+	const size_t ftyp = BeginBox(box, AP4_ATOM_TYPE('f','t','y','p'));
+	Put32(box, AP4_FILE_BRAND_M4A_);
+	Put32(box, 0); // minor_version
+	Put32(box, AP4_FILE_BRAND_ISOM);
+	Put32(box, AP4_FILE_BRAND_MP42);
+	EndBox(box, ftyp);
+	
+	return stream.Write(&box[0], box.size());
+}
+
+
+void
+ALAC_MovieWriter::AddPacket(uint32_t size, uint32_t duration)
+{
+	if(_sizes.size() % _chunk_size == 0)
+		_chunk_offsets.push_back(_data_size);
+	
+	_sizes.push_back(size);
+	_data_size += size;
+	
+	if(!_time_runs.empty() && _time_runs.back().duration == duration)
+	{
+		_time_runs.back().count++;
+	}
+	else
+	{
+		TimeRun run;
+		
+		run.count = 1;
+		run.duration = duration;
+		
+		_time_runs.push_back(run);
+	}
+	
+	_duration += duration;
+}
+
+
+void
+ALAC_MovieWriter::Finish(uint64_t mdat_payload)
+{
+	const bool version1 = (_duration > 0xffffffff);
+	
+	_moov.clear();
+	_moov.reserve(4096 + _magic_cookie.size() + (4 * _sizes.size()) + (8 * _chunk_offsets.size()));
+	
+	const size_t moov = BeginBox(_moov, AP4_ATOM_TYPE('m','o','o','v'));
+	
+	// the movie's time scale is the sample rate too
+	const size_t mvhd = BeginFullBox(_moov, AP4_ATOM_TYPE('m','v','h','d'), version1 ? 1 : 0, 0);
+	PutTimes(_moov, version1, _sample_rate, _duration);
+	Put32(_moov, 0x00010000); // rate
+	Put16(_moov, 0x0100); // volume
+	PutZeros(_moov, 2 + 8);
+	PutMatrix(_moov);
+	PutZeros(_moov, 24); // pre_defined
+	Put32(_moov, 2); // next_track_ID
+	EndBox(_moov, mvhd);
+	
+	const size_t trak = BeginBox(_moov, AP4_ATOM_TYPE('t','r','a','k'));
+	
+	// enabled, in movie, in preview
+	const size_t tkhd = BeginFullBox(_moov, AP4_ATOM_TYPE('t','k','h','d'), version1 ? 1 : 0, 0x000007);
+	PutZeros(_moov, version1 ? 16 : 8); // creation_time, modification_time
+	Put32(_moov, 1); // track_ID
+	Put32(_moov, 0);
+	
+	if(version1)
+		Put64(_moov, _duration);
+	else
+		Put32(_moov, _duration);
+	
+	PutZeros(_moov, 8);
+	Put16(_moov, 0); // layer
+	Put16(_moov, 0); // alternate_group
+	Put16(_moov, 0x0100); // volume
+	PutZeros(_moov, 2);
+	PutMatrix(_moov);
+	Put32(_moov, 0); // width
+	Put32(_moov, 0); // height
+	EndBox(_moov, tkhd);
+	
+	const size_t mdia = BeginBox(_moov, AP4_ATOM_TYPE('m','d','i','a'));
+	
+	const size_t mdhd = BeginFullBox(_moov, AP4_ATOM_TYPE('m','d','h','d'), version1 ? 1 : 0, 0);
+	PutTimes(_moov, version1, _sample_rate, _duration);
+	Put16(_moov, (('e' - 0x60) << 10) | (('n' - 0x60) << 5) | ('g' - 0x60));
+	Put16(_moov, 0);
+	EndBox(_moov, mdhd);
+	
+	const char handler_name[] = "SoundHandler";
+	
+	const size_t hdlr = BeginFullBox(_moov, AP4_ATOM_TYPE('h','d','l','r'), 0, 0);
+	Put32(_moov, 0); // pre_defined
+	Put32(_moov, AP4_ATOM_TYPE('s','o','u','n'));
+	PutZeros(_moov, 12);
+	_moov.insert(_moov.end(), handler_name, handler_name + sizeof(handler_name));
+	EndBox(_moov, hdlr);
+	
+	const size_t minf = BeginBox(_moov, AP4_ATOM_TYPE('m','i','n','f'));
+	
+	const size_t smhd = BeginFullBox(_moov, AP4_ATOM_TYPE('s','m','h','d'), 0, 0);
+	Put16(_moov, 0); // balance
+	Put16(_moov, 0);
+	EndBox(_moov, smhd);
+	
+	const size_t dinf = BeginBox(_moov, AP4_ATOM_TYPE('d','i','n','f'));
+	const size_t dref = BeginFullBox(_moov, AP4_ATOM_TYPE('d','r','e','f'), 0, 0);
+	Put32(_moov, 1);
+	const size_t url = BeginFullBox(_moov, AP4_ATOM_TYPE('u','r','l',' '), 0, 0x000001); // in this file
+	EndBox(_moov, url);
+	EndBox(_moov, dref);
+	EndBox(_moov, dinf);
+	
+	PutSampleTable(mdat_payload);
+	
+	EndBox(_moov, minf);
+	EndBox(_moov, mdia);
+	EndBox(_moov, trak);
+	EndBox(_moov, moov);
+}
+
+
+void
+ALAC_MovieWriter::PutSampleTable(uint64_t mdat_payload)
+{
+	const size_t stbl = BeginBox(_moov, AP4_ATOM_TYPE('s','t','b','l'));
+	
+	const size_t stsd = BeginFullBox(_moov, AP4_ATOM_TYPE('s','t','s','d'), 0, 0);
+	Put32(_moov, 1);
+	
+	const size_t alac = BeginBox(_moov, AP4_ATOM_TYPE('a','l','a','c'));
+	PutZeros(_moov, 6);
+	Put16(_moov, 1); // data_reference_index
+	PutZeros(_moov, 8); // version, revision, vendor
+	Put16(_moov, _channels);
+	Put16(_moov, _bit_depth);
+	Put16(_moov, 0); // compression_id
+	Put16(_moov, 0); // packet_size
+	
+	// 16.16, so a rate over 65535 can't go here.  Players get the real
+	// one from the mdhd time scale and the magic cookie.
+	Put32(_moov, _sample_rate <= 0xffff ? (_sample_rate << 16) : 0);
+	
+	const size_t cookie = BeginFullBox(_moov, AP4_ATOM_TYPE('a','l','a','c'), 0, 0);
+	_moov.insert(_moov.end(), _magic_cookie.begin(), _magic_cookie.end());
+	EndBox(_moov, cookie);
+	
+	EndBox(_moov, alac);
+	EndBox(_moov, stsd);
+	
+	
+	const size_t stts = BeginFullBox(_moov, AP4_ATOM_TYPE('s','t','t','s'), 0, 0);
+	Put32(_moov, _time_runs.size());
+	
+	for(std::vector<TimeRun>::const_iterator i = _time_runs.begin(); i != _time_runs.end(); ++i)
+	{
+		Put32(_moov, i->count);
+		Put32(_moov, i->duration);
+	}
+	
+	EndBox(_moov, stts);
+	
+	
+	// every chunk is full except maybe the last one
+	const uint32_t chunks = _chunk_offsets.size();
+	const uint32_t last_chunk_size = _sizes.size() - (chunks > 0 ? (chunks - 1) * _chunk_size : 0);
+	
+	const size_t stsc = BeginFullBox(_moov, AP4_ATOM_TYPE('s','t','s','c'), 0, 0);
+	
+	if(chunks == 0)
+	{
+		Put32(_moov, 0);
+	}
+	else if(last_chunk_size == _chunk_size || chunks == 1)
+	{
+		Put32(_moov, 1);
+		Put32(_moov, 1); // first_chunk
+		Put32(_moov, last_chunk_size);
+		Put32(_moov, 1); // sample_description_index
+	}
+	else
+	{
+		Put32(_moov, 2);
+		Put32(_moov, 1);
+		Put32(_moov, _chunk_size);
+		Put32(_moov, 1);
+		Put32(_moov, chunks);
+		Put32(_moov, last_chunk_size);
+		Put32(_moov, 1);
+	}
+	
+	EndBox(_moov, stsc);
+	
+	
+	bool same_size = !_sizes.empty();
+	
+	for(size_t i=1; i < _sizes.size() && same_size; i++)
+		same_size = (_sizes[i] == _sizes[0]);
+	
+	const size_t stsz = BeginFullBox(_moov, AP4_ATOM_TYPE('s','t','s','z'), 0, 0);
+	Put32(_moov, same_size ? _sizes[0] : 0);
+	Put32(_moov, _sizes.size());
+	
+	if(!same_size)
+	{
+		for(std::vector<uint32_t>::const_iterator i = _sizes.begin(); i != _sizes.end(); ++i)
+			Put32(_moov, *i);
+	}
+	
+	EndBox(_moov, stsz);
+	
+	
+	const bool co64 = (chunks > 0 && mdat_payload + _chunk_offsets.back() > 0xffffffff);
+	
+	const size_t stco = BeginFullBox(_moov, co64 ? AP4_ATOM_TYPE('c','o','6','4') : AP4_ATOM_TYPE('s','t','c','o'), 0, 0);
+	Put32(_moov, chunks);
+	
+	for(std::vector<uint64_t>::const_iterator i = _chunk_offsets.begin(); i != _chunk_offsets.end(); ++i)
+	{
+		if(co64)
+			Put64(_moov, mdat_payload + *i);
+		else
+			Put32(_moov, mdat_payload + *i);
+	}
+	
+	EndBox(_moov, stco);
+	
+	EndBox(_moov, stbl);
+}
+
+
+AP4_Result
+ALAC_MovieWriter::WriteMoov(AP4_ByteStream &stream)
+{
+	assert(!_moov.empty()); // Finish() first
+	
+	return stream.Write(&_moov[0], _moov.size());
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_MUX_H
+#define ALAC_MUX_H
+
+
+#include "Ap4.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+
+// Our own MP4 writer for a plain (not fragmented) ALAC file, the other
+// half of ALAC_PacketIndex::Parse().  The packets go straight into the
+// mdat while all we keep are their sizes, and at the end the moov is made
+// right from those: the stts and stsc are a run or two, the stsz only has
+// a table if the packets aren't all the same size, and the chunk offsets
+// go to a co64 once they don't fit in 32 bits.  The sample rate goes in
+// as 32 bits everywhere but the sample entry, which can only hold 16.
+
+class ALAC_MovieWriter
+{
+  public:
+	ALAC_MovieWriter(const void *magic_cookie, size_t magic_cookie_size,
+						uint32_t sample_rate, uint16_t channels, uint16_t bit_depth,
+						uint32_t chunk_size);
+	~ALAC_MovieWriter() {}
+	
+	static AP4_Result WriteFileType(AP4_ByteStream &stream);
+	
+	void AddPacket(uint32_t size, uint32_t duration);
+	
+	// Makes the moov, now that the packets are in and the mdat
+	// payload (the first packet) is at mdat_payload
+	void Finish(uint64_t mdat_payload);
+	
+	uint64_t GetMoovSize() const { return _moov.size(); }
+	
+	AP4_Result WriteMoov(AP4_ByteStream &stream);
+	
+  private:
+	void PutSampleTable(uint64_t mdat_payload);
+	
+	const std::vector<uint8_t> _magic_cookie;
+	const uint32_t _sample_rate;
+	const uint16_t _channels;
+	const uint16_t _bit_depth;
+	const uint32_t _chunk_size;
+	
+	std::vector<uint32_t> _sizes;
+	std::vector<uint64_t> _chunk_offsets;	// from the start of the mdat payload
+	uint64_t _data_size;
+	
+	// stts, run length encoded as we go
+	typedef struct
+	{
+		uint32_t	count;
+		uint32_t	duration;
+	} TimeRun;
+	
+	std::vector<TimeRun> _time_runs;
+	uint64_t _duration;
+	
+	std::vector<uint8_t> _moov;
+};
+
+
+#endif // ALAC_MUX_H
\ No newline at end of file
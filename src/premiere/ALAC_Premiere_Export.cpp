@@ -43,6 +43,10 @@
 
 #include "Ap4.h"
 #include "ALAC_Atom.h"
+#include "ALAC_Encode.h"
+#include "ALAC_Fragment.h"
+#include "ALAC_Mux.h"
+#include "ALAC_Quantize.h"
 
 #include "ALACEncoder.h"
 
@@ -55,13 +59,56 @@
 	#include <sys/timeb.h>
 #endif
 
+#include <deque>
 #include <sstream>
+#include <vector>
 
 
 static const csSDK_int32 ALAC_ID = 'ALAC';
 static const csSDK_int32 ALAC_Export_Class = 'ALAC';
 
 
+#define ALACFastStart	"ALACFastStart"
+#define ALACFragmented	"ALACFragmented"
+#define ALACEffort		"ALACEffort"
+#define ALACFrameSize	"ALACFrameSize"
+#define ALACParallelRender	"ALACParallelRender"
+
+// Frame Size setting that tries a few and picks one
+#define ALAC_FRAME_SIZE_AUTO	0
+
+// How much audio, from the middle of the export, it tries them on
+// (and ALAC_EXPORT_STATS tries the efforts on)
+#define ALAC_FRAME_SIZE_AUTO_SECONDS	4
+
+// Bytes of file writes to save up before handing them to Premiere
+#define ALAC_WRITE_BUFFER_SIZE	(1024 * 1024)
+
+// Buffers for the writer thread, one filling and the rest waiting to be written
+#define ALAC_WRITE_BUFFERS		4
+
+// Room for everything in the moov except the sample tables
+#define ALAC_MOOV_OVERHEAD	4096
+
+// Packets per chunk
+#define ALAC_CHUNK_SIZE		10
+
+// Write the moov ourselves instead of having Bento4 do it
+#define ALAC_NATIVE_MUXER	1
+
+// Seconds of audio in each fragment
+#define ALAC_FRAGMENT_SECONDS	2
+
+// With Parallel Render, several parts of the sequence render at once,
+// each with its own audio renderer
+#define ALAC_RANGE_FRAMES		64
+#define ALAC_MAX_RENDERERS		4
+
+// Tell the Events panel how an export went: how Premiere's audio render
+// got called and how the encoder did.  For benchmarking, not for users.
+#define ALAC_EXPORT_STATS		0
+
+
 typedef struct ExportSettings
 {
 	csSDK_int32					fileType;
@@ -303,6 +350,16 @@ exSDKFileExtension(
 }
 
 
+// Bento4 writes an atom a few bytes at a time, and every one of those would
+// be a trip through Premiere's file suite.  So writes pile up in a buffer,
+// and the position and size are kept here instead of asking Premiere.
+//
+// A full buffer goes to a thread that writes it to the file while the
+// export gets on with rendering and encoding into the next one.  If the
+// disk can't keep up, the export waits for a buffer to come back.  A seek
+// waits for everything before it to be written, and so does Flush(),
+// which reports the first write that failed.
+
 class MyOther_ByteStream : public AP4_ByteStream
 {
   public:
@@ -314,32 +371,116 @@ class MyOther_ByteStream : public AP4_ByteStream
 	virtual AP4_Result Seek(AP4_Position position);
 	virtual AP4_Result Tell(AP4_Position &position);
 	virtual AP4_Result GetSize(AP4_LargeSize &size);
+	virtual AP4_Result Flush();
 	
     virtual void AddReference();
     virtual void Release();
 
   private:
+	class Writer;
+	friend class Writer;
+	
+	typedef std::vector<AP4_UI08> Buffer;
+	
+	AP4_Result Queue();
+	AP4_Result Drain();
+	AP4_Result WriteFile(Buffer &buffer);
+	void WriterLoop();
+	
 	const PrSDKExportFileSuite *_fileSuite;
 	const csSDK_uint32 _fileObject;
 	
+	std::vector<Buffer> _buffers;
+	Buffer *_buffer;				// the one being filled
+	std::deque<Buffer *> _spare;
+	std::deque<Buffer *> _queue;	// front one is being written
+	
+	Writer *_writer;				// NULL if the thread didn't start
+	AP4_Result _write_result;		// first write that failed
+	bool _quit;
+	
+	ALAC_Mutex _mutex;
+	ALAC_Condition _work_cond;
+	ALAC_Condition _done_cond;
+	
+	AP4_Position _position;	// where the next byte goes
+	AP4_LargeSize _size;
+	
 	AP4_Cardinal _refCount;
 };
 
 
+class MyOther_ByteStream::Writer : public ALAC_Thread
+{
+  public:
+	Writer(MyOther_ByteStream &stream) : _stream(stream) {}
+	virtual ~Writer() { Join(); }
+	
+  protected:
+	virtual void Run() { _stream.WriterLoop(); }
+	
+  private:
+	MyOther_ByteStream &_stream;
+};
+
+
 MyOther_ByteStream::MyOther_ByteStream(PrSDKExportFileSuite *fileSuite, csSDK_uint32 fileObject) :
 	_fileSuite(fileSuite),
 	_fileObject(fileObject),
+	_buffers(ALAC_WRITE_BUFFERS),
+	_buffer(NULL),
+	_writer(NULL),
+	_write_result(AP4_SUCCESS),
+	_quit(false),
+	_position(0),
+	_size(0),
 	_refCount(1)
 {
 	prSuiteError err = _fileSuite->Open(_fileObject);
 	
 	if(err != malNoError)
 		throw err;
+	
+	for(std::vector<Buffer>::iterator i = _buffers.begin(); i != _buffers.end(); ++i)
+	{
+		i->reserve(ALAC_WRITE_BUFFER_SIZE);
+		
+		_spare.push_back(&*i);
+	}
+	
+	_buffer = _spare.front();
+	_spare.pop_front();
+	
+	_writer = new Writer(*this);
+	
+	if( !_writer->Start() )
+	{
+		delete _writer;
+		
+		_writer = NULL;
+	}
 }
 
 
 MyOther_ByteStream::~MyOther_ByteStream()
 {
+	// Should have been flushed already, so the error could be reported.
+	// If that failed, this just returns the same error again.
+	Flush();
+	
+	if(_writer != NULL)
+	{
+		{
+			ALAC_Lock lock(_mutex);
+			
+			_quit = true;
+			
+			_work_cond.Signal();
+		}
+		
+		delete _writer;
+	}
+
 	prSuiteError err = _fileSuite->Close(_fileObject);
 	
 	assert(err == malNoError);
@@ -356,61 +497,189 @@ MyOther_ByteStream::ReadPartial(void *buffer, AP4_Size bytes_to_read, AP4_Size &
 AP4_Result
 MyOther_ByteStream::WritePartial(const void *buffer, AP4_Size bytes_to_write, AP4_Size &bytes_written)
 {
-	prSuiteError err = _fileSuite->Write(_fileObject, (void *)buffer, bytes_to_write);
+	bytes_written = 0;
 	
-	bytes_written = ((err == malNoError) ? bytes_to_write : 0);
+	if(bytes_to_write == 0)
+		return AP4_SUCCESS;
 	
-	return ((err == malNoError) ? AP4_SUCCESS : AP4_FAILURE);
+	if(_buffer->size() == _buffer->capacity())
+	{
+		AP4_Result result = Queue();
+		
+		if(result != AP4_SUCCESS)
+			return result;
+	}
+	
+	// as much as fits, Bento4 will call again for the rest
+	const size_t room = _buffer->capacity() - _buffer->size();
+	
+	const AP4_Size bytes = (bytes_to_write < room ? bytes_to_write : room);
+	
+	const AP4_UI08 *data = (const AP4_UI08 *)buffer;
+	
+	_buffer->insert(_buffer->end(), data, data + bytes);
+	
+	bytes_written = bytes;
+	
+	_position += bytes;
+	
+	if(_position > _size)
+		_size = _position;
+	
+	return AP4_SUCCESS;
 }
 
 
 AP4_Result
 MyOther_ByteStream::Seek(AP4_Position position)
 {
+	if(position == _position)
+		return AP4_SUCCESS;
+	
+	AP4_Result result = Flush();
+	
+	if(result != AP4_SUCCESS)
+		return result;
+	
 	prInt64 outPos = 0;
 
 	prSuiteError err = _fileSuite->Seek(_fileObject, position, outPos, fileSeekMode_Begin);
 	
-	return ((err == malNoError) ? AP4_SUCCESS : AP4_FAILURE);
+	if(err != malNoError)
+		return AP4_FAILURE;
+	
+	_position = position;
+	
+	return AP4_SUCCESS;
 }
 
 
 AP4_Result
 MyOther_ByteStream::Tell(AP4_Position &position)
 {
-	prInt64 outPos = 0;
+	position = _position;
+	
+	return AP4_SUCCESS;
+}
 
-// son of a gun, fileSeekMode_End and fileSeekMode_Current are flipped inside Premiere!
-#define PR_SEEK_CURRENT fileSeekMode_End
 
-	prSuiteError err = _fileSuite->Seek(_fileObject, 0, outPos, PR_SEEK_CURRENT);
-	
-	position = outPos;
+AP4_Result
+MyOther_ByteStream::GetSize(AP4_LargeSize &size)
+{
+	size = _size;
 	
-	return ((err == malNoError) ? AP4_SUCCESS : AP4_FAILURE);
+	return AP4_SUCCESS;
 }
 
 
 AP4_Result
-MyOther_ByteStream::GetSize(AP4_LargeSize &size)
+MyOther_ByteStream::Flush()
 {
-	assert(false); // this isn't really getting called, is it?
+	AP4_Result result = Queue();
+	
+	if(result == AP4_SUCCESS)
+		result = Drain();
+	
+	return result;
+}
 
-	prInt64 outPos = 0;
 
-	AP4_Position tellPos = 0;
-	Tell(tellPos);
+// Hand the buffer being filled to the writer and get an empty one
+AP4_Result
+MyOther_ByteStream::Queue()
+{
+	if(_buffer->empty())
+		return _write_result;
+	
+	if(_writer == NULL)
+	{
+		if(_write_result == AP4_SUCCESS)
+			_write_result = WriteFile(*_buffer);
+		
+		_buffer->clear();
+		
+		return _write_result;
+	}
+	
+	ALAC_Lock lock(_mutex);
+	
+	_queue.push_back(_buffer);
+	
+	_work_cond.Signal();
+	
+	while(_spare.empty())
+		_done_cond.Wait(_mutex);
+	
+	_buffer = _spare.front();
+	_spare.pop_front();
+	
+	return _write_result;
+}
 
-// http://en.wikipedia.org/wiki/Facepalm
-#define PR_SEEK_END fileSeekMode_Current
 
-	prSuiteError err = _fileSuite->Seek(_fileObject, 0, outPos, PR_SEEK_END);
+// Wait until everything queued is in the file
+AP4_Result
+MyOther_ByteStream::Drain()
+{
+	ALAC_Lock lock(_mutex);
 	
-	Seek(tellPos);
+	while(!_queue.empty())
+		_done_cond.Wait(_mutex);
+	
+	return _write_result;
+}
+
+
+AP4_Result
+MyOther_ByteStream::WriteFile(Buffer &buffer)
+{
+	prSuiteError err = _fileSuite->Write(_fileObject, &buffer[0], buffer.size());
 	
-	size = outPos;
+	if(err == malNoError)
+		return AP4_SUCCESS;
+	else if(err == exportReturn_OutOfDiskSpace)
+		return AP4_ERROR_NOT_ENOUGH_SPACE;
+	else
+		return AP4_ERROR_WRITE_FAILED;
+}
+
+
+void
+MyOther_ByteStream::WriterLoop()
+{
+	ALAC_Lock lock(_mutex);
 	
-	return ((err == malNoError) ? AP4_SUCCESS : AP4_FAILURE);
+	while(!_quit)
+	{
+		if(_queue.empty())
+		{
+			_work_cond.Wait(_mutex);
+		}
+		else
+		{
+			Buffer *buffer = _queue.front();
+			
+			// after one fails, the rest just get thrown away
+			const bool write = (_write_result == AP4_SUCCESS);
+			
+			_mutex.Unlock();
+			
+			const AP4_Result result = (write ? WriteFile(*buffer) : AP4_SUCCESS);
+			
+			buffer->clear();
+			
+			_mutex.Lock();
+			
+			if(result != AP4_SUCCESS)
+				_write_result = result;
+			
+			_queue.pop_front();
+			
+			_spare.push_back(buffer);
+			
+			_done_cond.Broadcast();
+		}
+	}
 }
 
 
@@ -428,88 +697,962 @@ MyOther_ByteStream::Release()
 }
 
 
+// The packets go straight into the file as they're encoded, so all we
+// have to remember are their sizes.  Bento4 still builds the moov from
+// this, asking for the packets one by one, and they're always one right
+// after the other starting at 0 (the start of the mdat payload).
+
+class My_SampleTable : public AP4_SampleTable
+{
+  public:
+	My_SampleTable(AP4_SampleDescription *description, AP4_Cardinal chunk_size);
+	virtual ~My_SampleTable();
+	
+	void AddPacket(AP4_Size size, AP4_UI32 duration);
+	
+	// where each chunk starts, for the stco
+	void GetChunkOffsets(AP4_Position mdat_payload, AP4_Array<AP4_UI64> &offsets) const;
+	
+	virtual AP4_Result GetSample(AP4_Ordinal index, AP4_Sample &sample);
+	virtual AP4_Cardinal GetSampleCount() { return _sizes.size(); }
+	virtual AP4_Result GetSampleChunkPosition(AP4_Ordinal sample_index, AP4_Ordinal &chunk_index, AP4_Ordinal &position_in_chunk);
+	virtual AP4_Cardinal GetSampleDescriptionCount() { return 1; }
+	virtual AP4_SampleDescription *GetSampleDescription(AP4_Ordinal index) { return (index == 0 ? _description : NULL); }
+	virtual AP4_Result GetSampleIndexForTimeStamp(AP4_UI64 ts, AP4_Ordinal &index);
+	virtual AP4_Ordinal GetNearestSyncSampleIndex(AP4_Ordinal index, bool before = true) { return index; }
+	
+  private:
+	AP4_SampleDescription * const _description;
+	const AP4_Cardinal _chunk_size;
+	
+	std::vector<AP4_UI32> _sizes;
+	std::vector<AP4_UI64> _chunk_offsets;
+	
+	AP4_UI32 _frame_size;		// every packet but the last
+	AP4_UI32 _last_duration;
+	AP4_UI64 _data_size;
+};
+
+
+My_SampleTable::My_SampleTable(AP4_SampleDescription *description, AP4_Cardinal chunk_size) :
+	_description(description),
+	_chunk_size(chunk_size),
+	_frame_size(0),
+	_last_duration(0),
+	_data_size(0)
+{
+
+}
+
+
+My_SampleTable::~My_SampleTable()
+{
+	delete _description;
+}
+
+
+void
+My_SampleTable::AddPacket(AP4_Size size, AP4_UI32 duration)
+{
+	if(_sizes.size() % _chunk_size == 0)
+		_chunk_offsets.push_back(_data_size);
+	
+	if(_sizes.empty())
+		_frame_size = duration;
+	
+	assert(_sizes.empty() || _last_duration == _frame_size); // only the last one can be short
+	
+	_sizes.push_back(size);
+	
+	_last_duration = duration;
+	_data_size += size;
+}
+
+
+void
+My_SampleTable::GetChunkOffsets(AP4_Position mdat_payload, AP4_Array<AP4_UI64> &offsets) const
+{
+	offsets.SetItemCount(_chunk_offsets.size());
+	
+	for(size_t i=0; i < _chunk_offsets.size(); i++)
+		offsets[i] = mdat_payload + _chunk_offsets[i];
+}
+
+
+AP4_Result
+My_SampleTable::GetSample(AP4_Ordinal index, AP4_Sample &sample)
+{
+	if(index >= _sizes.size())
+		return AP4_ERROR_OUT_OF_RANGE;
+	
+	const AP4_Ordinal chunk = index / _chunk_size;
+	
+	AP4_Position offset = _chunk_offsets[chunk];
+	
+	for(AP4_Ordinal i = chunk * _chunk_size; i < index; i++)
+		offset += _sizes[i];
+	
+	sample.SetOffset(offset);
+	sample.SetSize(_sizes[index]);
+	sample.SetDts((AP4_UI64)index * _frame_size);
+	sample.SetDuration(index == _sizes.size() - 1 ? _last_duration : _frame_size);
+	sample.SetCtsDelta(0);
+	sample.SetDescriptionIndex(0);
+	sample.SetSync(true);
+	
+	return AP4_SUCCESS;
+}
+
+
+AP4_Result
+My_SampleTable::GetSampleChunkPosition(AP4_Ordinal sample_index, AP4_Ordinal &chunk_index, AP4_Ordinal &position_in_chunk)
+{
+	if(sample_index >= _sizes.size())
+		return AP4_ERROR_OUT_OF_RANGE;
+	
+	chunk_index = sample_index / _chunk_size;
+	position_in_chunk = sample_index % _chunk_size;
+	
+	return AP4_SUCCESS;
+}
+
+
+AP4_Result
+My_SampleTable::GetSampleIndexForTimeStamp(AP4_UI64 ts, AP4_Ordinal &index)
+{
+	if(_frame_size == 0 || ts / _frame_size >= _sizes.size())
+		return AP4_ERROR_OUT_OF_RANGE;
+	
+	index = ts / _frame_size;
+	
+	return AP4_SUCCESS;
+}
+
+
+// Bento4 makes a 32-bit stco, which is no good past 4GB
+static AP4_Result
+SetChunkOffsets(AP4_TrakAtom *trak, AP4_Array<AP4_UI64> &offsets)
+{
+	const AP4_Cardinal count = offsets.ItemCount();
+	
+	if(count > 0 && offsets[count - 1] > 0xFFFFFFFF)
+	{
+		AP4_ContainerAtom *stbl = AP4_DYNAMIC_CAST(AP4_ContainerAtom, trak->FindChild("mdia/minf/stbl"));
+		
+		AP4_Atom *stco = (stbl != NULL ? stbl->GetChild(AP4_ATOM_TYPE_STCO) : NULL);
+		
+		if(stco == NULL)
+			return AP4_ERROR_INTERNAL;
+		
+		stco->Detach();
+		
+		delete stco;
+		
+		return stbl->AddChild(new AP4_Co64Atom(&offsets[0], count));
+	}
+	else
+		return trak->SetChunkOffsets(offsets);
+}
+
+
+// We know how many packets there will be before we start, so we know
+// how big the moov can get.  The tables are a stsz entry for every
+// packet and a stco (or co64) entry for every chunk.
+static AP4_UI64
+MoovSizeEstimate(long long total_samples, int frame_size, size_t magic_cookie_size)
+{
+	const AP4_UI64 packets = (total_samples + frame_size - 1) / frame_size;
+	const AP4_UI64 chunks = (packets + ALAC_CHUNK_SIZE - 1) / ALAC_CHUNK_SIZE;
+	
+	return ALAC_MOOV_OVERHEAD + magic_cookie_size + (4 * packets) + (8 * chunks);
+}
+
+
+static AP4_Result
+WriteFreeAtom(AP4_ByteStream &stream, AP4_UI32 size)
+{
+	assert(size >= 8);
+	
+	AP4_Result result = stream.WriteUI32(size);
+	
+	if(result == AP4_SUCCESS)
+		result = stream.WriteUI32(AP4_ATOM_TYPE_FREE);
+	
+	const uint8_t zeros[4096] = { 0 };
+	
+	AP4_UI32 left = size - 8;
+	
+	while(left > 0 && result == AP4_SUCCESS)
+	{
+		const AP4_UI32 write_size = (left > sizeof(zeros) ? sizeof(zeros) : left);
+		
+		result = stream.Write(zeros, write_size);
+		
+		left -= write_size;
+	}
+	
+	return result;
+}
+
+
+static prMALError
+WriteError(AP4_Result write_result)
+{
+	prMALError result = malNoError;
+	
+	if(write_result != AP4_SUCCESS)
+	{
+		if(write_result == AP4_ERROR_OUT_OF_MEMORY)
+			result = exportReturn_ErrMemory;
+		else if(write_result == AP4_ERROR_PERMISSION_DENIED)
+			result = exportReturn_ErrPermErr;
+		else if(write_result == AP4_ERROR_NOT_ENOUGH_SPACE)
+			result = exportReturn_OutOfDiskSpace;
+		else if(write_result == AP4_ERROR_WRITE_FAILED)
+			result = exportReturn_ErrIo;
+		else
+			result = exportReturn_InternalError;
+	}
+	
+	return result;
+}
+
+
+// Obviously, this is the value that should go in outputDesc.mFormatFlags.~
+// Adapted from CoreAudioTypes.h
+enum
+{
+    kTestFormatFlag_16BitSourceData    = 1,
+    kTestFormatFlag_20BitSourceData    = 2,
+    kTestFormatFlag_24BitSourceData    = 3,
+    kTestFormatFlag_32BitSourceData    = 4
+};
+
+
+// What Premiere will give us in one GetAudio call
+static csSDK_int32
+MaxBlip(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 audioRenderID, PrTime ticksPerFrame, float sampleRate)
+{
+	csSDK_int32 maxBlip = 0;
+	
+	if(ticksPerFrame <= 0 ||
+		audioSuite->GetMaxBlip(audioRenderID, ticksPerFrame, &maxBlip) != malNoError ||
+		maxBlip <= 0)
+	{
+		maxBlip = sampleRate / 100; // what we always used before
+	}
+	
+	return maxBlip;
+}
+
+
+// Premiere renders up to maxBlip samples at a time, which has nothing to do
+// with our frame size.  This asks for as much as it can with each GetAudio
+// call and hands out whole frames from what's been rendered.
+
+class ALAC_RenderBuffer
+{
+  public:
+	ALAC_RenderBuffer(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 audioRenderID,
+						int channels, csSDK_int32 maxBlip, int frameSize, long long total_samples);
+	~ALAC_RenderBuffer() {}
+	
+	// Planar audio for the next frame, good until the next call
+	prMALError GetFrame(int samples, float * const *&frame);
+	
+	// the GetAudio calls so far
+	typedef struct
+	{
+		uint64_t	calls;
+		uint64_t	samples;
+		double		ms;
+	} Stats;
+	
+	const Stats & GetStats() const { return _stats; }
+	
+	static void AddStats(Stats &total, const Stats &more);
+	
+  private:
+	float * Channel(int c) { return &_buffer[_capacity * c]; }
+	
+	PrSDKSequenceAudioSuite *_audioSuite;
+	const csSDK_uint32 _audioRenderID;
+	const int _channels;
+	const csSDK_int32 _maxBlip;
+	long long _samples_left;	// still to render
+	
+	std::vector<float> _buffer;
+	const size_t _capacity;		// per channel
+	size_t _start;
+	size_t _count;
+	
+	float *_frame[6];
+	float *_render[6];
+	
+	Stats _stats;
+};
+
+
+ALAC_RenderBuffer::ALAC_RenderBuffer(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 audioRenderID,
+										int channels, csSDK_int32 maxBlip, int frameSize, long long total_samples) :
+	_audioSuite(audioSuite),
+	_audioRenderID(audioRenderID),
+	_channels(channels),
+	_maxBlip(maxBlip),
+	_samples_left(total_samples),
+	_capacity(frameSize + maxBlip),
+	_start(0),
+	_count(0)
+{
+	assert(channels <= 6);
+	
+	_buffer.resize(_capacity * channels);
+	
+	_stats.calls = 0;
+	_stats.samples = 0;
+	_stats.ms = 0.0;
+	
+	for(int c=0; c < 6; c++)
+	{
+		_frame[c] = NULL;
+		_render[c] = NULL;
+	}
+}
+
+
+prMALError
+ALAC_RenderBuffer::GetFrame(int samples, float * const *&frame)
+{
+	prMALError result = malNoError;
+	
+	assert(samples + _maxBlip <= _capacity);
+	
+	if(_count < samples)
+	{
+		// slide what's left over to the front
+		if(_start > 0)
+		{
+			for(int c=0; c < _channels; c++)
+				memmove(Channel(c), Channel(c) + _start, sizeof(float) * _count);
+			
+			_start = 0;
+		}
+		
+		while(_count < samples && result == malNoError)
+		{
+			long long samples_to_get = _maxBlip;
+			
+			if(samples_to_get > _samples_left)
+				samples_to_get = _samples_left;
+			
+			if(samples_to_get <= 0)
+			{
+				assert(false); // asked for more than we were supposed to render
+				
+				return exportReturn_InternalError;
+			}
+			
+			for(int c=0; c < _channels; c++)
+				_render[c] = Channel(c) + _count;
+			
+			const double started = ALAC_NowMs();
+			
+			result = _audioSuite->GetAudio(_audioRenderID, samples_to_get, _render, true);
+			
+			_stats.calls++;
+			_stats.samples += samples_to_get;
+			_stats.ms += ALAC_NowMs() - started;
+			
+			_count += samples_to_get;
+			_samples_left -= samples_to_get;
+		}
+	}
+	
+	for(int c=0; c < _channels; c++)
+		_frame[c] = Channel(c) + _start;
+	
+	_start += samples;
+	_count -= samples;
+	
+	frame = _frame;
+	
+	return result;
+}
+
+
+void
+ALAC_RenderBuffer::AddStats(Stats &total, const Stats &more)
+{
+	total.calls += more.calls;
+	total.samples += more.samples;
+	total.ms += more.ms;
+}
+
+
+// Render a frame and convert it for ALAC
+static prMALError
+RenderFrame(ALAC_RenderBuffer &render_buffer, uint8_t *alac_buffer, int samples, int audioChannels, int bitDepth)
+{
+	float * const *pr_buffers = NULL;
+	
+	prMALError result = render_buffer.GetFrame(samples, pr_buffers);
+	
+	if(result == malNoError)
+	{
+		// copy Premiere audio to ALAC buffer, swizzling channels
+		// Premiere uses Left, Right, Left Rear, Right Rear, Center, LFE
+		// ALAC uses Center, Left, Right, Left Rear, Right Rear, LFE
+		// http://alac.macosforge.org/trac/browser/trunk/ReadMe.txt
+		static const int stereo_swizzle[] = {0, 1, 0, 1, 0, 1};
+		static const int surround_swizzle[] = {4, 0, 1, 2, 3, 5};
+		
+		const int *swizzle = (audioChannels > 2 ? surround_swizzle : stereo_swizzle);
+		
+		ALAC_Quantize(alac_buffer, pr_buffers, audioChannels, swizzle, samples, bitDepth);
+	}
+	
+	return result;
+}
+
+
+// A run of whole frames, rendered and encoded by one of the range workers
+typedef struct
+{
+	std::vector<uint8_t>	data;
+	std::vector<int32_t>	sizes;
+	std::vector<int>		samples;
+	prMALError				result;
+} RenderRange;
+
+
+// Premiere's audio render is often slower than the encoder, so this
+// renders several parts of the sequence at once.  The export is cut into
+// ranges of ALAC_RANGE_FRAMES frames.  Each worker makes an audio renderer
+// starting at the beginning of its range, renders and encodes it, and
+// moves on to the next free one.  Ranges start on frame boundaries, so
+// the packets line up the same as if it had all been done in one go.
+// Workers stay within a window of the range being written, so memory
+// doesn't grow with the length of the export.
+//
+// But every new renderer starts effects like reverb, delay, and
+// compressors over again, so the audio won't always match rendering the
+// sequence straight through.  That's why it's an option, and off by default.
+
+class ALAC_RangeRender
+{
+  public:
+	ALAC_RangeRender(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 exID,
+						PrTime startTime, PrTime ticksPerSample, PrTime ticksPerFrame, long long total_samples,
+						PrAudioChannelType audioFormat, int audioChannels, float sampleRate, int bitDepth,
+						const AudioFormatDescription &inputDesc, const AudioFormatDescription &outputDesc,
+						int frameSize, ALAC_Effort effort, int workers);
+	~ALAC_RangeRender();
+	
+	// Waits for the next range in order, false when there are no more
+	bool NextRange(RenderRange &range);
+	
+	// for all the renderers together
+	ALAC_RenderBuffer::Stats GetRenderStats();
+	
+  private:
+	class Worker;
+	friend class Worker;
+	
+	void WorkerLoop(Worker &worker);
+	
+	void RenderOne(long long index, RenderRange &range);
+	
+	PrSDKSequenceAudioSuite *_audioSuite;
+	const csSDK_uint32 _exID;
+	const PrTime _startTime;
+	const PrTime _ticksPerSample;
+	const PrTime _ticksPerFrame;
+	const long long _total_samples;
+	const PrAudioChannelType _audioFormat;
+	const int _audioChannels;
+	const float _sampleRate;
+	const int _bitDepth;
+	const AudioFormatDescription _inputDesc;
+	const AudioFormatDescription _outputDesc;
+	const int _frameSize;
+	const ALAC_Effort _effort;
+	
+	const long long _range_count;
+	long long _next_render;
+	long long _next_write;
+	
+	typedef struct
+	{
+		RenderRange	range;
+		bool		done;
+	} Slot;
+	
+	std::vector<Slot> _window;
+	
+	std::vector<Worker *> _workers;
+	bool _quit;
+	ALAC_Flag _cancel;
+	
+	ALAC_RenderBuffer::Stats _render_stats;
+	
+	ALAC_Mutex _mutex;
+	ALAC_Condition _work_cond;
+	ALAC_Condition _done_cond;
+};
+
+
+class ALAC_RangeRender::Worker : public ALAC_Thread
+{
+  public:
+	Worker(ALAC_RangeRender &render) : _render(render) {}
+	virtual ~Worker() { Join(); }
+	
+  protected:
+	virtual void Run() { _render.WorkerLoop(*this); }
+	
+  private:
+	ALAC_RangeRender &_render;
+};
+
+
+ALAC_RangeRender::ALAC_RangeRender(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 exID,
+									PrTime startTime, PrTime ticksPerSample, PrTime ticksPerFrame, long long total_samples,
+									PrAudioChannelType audioFormat, int audioChannels, float sampleRate, int bitDepth,
+									const AudioFormatDescription &inputDesc, const AudioFormatDescription &outputDesc,
+									int frameSize, ALAC_Effort effort, int workers) :
+	_audioSuite(audioSuite),
+	_exID(exID),
+	_startTime(startTime),
+	_ticksPerSample(ticksPerSample),
+	_ticksPerFrame(ticksPerFrame),
+	_total_samples(total_samples),
+	_audioFormat(audioFormat),
+	_audioChannels(audioChannels),
+	_sampleRate(sampleRate),
+	_bitDepth(bitDepth),
+	_inputDesc(inputDesc),
+	_outputDesc(outputDesc),
+	_frameSize(frameSize),
+	_effort(effort),
+	_range_count((total_samples + ((long long)frameSize * ALAC_RANGE_FRAMES) - 1) / ((long long)frameSize * ALAC_RANGE_FRAMES)),
+	_next_render(0),
+	_next_write(0),
+	_quit(false)
+{
+	_window.resize(workers * 2);
+	
+	for(std::vector<Slot>::iterator i = _window.begin(); i != _window.end(); ++i)
+		i->done = false;
+	
+	_render_stats.calls = 0;
+	_render_stats.samples = 0;
+	_render_stats.ms = 0.0;
+	
+	for(int i=0; i < workers; i++)
+	{
+		Worker *worker = new Worker(*this);
+		
+		if( worker->Start() )
+			_workers.push_back(worker);
+		else
+			delete worker;
+	}
+}
+
+
+ALAC_RangeRender::~ALAC_RangeRender()
+{
+	{
+		ALAC_Lock lock(_mutex);
+		
+		_quit = true;
+		
+		_cancel.Set();
+		
+		_work_cond.Broadcast();
+	}
+	
+	for(std::vector<Worker *>::iterator i = _workers.begin(); i != _workers.end(); ++i)
+	{
+		delete *i;
+	}
+}
+
+
+bool
+ALAC_RangeRender::NextRange(RenderRange &range)
+{
+	if(_next_write >= _range_count)
+		return false;
+	
+	if(_workers.empty())
+	{
+		// couldn't start any threads, so do it here
+		RenderOne(_next_write++, range);
+		
+		return true;
+	}
+	
+	ALAC_Lock lock(_mutex);
+	
+	Slot &slot = _window[_next_write % _window.size()];
+	
+	while(!slot.done)
+		_done_cond.Wait(_mutex);
+	
+	range.data.swap(slot.range.data);
+	range.sizes.swap(slot.range.sizes);
+	range.samples.swap(slot.range.samples);
+	range.result = slot.range.result;
+	
+	slot.done = false;
+	
+	_next_write++;
+	
+	_work_cond.Broadcast();
+	
+	return true;
+}
+
+
+ALAC_RenderBuffer::Stats
+ALAC_RangeRender::GetRenderStats()
+{
+	ALAC_Lock lock(_mutex);
+	
+	return _render_stats;
+}
+
+
+void
+ALAC_RangeRender::WorkerLoop(Worker &worker)
+{
+	ALAC_Lock lock(_mutex);
+	
+	while(!_quit && _next_render < _range_count)
+	{
+		if(_next_render >= _next_write + (long long)_window.size())
+		{
+			_work_cond.Wait(_mutex);
+		}
+		else
+		{
+			const long long index = _next_render++;
+			
+			RenderRange range;
+			
+			_mutex.Unlock();
+			
+			RenderOne(index, range);
+			
+			_mutex.Lock();
+			
+			Slot &slot = _window[index % _window.size()];
+			
+			slot.range.data.swap(range.data);
+			slot.range.sizes.swap(range.sizes);
+			slot.range.samples.swap(range.samples);
+			slot.range.result = range.result;
+			slot.done = true;
+			
+			_done_cond.Broadcast();
+		}
+	}
+}
+
 
-static inline int32_t
-AudioClip(double in, unsigned int max_val)
+void
+ALAC_RangeRender::RenderOne(long long index, RenderRange &range)
 {
-	// My understanding with audio is that it uses the full signed range.
-	// So an 8-bit sample is allowed to go from -128 to 127.  It's not
-	// balanced in positive and negative, but I guess that's OK?
-	return (in >= 0 ?
-				(in < (max_val - 1) ? (in + 0.5) : (max_val - 1)) :
-				(in > (-(int)max_val) ? (in - 0.5) : (-(int)max_val) )
-			);
+	range.result = malNoError;
+	
+	const long long first_sample = index * _frameSize * ALAC_RANGE_FRAMES;
+	
+	long long samples_left = _total_samples - first_sample;
+	
+	if(samples_left > (long long)_frameSize * ALAC_RANGE_FRAMES)
+		samples_left = (long long)_frameSize * ALAC_RANGE_FRAMES;
+	
+	
+	ALACEncoder alac;
+	
+	alac.SetFrameSize(_frameSize);
+	
+	if(alac.InitializeEncoder(_outputDesc) != 0)
+	{
+		range.result = exportReturn_ErrCodecBadInput;
+		
+		return;
+	}
+	
+	
+	csSDK_uint32 audioRenderID = 0;
+	
+	range.result = _audioSuite->MakeAudioRenderer(_exID,
+													_startTime + (first_sample * _ticksPerSample),
+													_audioFormat,
+													kPrAudioSampleType_32BitFloat,
+													_sampleRate,
+													&audioRenderID);
+	
+	if(range.result != malNoError)
+		return;
+	
+	
+	ALAC_RenderBuffer render_buffer(_audioSuite, audioRenderID, _audioChannels,
+									MaxBlip(_audioSuite, audioRenderID, _ticksPerFrame, _sampleRate),
+									_frameSize, samples_left);
+	
+	const size_t frame_bytes = _frameSize * _inputDesc.mBytesPerPacket;
+	
+	std::vector<uint8_t> frame(frame_bytes);
+	
+	ALAC_EncodeScratch scratch;
+	
+	range.data.reserve(frame_bytes * ALAC_RANGE_FRAMES / 2);
+	
+	
+	while(samples_left > 0 && range.result == malNoError && !_cancel.IsSet())
+	{
+		const int samples_this_frame = (samples_left > _frameSize ? _frameSize : samples_left);
+		
+		range.result = RenderFrame(render_buffer, &frame[0], samples_this_frame, _audioChannels, _bitDepth);
+		
+		if(range.result == malNoError)
+		{
+			const size_t pos = range.data.size();
+			
+			range.data.resize(pos + frame_bytes + kALACMaxEscapeHeaderBytes);
 			
-	// BTW, the need to cast max_val into an int before the - operation
-	// was the source of a horrific bug I gave myself.  Sigh.
+			int32_t compressed_bytes = frame_bytes + kALACMaxEscapeHeaderBytes;
+			
+			if( ALAC_EncodePipeline::EncodeFrame(alac, _effort, _inputDesc, _outputDesc,
+													&frame[0], samples_this_frame,
+													&range.data[pos], compressed_bytes, scratch) )
+			{
+				range.data.resize(pos + compressed_bytes);
+				
+				range.sizes.push_back(compressed_bytes);
+				range.samples.push_back(samples_this_frame);
+			}
+			else
+				range.result = exportReturn_ErrCodecBadInput;
+		}
+		
+		samples_left -= samples_this_frame;
+	}
+	
+	{
+		ALAC_Lock lock(_mutex);
+		
+		ALAC_RenderBuffer::AddStats(_render_stats, render_buffer.GetStats());
+	}
+	
+	_audioSuite->ReleaseAudioRenderer(_exID, audioRenderID);
 }
 
 
-template<typename OUTPUT>
+// Shows up in Premiere's Events panel
 static void
-CopySamples(OUTPUT *out, float * const *in, int channels, const int swizzle[], int samples, PrAudioSample pos)
+ReportEvent(ExportSettings *mySettings, const std::string &title, const std::string &description)
 {
-	const double multiplier = (1L << ((sizeof(OUTPUT) << 3) - 1));
+	PrSDKErrorSuite3 *errorSuite = NULL;
 	
-	for(int c=0; c < channels; c++)
+	SPErr spError = mySettings->spBasic->AcquireSuite(kPrSDKErrorSuite, kPrSDKErrorSuiteVersion3,
+														const_cast<const void**>(reinterpret_cast<void**>(&errorSuite)));
+	
+	if(spError == kSPNoError && errorSuite != NULL)
+	{
+		prUTF16Char title16[256];
+		prUTF16Char description16[256];
+		
+		utf16ncpy(title16, title.c_str(), 255);
+		utf16ncpy(description16, description.c_str(), 255);
+		
+		errorSuite->SetEventStringUnicode(PrSDKErrorSuite3::kEventTypeInformational, title16, description16);
+		
+		mySettings->spBasic->ReleaseSuite(kPrSDKErrorSuite, kPrSDKErrorSuiteVersion3);
+	}
+}
+
+
+// Render a bit from the middle of the export, ready for the encoder,
+// to try things out on.  Returns the number of samples, 0 if there
+// isn't enough to tell anything from.
+static int
+RenderSample(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 exID,
+				PrTime startTime, PrTime duration, PrTime ticksPerSecond, PrTime ticksPerFrame,
+				PrAudioChannelType audioFormat, int audioChannels, float sampleRate, int bitDepth,
+				const AudioFormatDescription &inputDesc, std::vector<uint8_t> &pcm)
+{
+	const long long total_samples = (PrTime)sampleRate * duration / ticksPerSecond;
+	
+	long long samples = sampleRate * ALAC_FRAME_SIZE_AUTO_SECONDS;
+	
+	if(samples > total_samples)
+		samples = total_samples;
+	
+	if(samples < kALACDefaultFramesPerPacket * 4)
+		return 0;
+	
+	const PrTime sample_duration = (PrTime)samples * ticksPerSecond / (PrTime)sampleRate;
+	
+	
+	csSDK_uint32 audioRenderID = 0;
+	
+	prMALError result = audioSuite->MakeAudioRenderer(exID,
+														startTime + ((duration - sample_duration) / 2),
+														audioFormat,
+														kPrAudioSampleType_32BitFloat,
+														sampleRate,
+														&audioRenderID);
+	
+	if(result != malNoError)
+		return 0;
+	
+	pcm.resize(samples * inputDesc.mBytesPerPacket);
+	
+	{
+		ALAC_RenderBuffer render_buffer(audioSuite, audioRenderID, audioChannels,
+										MaxBlip(audioSuite, audioRenderID, ticksPerFrame, sampleRate),
+										samples, samples);
+		
+		result = RenderFrame(render_buffer, &pcm[0], samples, audioChannels, bitDepth);
+	}
+	
+	audioSuite->ReleaseAudioRenderer(exID, audioRenderID);
+	
+	return (result == malNoError ? samples : 0);
+}
+
+
+// See which frame size does best on a bit of the export
+static int
+AutoFrameSize(PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 exID,
+				PrTime startTime, PrTime duration, PrTime ticksPerSecond, PrTime ticksPerFrame,
+				PrAudioChannelType audioFormat, int audioChannels, float sampleRate, int bitDepth,
+				const AudioFormatDescription &inputDesc, const AudioFormatDescription &outputDesc,
+				ALAC_Effort effort, std::vector<ALAC_EncodePipeline::FrameSizeResult> &results)
+{
+	static const int frame_sizes[] = { 1024, 2048, 4096, 8192, 16384 };
+	
+	std::vector<uint8_t> pcm;
+	
+	const int samples = RenderSample(audioSuite, exID, startTime, duration, ticksPerSecond, ticksPerFrame,
+										audioFormat, audioChannels, sampleRate, bitDepth, inputDesc, pcm);
+	
+	if(samples == 0)
+		return kALACDefaultFramesPerPacket; // not enough to tell
+	
+	return ALAC_EncodePipeline::ChooseFrameSize(inputDesc, outputDesc, effort,
+												&pcm[0], samples,
+												frame_sizes, sizeof(frame_sizes) / sizeof(frame_sizes[0]),
+												&results);
+}
+
+
+#if ALAC_EXPORT_STATS
+// Encode a bit of the export at every effort, for choosing one.  Size is
+// compared to the PCM, speed to real time on one core.
+static void
+ReportEfforts(ExportSettings *mySettings, PrSDKSequenceAudioSuite *audioSuite, csSDK_uint32 exID,
+				PrTime startTime, PrTime duration, PrTime ticksPerSecond, PrTime ticksPerFrame,
+				PrAudioChannelType audioFormat, int audioChannels, float sampleRate, int bitDepth,
+				const AudioFormatDescription &inputDesc, const AudioFormatDescription &outputDesc,
+				int frameSize)
+{
+	// real-time is default effort when there's no deadline
+	static const ALAC_Effort efforts[] = { ALAC_EFFORT_FAST, ALAC_EFFORT_DEFAULT, ALAC_EFFORT_EXHAUSTIVE, ALAC_EFFORT_ADAPTIVE };
+	static const char * const effort_names[] = { "Fast", "Default", "Exhaustive", "Adaptive" };
+	
+	std::vector<uint8_t> pcm;
+	
+	const int samples = RenderSample(audioSuite, exID, startTime, duration, ticksPerSecond, ticksPerFrame,
+										audioFormat, audioChannels, sampleRate, bitDepth, inputDesc, pcm);
+	
+	if(samples == 0)
+		return;
+	
+	const double audio_ms = samples * 1000.0 / sampleRate;
+	
+	std::stringstream description;
+	
+	description << (int)(audio_ms / 1000.0 + 0.5) << " s at " << frameSize << " (size, speed)";
+	
+	for(int i=0; i < (int)(sizeof(efforts) / sizeof(efforts[0])); i++)
 	{
-		for(int i=0; i < samples; i++)
+		uint64_t bytes = 0;
+		double ms = 0.0;
+		
+		if( ALAC_EncodePipeline::TrialEncode(inputDesc, outputDesc, efforts[i], &pcm[0], samples, frameSize, bytes, ms) )
 		{
-			out[(channels * (pos + i)) + c] = AudioClip(in[swizzle[c]][i] * multiplier, multiplier);
+			description << (i == 0 ? ": " : ", ") << effort_names[i] << " " <<
+							(int)(bytes * 1000 / pcm.size()) / 10.0 << "% " <<
+							(int)(audio_ms / (ms > 0.001 ? ms : 0.001) + 0.5) << "x";
 		}
+		else
+			description << (i == 0 ? ": " : ", ") << effort_names[i] << " failed";
+	}
+	
+	ReportEvent(mySettings, "ALAC effort", description.str());
+}
+#endif
+
+
+static prMALError
+WritePacket(ALAC_FragmentWriter *fragments, AP4_ByteStream &writer,
+			ALAC_MovieWriter *muxer, My_SampleTable *sample_table,
+			const uint8_t *data, int32_t size, int samples)
+{
+	if(fragments != NULL)
+	{
+		return WriteError( fragments->AddPacket(data, size, samples) );
+	}
+	else
+	{
+		prMALError result = WriteError( writer.Write(data, size) );
+		
+		if(muxer != NULL)
+			muxer->AddPacket(size, samples);
+		else
+			sample_table->AddPacket(size, samples);
+		
+		return result;
 	}
 }
 
 
-static void
-CopySamples24(uint8_t *out, float * const *in, int channels, const int swizzle[], int samples, PrAudioSample pos, int bitDepth)
+// The moov comes from our muxer or from Bento4, whichever is in use
+static AP4_UI64
+MoovSize(ALAC_MovieWriter *muxer, AP4_Movie *movie)
+{
+	return (muxer != NULL ? muxer->GetMoovSize() : movie->GetMoovAtom()->GetSize());
+}
+
+
+static AP4_Result
+WriteMoov(ALAC_MovieWriter *muxer, AP4_Movie *movie, AP4_ByteStream &writer)
 {
-	// Apparently with ALAC, 20-bit and 24-bit audio is packed into 3 bytes.
-	// We will make an int32_t and then copy over the top three bytes
-	const int bits_to_clear = 32 - bitDepth;
-	const uint32_t bitmask = ~((uint32_t)((1L << bits_to_clear) - 1));
-	
-	const double multiplier = (1L << (32 - 1));
-	
-	
-	out += 3 * channels * pos;
+	return (muxer != NULL ? muxer->WriteMoov(writer) : movie->GetMoovAtom()->Write(writer));
+}
+
+
+static prMALError
+UpdateProgress(ExportSettings *mySettings, csSDK_uint32 exID, long long samples_written, long long total_samples)
+{
+	float progress = (double)samples_written / (double)total_samples;
 	
+	prMALError result = mySettings->exportProgressSuite->UpdateProgressPercent(exID, progress);
 	
-	for(int i=0; i < samples; i++)
+	if(result == suiteError_ExporterSuspended)
 	{
-		for(int c=0; c < channels; c++)
-		{
-			int32_t val = AudioClip(in[swizzle[c]][i] * multiplier, multiplier);
-			
-			// zero out lower bits (might not be necessary)
-			// converting to unsigned (also might not be necessary)
-			uint32_t *uval = (uint32_t *)&val;
-			
-			*uval &= bitmask;
-			
-			
-			uint8_t *buf = (uint8_t *)&val;
-			
-			// endian-dependant
-			*out++ = buf[1];
-			*out++ = buf[2];
-			*out++ = buf[3];
-		}
+		result = mySettings->exportProgressSuite->WaitForResume(exID);
 	}
+	
+	return result;
 }
 
 
-// Obviously, this is the value that should go in outputDesc.mFormatFlags.~
-// Adapted from CoreAudioTypes.h
-enum
-{
-    kTestFormatFlag_16BitSourceData    = 1,
-    kTestFormatFlag_20BitSourceData    = 2,
-    kTestFormatFlag_24BitSourceData    = 3,
-    kTestFormatFlag_32BitSourceData    = 4
-};
-
-
 static prMALError
 exSDKExport(
 	exportStdParms	*stdParmsP,
@@ -533,6 +1676,13 @@ exSDKExport(
 	PrTime ticksPerSecond = 0;
 	mySettings->timeSuite->GetTicksPerSecond(&ticksPerSecond);
 	
+	// GetMaxBlip wants the sequence frame rate
+	PrParam frameRateP;
+	frameRateP.mInt64 = 0;
+	exportInfoSuite->GetExportSourceInfo(exportInfoP->exporterPluginID, kExportInfo_VideoFrameRate, &frameRateP);
+	
+	const PrTime ticksPerFrame = frameRateP.mInt64;
+	
 					
 	csSDK_uint32 exID = exportInfoP->exporterPluginID;
 	csSDK_uint32 fileType = exportInfoP->fileType;
@@ -544,6 +1694,27 @@ exSDKExport(
 	paramSuite->GetParamValue(exID, gIdx, ADBEAudioNumChannels, &channelTypeP);
 	paramSuite->GetParamValue(exID, gIdx, ADBEAudioSampleType, &sampleSizeP);
 	
+	exParamValues fastStartP;
+	fastStartP.value.intValue = kPrFalse; // older presets won't have it
+	paramSuite->GetParamValue(exID, gIdx, ALACFastStart, &fastStartP);
+	
+	exParamValues fragmentedP;
+	fragmentedP.value.intValue = kPrFalse;
+	paramSuite->GetParamValue(exID, gIdx, ALACFragmented, &fragmentedP);
+	
+	exParamValues effortP;
+	effortP.value.intValue = ALAC_EFFORT_DEFAULT;
+	paramSuite->GetParamValue(exID, gIdx, ALACEffort, &effortP);
+	
+	const ALAC_Effort effort = (ALAC_Effort)effortP.value.intValue;
+	
+	exParamValues frameSizeP;
+	frameSizeP.value.intValue = kALACDefaultFramesPerPacket;
+	paramSuite->GetParamValue(exID, gIdx, ALACFrameSize, &frameSizeP);
+	
+	exParamValues parallelRenderP;
+	parallelRenderP.value.intValue = kPrFalse;
+	paramSuite->GetParamValue(exID, gIdx, ALACParallelRender, &parallelRenderP);
 	
 	
 	const PrAudioChannelType audioFormat = (PrAudioChannelType)channelTypeP.value.intValue;
@@ -553,20 +1724,12 @@ exSDKExport(
 
 	try
 	{
-		const int frameSize = kALACDefaultFramesPerPacket;
-		
-		ALACEncoder alac;
-		
-		alac.SetFrameSize(frameSize);
-		
-
 		const size_t bytes_per_sample = (sampleSizeP.value.intValue == 16 ? 2 :
 											sampleSizeP.value.intValue == 20 ? 3 :
 											sampleSizeP.value.intValue == 24 ? 3 :
 											sampleSizeP.value.intValue == 34 ? 4 :
 											4);
 
-		const size_t alac_buf_size = frameSize * audioChannels * bytes_per_sample;
 						
 												
 		// Only the //* fields are actually used
@@ -599,17 +1762,89 @@ exSDKExport(
 		outputDesc.mBitsPerChannel = sampleSizeP.value.intValue;
 		outputDesc.mReserved = 0;
 		
+		
+		std::vector<ALAC_EncodePipeline::FrameSizeResult> frame_size_results;
+		
+		const int frameSize = (frameSizeP.value.intValue == ALAC_FRAME_SIZE_AUTO ?
+								AutoFrameSize(audioSuite, exID,
+												exportInfoP->startTime, exportInfoP->endTime - exportInfoP->startTime,
+												ticksPerSecond, ticksPerFrame,
+												audioFormat, audioChannels, sampleRateP.value.floatValue, sampleSizeP.value.intValue,
+												inputDesc, outputDesc, effort, frame_size_results) :
+								frameSizeP.value.intValue);
+		
+	#if ALAC_EXPORT_STATS
+		if(!frame_size_results.empty())
+		{
+			// what the automatic frame size had to go on, size compared to the PCM
+			long long samples = (PrTime)sampleRateP.value.floatValue * (exportInfoP->endTime - exportInfoP->startTime) / ticksPerSecond;
+			
+			if(samples > (long long)(sampleRateP.value.floatValue * ALAC_FRAME_SIZE_AUTO_SECONDS))
+				samples = sampleRateP.value.floatValue * ALAC_FRAME_SIZE_AUTO_SECONDS; // as in RenderSample()
+			
+			const uint64_t pcm_bytes = samples * inputDesc.mBytesPerPacket;
+			
+			std::stringstream description;
+			
+			description << "picked " << frameSize << " (size, time)";
+			
+			for(std::vector<ALAC_EncodePipeline::FrameSizeResult>::const_iterator i = frame_size_results.begin(); i != frame_size_results.end(); ++i)
+			{
+				description << (i == frame_size_results.begin() ? ": " : ", ") << i->frame_size;
+				
+				if(i->ok)
+					description << " " << (int)(i->bytes * 1000 / pcm_bytes) / 10.0 << "% " << (int)(i->ms + 0.5) << " ms";
+				else
+					description << " failed";
+			}
+			
+			ReportEvent(mySettings, "ALAC frame size", description.str());
+		}
+		
+		ReportEfforts(mySettings, audioSuite, exID,
+						exportInfoP->startTime, exportInfoP->endTime - exportInfoP->startTime,
+						ticksPerSecond, ticksPerFrame,
+						audioFormat, audioChannels, sampleRateP.value.floatValue, sampleSizeP.value.intValue,
+						inputDesc, outputDesc, frameSize);
+	#endif
+		
+		ALACEncoder alac;
+		
+		alac.SetFrameSize(frameSize);
+		
 		int32_t alac_err = alac.InitializeEncoder(outputDesc);
 		
 		if(alac_err == 0)
 		{
+			const PrTime pr_duration = exportInfoP->endTime - exportInfoP->startTime;
+			const long long total_samples = (PrTime)sampleRateP.value.floatValue * pr_duration / ticksPerSecond;
+			
+			// Ranges have to start on an exact sample
+			const PrTime ticksPerSample = ticksPerSecond / (PrTime)sampleRateP.value.floatValue;
+			
+			const int renderers = ALAC_Thread::Processors() - 1;
+			
+			// Real-time goes through the pipeline in order, the way a capture would
+			const bool realtime = (effort == ALAC_EFFORT_REALTIME);
+			
+			const bool render_ranges = (parallelRenderP.value.intValue && !realtime &&
+										ticksPerSample * (PrTime)sampleRateP.value.floatValue == ticksPerSecond &&
+										total_samples > (long long)frameSize * ALAC_RANGE_FRAMES &&
+										renderers > 1);
+			
+			// The range renderers make their own
 			csSDK_uint32 audioRenderID = 0;
-			result = audioSuite->MakeAudioRenderer(exID,
-													exportInfoP->startTime,
-													audioFormat,
-													kPrAudioSampleType_32BitFloat,
-													sampleRateP.value.floatValue, 
-													&audioRenderID);
+			
+			if(!render_ranges)
+			{
+				result = audioSuite->MakeAudioRenderer(exID,
+														exportInfoP->startTime,
+														audioFormat,
+														kPrAudioSampleType_32BitFloat,
+														sampleRateP.value.floatValue, 
+														&audioRenderID);
+			}
+			
 			if(result == malNoError)
 			{
 				AP4_DataBuffer magic_cookie;
@@ -637,177 +1872,346 @@ exSDKExport(
 				// rate over 65535 can be recorded.  AP4_MpegAudioSampleDescription::ToAtom() seems to be using
 				// this work-around as well, but feels more like a bug.
 				
-				AP4_SyntheticSampleTable *sample_table = new AP4_SyntheticSampleTable;
+				My_SampleTable *sample_table = new My_SampleTable(sample_description, ALAC_CHUNK_SIZE);
 				
-				AP4_Result add_desc_err = sample_table->AddSampleDescription(sample_description);
+				// A fragmented file still gets its moov from Bento4, it's empty anyway.
+				// Otherwise our muxer keeps the packet sizes and makes the moov at the end.
+				ALAC_MovieWriter *muxer = NULL;
 				
+				if(ALAC_NATIVE_MUXER && !fragmentedP.value.intValue)
+				{
+					muxer = new ALAC_MovieWriter(magic_cookie.UseData(), cookie_size,
+													sampleRateP.value.floatValue,
+													audioChannels, sampleSizeP.value.intValue,
+													ALAC_CHUNK_SIZE);
+				}
 				
 				
-				uint8_t *alac_buffer = (uint8_t *)malloc(alac_buf_size);
-				uint8_t *alac_compressed_buffer = (uint8_t *)malloc(alac_buf_size);
-
-			
-				const csSDK_int32 maxBlip = sampleRateP.value.floatValue / 100;
-				//mySettings->sequenceAudioSuite->GetMaxBlip(audioRenderID, frameRateP.value.timeValue, &maxBlip);
+				MyOther_ByteStream writer(fileSuite, exportInfoP->fileObject);
+				
+				AP4_UI32 compatible_brands[2] = {
+					AP4_FILE_BRAND_ISOM,
+					AP4_FILE_BRAND_MP42
+				};
+				
+				AP4_FtypAtom file_type(AP4_FILE_BRAND_M4A_, 0, compatible_brands, 2);
 				
-				assert(maxBlip < frameSize);
+				AP4_Result write_result = (muxer != NULL ? ALAC_MovieWriter::WriteFileType(writer) : file_type.Write(writer));
 				
-				float *pr_buffers[6] = {NULL, NULL, NULL, NULL, NULL, NULL};
+				AP4_Movie *movie = NULL;
+				AP4_Track *track = NULL;
 				
-				for(int i=0; i < audioChannels; i++)
+				ALAC_FragmentWriter *fragments = NULL;
+				
+				if(fragmentedP.value.intValue)
 				{
-					pr_buffers[i] = (float *)malloc(sizeof(float) * maxBlip);
+					// Fragmented: an empty moov up front, then a moof+mdat every few seconds.
+					// Nothing has to be patched at the end, so the file is good up to the
+					// last fragment written.
+					movie = new AP4_Movie;
+					
+					track = new AP4_Track(AP4_Track::TYPE_AUDIO,
+											sample_table,
+											0,
+											sampleRateP.value.floatValue,
+											0,
+											sampleRateP.value.floatValue,
+											0,
+											"eng",
+											0, 0);
+					
+					movie->AddTrack(track);
+					
+					AP4_ContainerAtom *mvex = new AP4_ContainerAtom(AP4_ATOM_TYPE_MVEX);
+					
+					mvex->AddChild(new AP4_TrexAtom(track->GetId(), 1, 0, 0, 0));
+					
+					movie->GetMoovAtom()->AddChild(mvex);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = movie->GetMoovAtom()->Write(writer);
+					
+					fragments = new ALAC_FragmentWriter(writer, track->GetId(),
+															sampleRateP.value.floatValue * ALAC_FRAGMENT_SECONDS);
 				}
 				
-				const PrTime pr_duration = exportInfoP->endTime - exportInfoP->startTime;
-				const long long total_samples = (PrTime)sampleRateP.value.floatValue * pr_duration / ticksPerSecond;
-				long long samples_left = total_samples;
+				// For fast start, we save room for the moov before the mdat and
+				// fill it in at the end.  Until then, it's a free atom.
+				AP4_Position moov_space_pos = 0;
+				AP4_UI64 moov_space = 0;
+				
+				if(fastStartP.value.intValue && fragments == NULL && write_result == AP4_SUCCESS)
+				{
+					moov_space = MoovSizeEstimate(total_samples, frameSize, cookie_size);
+					
+					write_result = writer.Tell(moov_space_pos);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = WriteFreeAtom(writer, moov_space);
+				}
 				
+				// The mdat goes next, with a 64-bit size because we don't know how big
+				// it's going to be.  We'll fill in the size when we're done.
+				AP4_Position mdat_pos = 0;
 				
-				while(samples_left > 0 && result == malNoError)
+				if(fragments == NULL)
 				{
-					int samples_this_frame = frameSize;
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.Tell(mdat_pos);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.WriteUI32(1);
 					
-					if(samples_this_frame > samples_left)
-						samples_this_frame = samples_left;
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.WriteUI32(AP4_ATOM_TYPE_MDAT);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.WriteUI64(0);
+				}
+				
+				result = WriteError(write_result);
+				
+				
+				
+				long long samples_written = 0;
+				
+				ALAC_RenderBuffer::Stats render_stats = { 0, 0, 0.0 };
+				
+			#if ALAC_EXPORT_STATS
+				const double export_started = ALAC_NowMs();
+			#endif
+				
+				
+				if(render_ranges)
+				{
+					ALAC_RangeRender ranges(audioSuite, exID,
+											exportInfoP->startTime, ticksPerSample, ticksPerFrame, total_samples,
+											audioFormat, audioChannels, sampleRateP.value.floatValue, sampleSizeP.value.intValue,
+											inputDesc, outputDesc, frameSize, effort,
+											(renderers > ALAC_MAX_RENDERERS ? ALAC_MAX_RENDERERS : renderers));
 					
-					int samples_left_this_frame = samples_this_frame;
-					int pos_this_frame = 0;
+					RenderRange range;
 					
-					while(samples_left_this_frame > 0 && result == malNoError)
+					while(result == malNoError && ranges.NextRange(range))
 					{
-						int samples_to_get = maxBlip;
-						
-						if(samples_to_get > samples_left_this_frame)
-							samples_to_get = samples_left_this_frame;
+						result = range.result;
 						
-						// first fill up the frame
-						result = audioSuite->GetAudio(audioRenderID, samples_to_get, pr_buffers, true);
+						const uint8_t *packet = (range.data.empty() ? NULL : &range.data[0]);
 						
-						if(result == malNoError)
+						for(size_t i=0; i < range.sizes.size() && result == malNoError; i++)
 						{
-							// copy Premiere audio to ALAC buffer, swizzling channels
-							// Premiere uses Left, Right, Left Rear, Right Rear, Center, LFE
-							// ALAC uses Center, Left, Right, Left Rear, Right Rear, LFE
-							// http://alac.macosforge.org/trac/browser/trunk/ReadMe.txt
-							static const int stereo_swizzle[] = {0, 1, 0, 1, 0, 1};
-							static const int surround_swizzle[] = {4, 0, 1, 2, 3, 5};
-							
-							const int *swizzle = (audioChannels > 2 ? surround_swizzle : stereo_swizzle);
+							result = WritePacket(fragments, writer, muxer, sample_table, packet, range.sizes[i], range.samples[i]);
 							
+							packet += range.sizes[i];
 							
-							if(sampleSizeP.value.intValue == 16)
-							{
-								CopySamples<int16_t>((int16_t *)alac_buffer, pr_buffers, audioChannels, swizzle,
-														samples_to_get, pos_this_frame);
-							}
-							else if(sampleSizeP.value.intValue == 32)
-							{
-								CopySamples<int32_t>((int32_t *)alac_buffer, pr_buffers, audioChannels, swizzle,
-														samples_to_get, pos_this_frame);
-							}
-							else
-							{
-								assert(sampleSizeP.value.intValue == 20 || sampleSizeP.value.intValue == 24);
-								
-								CopySamples24(alac_buffer, pr_buffers, audioChannels, swizzle,
-												samples_to_get, pos_this_frame,
-												sampleSizeP.value.intValue);
-							}
+							samples_written += range.samples[i];
 						}
 						
-						samples_left_this_frame -= samples_to_get;
-						pos_this_frame += samples_to_get;
-						
-						samples_left -= samples_to_get;
+						if(result == malNoError)
+							result = UpdateProgress(mySettings, exID, samples_written, total_samples);
 					}
 					
+					render_stats = ranges.GetRenderStats();
+				}
+				else
+				{
+					// The export thread renders, the pipeline encodes
+					ALAC_EncodePipeline pipeline(inputDesc, outputDesc, frameSize, effort, ALAC_EncodePipeline::DefaultWorkers());
 					
+					ALAC_RenderBuffer render_buffer(audioSuite, audioRenderID, audioChannels,
+													MaxBlip(audioSuite, audioRenderID, ticksPerFrame, sampleRateP.value.floatValue),
+													frameSize, total_samples);
 					
-					int32_t compressed_bytes = alac_buf_size;
+					long long samples_left = total_samples;
 					
-					int32_t alac_err = alac.Encode(inputDesc, outputDesc, alac_buffer, alac_compressed_buffer, &compressed_bytes);
 					
-					if(alac_err == 0)
+					while((samples_left > 0 || !pipeline.Empty()) && result == malNoError)
 					{
-						AP4_MemoryByteStream *sample_data = new AP4_MemoryByteStream(alac_compressed_buffer, compressed_bytes);
-						
-						sample_table->AddSample(*sample_data, 0, compressed_bytes, samples_this_frame, 0, 0, 0, true);
-						
-						sample_data->Release();
+						if(samples_left > 0 && !pipeline.Full())
+						{
+							int samples_this_frame = frameSize;
+							
+							if(samples_this_frame > samples_left)
+								samples_this_frame = samples_left;
+							
+							result = RenderFrame(render_buffer, pipeline.FrameBuffer(), samples_this_frame,
+													audioChannels, sampleSizeP.value.intValue);
+							
+							samples_left -= samples_this_frame;
+							
+							// real-time gets as long as the frame plays
+							const double budget_ms = (realtime ? samples_this_frame * 1000.0 / sampleRateP.value.floatValue : 0.0);
+							
+							if(result == malNoError)
+								pipeline.Encode(samples_this_frame, budget_ms);
+						}
+						else
+						{
+							// write out the oldest packet, waiting for it if need be
+							const uint8_t *alac_compressed_buffer = NULL;
+							int32_t compressed_bytes = 0;
+							int samples_this_frame = 0;
+							
+							if( pipeline.Packet(alac_compressed_buffer, compressed_bytes, samples_this_frame) )
+								result = WritePacket(fragments, writer, muxer, sample_table, alac_compressed_buffer, compressed_bytes, samples_this_frame);
+							else
+								result = exportReturn_ErrCodecBadInput;
+							
+							pipeline.Pop();
+							
+							samples_written += samples_this_frame;
+							
+							if(result == malNoError)
+								result = UpdateProgress(mySettings, exID, samples_written, total_samples);
+						}
 					}
-					else
-						result = exportReturn_ErrCodecBadInput;
 					
-					
-					if(result == malNoError)
+					if(realtime)
 					{
-						float progress = (double)(total_samples - samples_left) / (double)total_samples;
+						const ALAC_EncodePipeline::DeadlineStats stats = pipeline.GetDeadlineStats();
 						
-						result = mySettings->exportProgressSuite->UpdateProgressPercent(exID, progress);
+						std::stringstream description;
 						
-						if(result == suiteError_ExporterSuspended)
-						{
-							result = mySettings->exportProgressSuite->WaitForResume(exID);
-						}
+						description << stats.frames << " frames, " <<
+										stats.lowered << " with less effort, " <<
+										stats.escaped << " stored as PCM, " <<
+										stats.late << " late anyway, longest " <<
+										(int)(stats.max_ms + 0.5) << " ms";
+						
+						ReportEvent(mySettings, "ALAC real-time encode", description.str());
 					}
+					
+					render_stats = render_buffer.GetStats();
 				}
 				
+			#if ALAC_EXPORT_STATS
+				if(render_stats.calls > 0 && samples_written > 0)
+				{
+					// Before maxBlip came from GetMaxBlip, it was always a hundredth
+					// of a second, so that was 100 calls for every second of audio.
+					const double audio_seconds = (double)samples_written / sampleRateP.value.floatValue;
+					const double export_seconds = (ALAC_NowMs() - export_started) / 1000.0;
+					
+					std::stringstream description;
+					
+					description << render_stats.calls << " GetAudio calls, " <<
+									(int)(render_stats.calls / audio_seconds + 0.5) << " per second of audio, " <<
+									(render_stats.samples / render_stats.calls) << " samples each, " <<
+									(int)(render_stats.ms + 0.5) << " ms in GetAudio" <<
+									(render_ranges ? " (all renderers)" : "") << ", " <<
+									(int)(samples_written / export_seconds + 0.5) << " samples/sec overall";
+					
+					ReportEvent(mySettings, "ALAC render", description.str());
+				}
+			#endif
 				
-				AP4_Movie *movie = new AP4_Movie;
-				
-				movie->AddTrack(new AP4_Track(AP4_Track::TYPE_AUDIO,
-												sample_table,
-												0,
-												sampleRateP.value.floatValue,
-												total_samples,
-												sampleRateP.value.floatValue,
-												total_samples,
-												"eng",
-												0, 0) );
-				
-				
-				AP4_File file(movie);
-				
-				AP4_UI32 compatible_brands[2] = {
-					AP4_FILE_BRAND_ISOM,
-					AP4_FILE_BRAND_MP42
-				};
-				file.SetFileType(AP4_FILE_BRAND_M4A_, 0, compatible_brands, 2);
-				
-				
-				
-				MyOther_ByteStream writer(fileSuite, exportInfoP->fileObject);
-		
-				
-				AP4_Result write_result = AP4_FileWriter::Write(file, writer);
 				
-				if(write_result != AP4_SUCCESS)
+				if(fragments != NULL)
+				{
+					// Even if cancelled, finish up what we have so the file is playable
+					const AP4_Result finish_result = fragments->Finish();
+					
+					if(result == malNoError)
+						result = WriteError(finish_result);
+					
+					delete fragments;
+				}
+				else if(muxer == NULL)
 				{
-					if(write_result == AP4_ERROR_OUT_OF_MEMORY)
-						result = exportReturn_ErrMemory;
-					else if(write_result == AP4_ERROR_PERMISSION_DENIED)
-						result = exportReturn_ErrPermErr;
-					else if(write_result == AP4_ERROR_NOT_ENOUGH_SPACE)
-						result = exportReturn_OutOfDiskSpace;
-					else if(write_result == AP4_ERROR_WRITE_FAILED)
-						result = exportReturn_ErrIo;
-					else
-						result = exportReturn_InternalError;
+					movie = new AP4_Movie;
+					
+					track = new AP4_Track(AP4_Track::TYPE_AUDIO,
+											sample_table,
+											0,
+											sampleRateP.value.floatValue,
+											total_samples,
+											sampleRateP.value.floatValue,
+											total_samples,
+											"eng",
+											0, 0);
+					
+					movie->AddTrack(track);
 				}
 				
 				
-				for(int i=0; i < audioChannels; i++)
+				if(result == malNoError && fragments == NULL)
 				{
-					if(pr_buffers[i] != NULL)
-						free(pr_buffers[i]);
+					// now we know how big the mdat is, and the moov goes after it
+					AP4_Position mdat_end = 0;
+					
+					write_result = writer.Tell(mdat_end);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.Seek(mdat_pos + 8);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.WriteUI64(mdat_end - mdat_pos);
+					
+					if(write_result == AP4_SUCCESS)
+						write_result = writer.Seek(mdat_end);
+					
+					if(write_result == AP4_SUCCESS)
+					{
+						if(muxer != NULL)
+						{
+							muxer->Finish(mdat_pos + 16);
+						}
+						else
+						{
+							AP4_Array<AP4_UI64> chunk_offsets;
+							
+							sample_table->GetChunkOffsets(mdat_pos + 16, chunk_offsets);
+							
+							write_result = SetChunkOffsets(track->UseTrakAtom(), chunk_offsets);
+						}
+					}
+					
+					if(write_result == AP4_SUCCESS)
+					{
+						const AP4_UI64 moov_size = MoovSize(muxer, movie);
+						
+						if(moov_space > 0 && (moov_size == moov_space || moov_size + 8 <= moov_space))
+						{
+							// it fits, what's left over is still a free atom
+							write_result = writer.Seek(moov_space_pos);
+							
+							if(write_result == AP4_SUCCESS)
+								write_result = WriteMoov(muxer, movie, writer);
+							
+							if(write_result == AP4_SUCCESS && moov_size < moov_space)
+							{
+								write_result = writer.WriteUI32(moov_space - moov_size);
+								
+								if(write_result == AP4_SUCCESS)
+									write_result = writer.WriteUI32(AP4_ATOM_TYPE_FREE);
+							}
+						}
+						else
+						{
+							// Not fast start, or our guess was too small, or it would leave
+							// 1 to 7 bytes, too few for a free atom.  Then the moov goes at
+							// the end and the space we saved stays a free atom.  Still a
+							// good file, just not fast start.
+							write_result = WriteMoov(muxer, movie, writer);
+						}
+					}
+					
+					result = WriteError(write_result);
 				}
 				
-				free(alac_buffer);
-				free(alac_compressed_buffer);
+				if(result == malNoError)
+					result = WriteError( writer.Flush() );
+				
+				if(movie != NULL)
+					delete movie;
+				else
+					delete sample_table; // the track would have owned it
 				
+				delete muxer;
 				
-				audioSuite->ReleaseAudioRenderer(exID, audioRenderID);
+				
+				if(!render_ranges)
+					audioSuite->ReleaseAudioRenderer(exID, audioRenderID);
 			}
 		}
 	}
@@ -964,8 +2368,97 @@ exSDKGenerateDefaultParams(
 	exportParamSuite->AddParam(exID, gIdx, ADBEBasicAudioGroup, &audioSampleSizeParam);
 	
 	
+	// Fast start (moov first)
+	exParamValues fastStartValues;
+	fastStartValues.structVersion = 1;
+	fastStartValues.value.intValue = kPrFalse;
+	fastStartValues.disabled = kPrFalse;
+	fastStartValues.hidden = kPrFalse;
+	
+	exNewParamInfo fastStartParam;
+	fastStartParam.structVersion = 1;
+	strncpy(fastStartParam.identifier, ALACFastStart, 255);
+	fastStartParam.paramType = exParamType_bool;
+	fastStartParam.flags = exParamFlag_none;
+	fastStartParam.paramValues = fastStartValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicAudioGroup, &fastStartParam);
+	
+	
+	// Fragmented (moof+mdat)
+	exParamValues fragmentedValues;
+	fragmentedValues.structVersion = 1;
+	fragmentedValues.value.intValue = kPrFalse;
+	fragmentedValues.disabled = kPrFalse;
+	fragmentedValues.hidden = kPrFalse;
+	
+	exNewParamInfo fragmentedParam;
+	fragmentedParam.structVersion = 1;
+	strncpy(fragmentedParam.identifier, ALACFragmented, 255);
+	fragmentedParam.paramType = exParamType_bool;
+	fragmentedParam.flags = exParamFlag_none;
+	fragmentedParam.paramValues = fragmentedValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicAudioGroup, &fragmentedParam);
+	
+	
+	// Encoder effort
+	exParamValues effortValues;
+	effortValues.structVersion = 1;
+	effortValues.rangeMin.intValue = ALAC_EFFORT_FAST;
+	effortValues.rangeMax.intValue = ALAC_EFFORT_REALTIME;
+	effortValues.value.intValue = ALAC_EFFORT_DEFAULT;
+	effortValues.disabled = kPrFalse;
+	effortValues.hidden = kPrFalse;
+	
+	exNewParamInfo effortParam;
+	effortParam.structVersion = 1;
+	strncpy(effortParam.identifier, ALACEffort, 255);
+	effortParam.paramType = exParamType_int;
+	effortParam.flags = exParamFlag_none;
+	effortParam.paramValues = effortValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicAudioGroup, &effortParam);
+	
+	
+	// Frame size
+	exParamValues frameSizeValues;
+	frameSizeValues.structVersion = 1;
+	frameSizeValues.rangeMin.intValue = ALAC_FRAME_SIZE_AUTO;
+	frameSizeValues.rangeMax.intValue = 16384;
+	frameSizeValues.value.intValue = kALACDefaultFramesPerPacket;
+	frameSizeValues.disabled = kPrFalse;
+	frameSizeValues.hidden = kPrFalse;
+	
+	exNewParamInfo frameSizeParam;
+	frameSizeParam.structVersion = 1;
+	strncpy(frameSizeParam.identifier, ALACFrameSize, 255);
+	frameSizeParam.paramType = exParamType_int;
+	frameSizeParam.flags = exParamFlag_none;
+	frameSizeParam.paramValues = frameSizeValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicAudioGroup, &frameSizeParam);
+	
+	
+	// Parallel render (several audio renderers)
+	exParamValues parallelRenderValues;
+	parallelRenderValues.structVersion = 1;
+	parallelRenderValues.value.intValue = kPrFalse;
+	parallelRenderValues.disabled = kPrFalse;
+	parallelRenderValues.hidden = kPrFalse;
+	
+	exNewParamInfo parallelRenderParam;
+	parallelRenderParam.structVersion = 1;
+	strncpy(parallelRenderParam.identifier, ALACParallelRender, 255);
+	parallelRenderParam.paramType = exParamType_bool;
+	parallelRenderParam.flags = exParamFlag_none;
+	parallelRenderParam.paramValues = parallelRenderValues;
+	
+	exportParamSuite->AddParam(exID, gIdx, ADBEBasicAudioGroup, &parallelRenderParam);
+	
+	
 
-	exportParamSuite->SetParamsVersion(exID, 1);
+	exportParamSuite->SetParamsVersion(exID, 6);
 	
 	
 	return result;
@@ -1075,6 +2568,61 @@ exSDKPostProcessParams(
 		utf16ncpy(paramString, sampleSizeStrings[i], 255);
 		exportParamSuite->AddConstrainedValuePair(exID, gIdx, ADBEAudioSampleType, &tempSampleType, paramString);
 	}
+	
+	
+	// Fast Start
+	utf16ncpy(paramString, "Fast Start", 255);
+	exportParamSuite->SetParamName(exID, gIdx, ALACFastStart, paramString);
+	
+	// Fragmented
+	utf16ncpy(paramString, "Fragmented", 255);
+	exportParamSuite->SetParamName(exID, gIdx, ALACFragmented, paramString);
+	
+	// Parallel Render
+	utf16ncpy(paramString, "Parallel Render", 255);
+	exportParamSuite->SetParamName(exID, gIdx, ALACParallelRender, paramString);
+	
+	
+	// Encoder Effort
+	utf16ncpy(paramString, "Encoder Effort", 255);
+	exportParamSuite->SetParamName(exID, gIdx, ALACEffort, paramString);
+	
+	int efforts[] = { ALAC_EFFORT_FAST, ALAC_EFFORT_DEFAULT, ALAC_EFFORT_EXHAUSTIVE, ALAC_EFFORT_ADAPTIVE, ALAC_EFFORT_REALTIME };
+	
+	const char *effortStrings[] = { "Fast", "Default", "Exhaustive", "Adaptive", "Real-time" };
+	
+	
+	exportParamSuite->ClearConstrainedValues(exID, gIdx, ALACEffort);
+	
+	exOneParamValueRec tempEffort;
+	
+	for(csSDK_int32 i=0; i < 5; i++)
+	{
+		tempEffort.intValue = efforts[i];
+		utf16ncpy(paramString, effortStrings[i], 255);
+		exportParamSuite->AddConstrainedValuePair(exID, gIdx, ALACEffort, &tempEffort, paramString);
+	}
+	
+	
+	// Frame Size
+	utf16ncpy(paramString, "Frame Size", 255);
+	exportParamSuite->SetParamName(exID, gIdx, ALACFrameSize, paramString);
+	
+	int frameSizes[] = { ALAC_FRAME_SIZE_AUTO, 1024, 2048, 4096, 8192, 16384 };
+	
+	const char *frameSizeStrings[] = { "Automatic", "1024", "2048", "4096", "8192", "16384" };
+	
+	
+	exportParamSuite->ClearConstrainedValues(exID, gIdx, ALACFrameSize);
+	
+	exOneParamValueRec tempFrameSize;
+	
+	for(csSDK_int32 i=0; i < 6; i++)
+	{
+		tempFrameSize.intValue = frameSizes[i];
+		utf16ncpy(paramString, frameSizeStrings[i], 255);
+		exportParamSuite->AddConstrainedValuePair(exID, gIdx, ALACFrameSize, &tempFrameSize, paramString);
+	}
 
 	
 	return result;
@@ -1100,6 +2648,26 @@ exSDKGetParamSummary(
 	paramSuite->GetParamValue(exID, gIdx, ADBEAudioRatePerSecond, &sampleRateP);
 	paramSuite->GetParamValue(exID, gIdx, ADBEAudioNumChannels, &channelTypeP);
 	paramSuite->GetParamValue(exID, gIdx, ADBEAudioSampleType, &sampleSizeP);
+	
+	exParamValues fastStartP;
+	fastStartP.value.intValue = kPrFalse;
+	paramSuite->GetParamValue(exID, gIdx, ALACFastStart, &fastStartP);
+	
+	exParamValues fragmentedP;
+	fragmentedP.value.intValue = kPrFalse;
+	paramSuite->GetParamValue(exID, gIdx, ALACFragmented, &fragmentedP);
+	
+	exParamValues effortP;
+	effortP.value.intValue = ALAC_EFFORT_DEFAULT;
+	paramSuite->GetParamValue(exID, gIdx, ALACEffort, &effortP);
+	
+	exParamValues frameSizeP;
+	frameSizeP.value.intValue = kALACDefaultFramesPerPacket;
+	paramSuite->GetParamValue(exID, gIdx, ALACFrameSize, &frameSizeP);
+	
+	exParamValues parallelRenderP;
+	parallelRenderP.value.intValue = kPrFalse;
+	paramSuite->GetParamValue(exID, gIdx, ALACParallelRender, &parallelRenderP);
 
 
 	std::stringstream stream1;
@@ -1117,6 +2685,27 @@ exSDKGetParamSummary(
 	
 	stream2 << sampleSizeP.value.intValue << "-bit";
 	
+	if(effortP.value.intValue != ALAC_EFFORT_DEFAULT)
+	{
+		stream2 << ", " << (effortP.value.intValue == ALAC_EFFORT_FAST ? "Fast" :
+							effortP.value.intValue == ALAC_EFFORT_EXHAUSTIVE ? "Exhaustive" :
+							effortP.value.intValue == ALAC_EFFORT_REALTIME ? "Real-time" :
+							"Adaptive") << " Encode";
+	}
+	
+	if(frameSizeP.value.intValue == ALAC_FRAME_SIZE_AUTO)
+		stream2 << ", Automatic Frame Size";
+	else if(frameSizeP.value.intValue != kALACDefaultFramesPerPacket)
+		stream2 << ", " << frameSizeP.value.intValue << " Frame Size";
+	
+	if(fragmentedP.value.intValue)
+		stream2 << ", Fragmented";
+	else if(fastStartP.value.intValue)
+		stream2 << ", Fast Start";
+	
+	if(parallelRenderP.value.intValue)
+		stream2 << ", Parallel Render";
+	
 	summary2 = stream2.str();
 	
 	
@@ -55,6 +55,7 @@
 #include	"PrSDKMemoryManagerSuite.h"
 #include	"PrSDKWindowSuite.h"
 #include	"PrSDKAppInfoSuite.h"
+#include	"PrSDKErrorSuite.h"
 
 
 
@@ -46,12 +46,52 @@
 #include "ALACDecoder.h"
 
 #include "ALAC_Atom.h"
+#include "ALAC_Cache.h"
+#include "ALAC_Decode.h"
+#include "ALAC_Demux.h"
+#include "ALAC_IO.h"
+#include "ALAC_Proxy.h"
+#include "ALAC_Segments.h"
+#include "ALAC_SharedCache.h"
+#include "ALAC_Thread.h"
 
 
 #include <assert.h>
 #include <math.h>
 
 #include <sstream>
+#include <vector>
+
+#ifndef PRWIN_ENV
+#include <sys/stat.h>
+#endif
+
+
+// After a file is opened, decode the first couple of seconds in the background
+// so that playback can start right away.  If the file is being re-opened, also
+// decode around the last place we were asked for audio.
+#define ALAC_WARM_START				1
+#define ALAC_WARM_START_SECONDS		2
+#define ALAC_WARM_WINDOW_SECONDS	1
+
+// Decoded audio we hang on to for each clip
+#define ALAC_CLIP_CACHE_BYTES		(16 * 1024 * 1024)
+
+// Build a low sample rate copy of the clip in the background, and play from
+// that when Premiere is shuttling through faster than ALAC_SCRUB_SPEED.
+// A jump bigger than ALAC_SCRUB_WINDOW_SECONDS is a seek, not a scrub.
+// The copy only gets made once somebody scrubs the clip.
+#define ALAC_SCRUB_PROXY			1
+#define ALAC_SCRUB_SPEED			3
+#define ALAC_SCRUB_WINDOW_SECONDS	2
+
+// Open take_0001.m4a, take_0002.m4a, etc. as one clip,
+// when take_0001.m4a.segments is there to ask for it
+#define ALAC_SEGMENTS				1
+#define ALAC_MAX_SEGMENTS			10000
+
+// Biggest ALAC packet we'll decode, in samples
+#define ALAC_MAX_FRAME_LENGTH		65536
 
 
 class My_ByteStream : public AP4_ByteStream
@@ -209,6 +249,452 @@ typedef PrSDKPPixCacheSuite PrCacheSuite;
 #endif
 
 
+typedef struct
+{
+	AP4_Ordinal		index;
+	uint32_t		segment;	// which file it's in
+	PrAudioSample	pos;
+	PrAudioSample	len;
+	AP4_Position	offset;
+	AP4_Size		size;
+	bool			fetch;		// read and decode this one
+	int				samples;	// how many we decoded, -1 if we didn't
+} PacketInfo;
+
+
+// Packet i of the index, in Premiere's sample rate
+static void
+GetPacketInfo(const ALAC_PacketIndex &index, uint32_t i, PrAudioSample sampleRate, PacketInfo &info)
+{
+	const ALAC_Packet &packet = index.GetPacket(i);
+	
+	const PrAudioSample timeScale = index.GetTimeScale();
+	
+	info.index = i;
+	info.segment = index.GetSegment(i);
+	info.pos = (PrAudioSample)packet.dts * sampleRate / timeScale;
+	info.len = (PrAudioSample)packet.duration * sampleRate / timeScale;
+	info.offset = packet.offset;
+	info.size = packet.size;
+	info.fetch = true;
+	info.samples = -1;
+}
+
+
+// The packet that's playing at position
+static bool
+FindPacket(const ALAC_PacketIndex &index, PrAudioSample position, PrAudioSample sampleRate, uint32_t &i)
+{
+	return index.FindPacket(position * index.GetTimeScale() / sampleRate, i);
+}
+
+
+// Reads the packets marked fetch through the I/O scheduler, all together,
+// and then decodes them on the decode pool, all together.  Packet i ends up
+// in out at i * channels * frameLength, one channel after another.
+static bool
+FetchPackets(ALAC_SegmentFiles &files, const void *magic_cookie, size_t magic_cookie_size, const ALACSpecificConfig &config,
+				std::vector<PacketInfo> &packets, std::vector<float> &out, ALAC_Priority priority)
+{
+	std::vector<uint8_t> read_buf;
+	std::vector<size_t> read_pos(packets.size(), 0);
+	
+	for(size_t i=0; i < packets.size(); i++)
+	{
+		PacketInfo &packet = packets[i];
+		
+		packet.samples = -1;
+		
+		if(packet.fetch && packet.size > 0)
+		{
+			read_pos[i] = read_buf.size();
+			
+			read_buf.resize(read_buf.size() + packet.size);
+		}
+		else
+			packet.fetch = false;
+	}
+	
+	if(read_buf.empty())
+		return true;
+	
+	
+	// one trip to the I/O scheduler for each file, usually just the one
+	std::vector<ALAC_IORange> ranges;
+	
+	for(size_t i=0; i < packets.size(); i++)
+	{
+		if(packets[i].fetch)
+		{
+			ALAC_IORange range;
+			
+			range.offset = packets[i].offset;
+			range.size = packets[i].size;
+			range.buf = &read_buf[read_pos[i]];
+			
+			ranges.push_back(range);
+		}
+		
+		const bool last_in_file = (i + 1 == packets.size() || packets[i + 1].segment != packets[i].segment);
+		
+		if(last_in_file && !ranges.empty())
+		{
+			const imFileRef file = files.GetFile(packets[i].segment);
+			
+			if(file == imInvalidHandleValue)
+				return false;
+			
+			if( !ALAC_IOScheduler::Instance().Read(file, &ranges[0], ranges.size(), priority) )
+				return false;
+			
+			ranges.clear();
+		}
+	}
+	
+	
+	const size_t packet_floats = config.frameLength * config.numChannels;
+	
+	out.resize(packets.size() * packet_floats);
+	
+	std::vector<float *> channel_buffers(packets.size() * config.numChannels);
+	std::vector<ALAC_DecodeJob> jobs;
+	std::vector<size_t> job_packets;
+	
+	for(size_t i=0; i < packets.size(); i++)
+	{
+		if(packets[i].fetch)
+		{
+			float **buffers = &channel_buffers[i * config.numChannels];
+			
+			for(int c=0; c < config.numChannels; c++)
+			{
+				buffers[c] = &out[(i * packet_floats) + (c * config.frameLength)];
+			}
+			
+			ALAC_DecodeJob job;
+			
+			job.data = &read_buf[read_pos[i]];
+			job.size = packets[i].size;
+			job.out = buffers;
+			job.samples = 0;
+			job.ok = false;
+			
+			jobs.push_back(job);
+			job_packets.push_back(i);
+		}
+	}
+	
+	ALAC_DecodePool::Instance().Decode(magic_cookie, magic_cookie_size, &jobs[0], jobs.size(), priority);
+	
+	for(size_t j=0; j < jobs.size(); j++)
+	{
+		if(jobs[j].ok)
+			packets[ job_packets[j] ].samples = jobs[j].samples;
+	}
+	
+	return true;
+}
+
+
+// Where FetchPackets put packet i
+static void
+PacketBuffers(const ALACSpecificConfig &config, std::vector<float> &out, size_t i, float **buffers)
+{
+	const size_t packet_floats = config.frameLength * config.numChannels;
+	
+	for(int c=0; c < config.numChannels; c++)
+	{
+		buffers[c] = &out[(i * packet_floats) + (c * config.frameLength)];
+	}
+}
+
+
+// Background threads hand this many packets to the I/O scheduler and decode pool at once
+#define ALAC_BACKGROUND_BATCH		8
+
+
+class ALAC_WarmStart : public ALAC_Thread
+{
+  public:
+	ALAC_WarmStart(ALAC_SegmentFiles &files, const ALAC_PacketIndex &index, ALAC_PacketCache &cache,
+					const void *magic_cookie, size_t magic_cookie_size, const ALACSpecificConfig &config,
+					PrAudioSample position);
+	virtual ~ALAC_WarmStart();
+	
+	void Cancel();
+	
+  protected:
+	virtual void Run();
+	
+  private:
+	void Warm(PrAudioSample start, PrAudioSample end);
+	
+	ALAC_SegmentFiles &_files;
+	const ALAC_PacketIndex &_index;
+	ALAC_PacketCache &_cache;
+	const void * const _magic_cookie;
+	const size_t _magic_cookie_size;
+	const ALACSpecificConfig _config;
+	const PrAudioSample _position;
+	
+	ALAC_Flag _cancel;
+};
+
+
+ALAC_WarmStart::ALAC_WarmStart(ALAC_SegmentFiles &files, const ALAC_PacketIndex &index, ALAC_PacketCache &cache,
+								const void *magic_cookie, size_t magic_cookie_size, const ALACSpecificConfig &config,
+								PrAudioSample position) :
+	_files(files),
+	_index(index),
+	_cache(cache),
+	_magic_cookie(magic_cookie),
+	_magic_cookie_size(magic_cookie_size),
+	_config(config),
+	_position(position)
+{
+
+}
+
+
+ALAC_WarmStart::~ALAC_WarmStart()
+{
+	Cancel();
+}
+
+
+void
+ALAC_WarmStart::Cancel()
+{
+	_cancel.Set();
+	
+	Join();
+}
+
+
+void
+ALAC_WarmStart::Run()
+{
+	const PrAudioSample sampleRate = _config.sampleRate;
+	
+	Warm(0, sampleRate * ALAC_WARM_START_SECONDS);
+	
+	if(_position > 0)
+	{
+		Warm(_position - (sampleRate * ALAC_WARM_WINDOW_SECONDS),
+				_position + (sampleRate * ALAC_WARM_WINDOW_SECONDS));
+	}
+}
+
+
+void
+ALAC_WarmStart::Warm(PrAudioSample start, PrAudioSample end)
+{
+	if(start < 0)
+		start = 0;
+	
+	const PrAudioSample sampleRate = _config.sampleRate;
+	
+	uint32_t packet_index = 0;
+	
+	bool more = FindPacket(_index, start, sampleRate, packet_index);
+	
+	std::vector<float> decoded;
+	
+	while(more && !_cancel.IsSet())
+	{
+		std::vector<PacketInfo> packets;
+		
+		while(packets.size() < ALAC_BACKGROUND_BATCH && more)
+		{
+			if(packet_index < _index.GetPacketCount())
+			{
+				PacketInfo packet;
+				
+				GetPacketInfo(_index, packet_index, sampleRate, packet);
+				
+				if(packet.pos >= end)
+					more = false;
+				else if( !_cache.Has(packet_index) )
+					packets.push_back(packet);
+				
+				packet_index++;
+			}
+			else
+				more = false;
+		}
+		
+		if( !packets.empty() &&
+			FetchPackets(_files, _magic_cookie, _magic_cookie_size, _config, packets, decoded, ALAC_PRIORITY_BACKGROUND) )
+		{
+			for(size_t i=0; i < packets.size(); i++)
+			{
+				if(packets[i].samples >= 0)
+				{
+					float *packet_buffers[6];
+					
+					PacketBuffers(_config, decoded, i, packet_buffers);
+					
+					_cache.Store(packets[i].index, packet_buffers, packets[i].samples);
+				}
+			}
+		}
+	}
+}
+
+
+class ALAC_ProxyBuilder : public ALAC_Thread
+{
+  public:
+	ALAC_ProxyBuilder(ALAC_SegmentFiles &files, const ALAC_PacketIndex &index, ALAC_PacketCache &cache, ALAC_ScrubProxy &proxy,
+						const void *magic_cookie, size_t magic_cookie_size, const ALACSpecificConfig &config);
+	virtual ~ALAC_ProxyBuilder();
+	
+	void Cancel();
+	
+  protected:
+	virtual void Run();
+	
+  private:
+	ALAC_SegmentFiles &_files;
+	const ALAC_PacketIndex &_index;
+	ALAC_PacketCache &_cache;
+	ALAC_ScrubProxy &_proxy;
+	const void * const _magic_cookie;
+	const size_t _magic_cookie_size;
+	const ALACSpecificConfig _config;
+	
+	ALAC_Flag _cancel;
+};
+
+
+ALAC_ProxyBuilder::ALAC_ProxyBuilder(ALAC_SegmentFiles &files, const ALAC_PacketIndex &index, ALAC_PacketCache &cache, ALAC_ScrubProxy &proxy,
+										const void *magic_cookie, size_t magic_cookie_size, const ALACSpecificConfig &config) :
+	_files(files),
+	_index(index),
+	_cache(cache),
+	_proxy(proxy),
+	_magic_cookie(magic_cookie),
+	_magic_cookie_size(magic_cookie_size),
+	_config(config)
+{
+
+}
+
+
+ALAC_ProxyBuilder::~ALAC_ProxyBuilder()
+{
+	Cancel();
+}
+
+
+void
+ALAC_ProxyBuilder::Cancel()
+{
+	_cancel.Set();
+	
+	Join();
+}
+
+
+void
+ALAC_ProxyBuilder::Run()
+{
+	if( !_proxy.Valid() )
+		return;
+	
+	const PrAudioSample sampleRate = _config.sampleRate;
+	
+	std::vector<float> decoded;
+	std::vector<float> cached(_config.frameLength * _config.numChannels);
+	
+	float *cached_buffers[6];
+	const float *in_buffers[6];
+	
+	assert(_config.numChannels <= 6);
+	
+	for(int c=0; c < _config.numChannels; c++)
+	{
+		cached_buffers[c] = &cached[c * _config.frameLength];
+	}
+	
+	
+	while(!_cancel.IsSet())
+	{
+		// if we were here before, pick up where we left off
+		const PrAudioSample start = _proxy.NextInputSample();
+		
+		std::vector<PacketInfo> packets;
+		
+		uint32_t packet_index = 0;
+		
+		if( FindPacket(_index, start, sampleRate, packet_index) )
+		{
+			while(packets.size() < ALAC_BACKGROUND_BATCH && packet_index < _index.GetPacketCount())
+			{
+				PacketInfo packet;
+				
+				GetPacketInfo(_index, packet_index, sampleRate, packet);
+				
+				// the playback thread may have decoded this for us already,
+				// but we don't put anything in the cache, we'd just push out what it needs
+				packet.fetch = !_cache.Has(packet_index);
+				
+				if(packet.pos + packet.len > start)
+					packets.push_back(packet);
+				
+				packet_index++;
+			}
+		}
+		
+		if(packets.empty())
+			break; // all done
+		
+		if( !FetchPackets(_files, _magic_cookie, _magic_cookie_size, _config, packets, decoded, ALAC_PRIORITY_BACKGROUND) )
+			break;
+		
+		
+		for(size_t i=0; i < packets.size() && !_cancel.IsSet(); i++)
+		{
+			const PacketInfo &packet = packets[i];
+			
+			int samples = packet.samples;
+			
+			if(samples >= 0)
+			{
+				float *packet_buffers[6];
+				
+				PacketBuffers(_config, decoded, i, packet_buffers);
+				
+				for(int c=0; c < _config.numChannels; c++)
+					in_buffers[c] = packet_buffers[c];
+			}
+			else if(!packet.fetch)
+			{
+				samples = _cache.Read(packet.index, cached_buffers, 0, 0, _config.frameLength);
+				
+				for(int c=0; c < _config.numChannels; c++)
+					in_buffers[c] = cached_buffers[c];
+			}
+			
+			if(samples < 0)
+				break; // if it fell out of the cache, we'll get it next time around
+			
+			const PrAudioSample skip = _proxy.NextInputSample() - packet.pos;
+			
+			if(skip >= 0 && skip < samples)
+			{
+				for(int c=0; c < _config.numChannels; c++)
+					in_buffers[c] += skip;
+				
+				_proxy.Append(in_buffers, samples - skip);
+			}
+		}
+		
+		if(_proxy.NextInputSample() == start)
+			break; // not getting anywhere
+	}
+}
+
 
 typedef struct
 {	
@@ -219,17 +705,135 @@ typedef struct
 	int						bitDepth;
 	PrAudioSample			duration;
 	
-	My_ByteStream			*reader;
-	AP4_File				*file;
-	AP4_Track				*audio_track;
+	ALAC_PacketIndex		*index;
+	double					index_ms;		// how long it took to build
+	bool					index_native;	// our parser, not Bento4
+	ALAC_SegmentFiles		*segments;
 	ALACDecoder				*alac;
 	
+	ALAC_PacketCache		*cache;
+	void					*magic_cookie; // belongs to the index
+	size_t					magic_cookie_size;
+	
+	PrAudioSample			last_position;
+	ALAC_WarmStart			*warm_start;
+	
+	// time to first audio, to see what the warm start is buying us
+	double					opened_at;			// ALAC_NowMs() when SDKOpenFile8 started
+	double					first_audio_at;		// when the first imImportAudio7 came, 0 until then
+	double					first_audio_ms;		// how long it took
+	uint32_t				first_audio_packets;
+	uint32_t				first_audio_ready;	// already decoded
+	
+	int						scrub_steps;
+	ALAC_ScrubProxy			*proxy;
+	ALAC_ProxyBuilder		*proxy_builder;
+	
 } ImporterLocalRec8, *ImporterLocalRec8Ptr, **ImporterLocalRec8H;
 
 
+#if ALAC_SCRUB_PROXY
+// Somebody's scrubbing, so start building the proxy if we haven't yet.
+// It doesn't help this time, but it will the next.
+static void
+StartScrubProxy(ImporterLocalRec8Ptr localRecP)
+{
+	const ALACSpecificConfig &config = localRecP->alac->mConfig;
+	
+	if(localRecP->proxy != NULL || !(config.numChannels <= 2 || config.numChannels == 6))
+		return;
+	
+	const PrAudioSample duration = localRecP->index->GetDuration() * config.sampleRate /
+									localRecP->index->GetTimeScale();
+	
+	localRecP->proxy = new ALAC_ScrubProxy(config.numChannels, config.sampleRate, duration);
+	
+	if(localRecP->proxy->Valid())
+	{
+		localRecP->proxy_builder = new ALAC_ProxyBuilder(*localRecP->segments, *localRecP->index,
+															*localRecP->cache, *localRecP->proxy,
+															localRecP->magic_cookie, localRecP->magic_cookie_size, config);
+		
+		if( !localRecP->proxy_builder->Start() )
+		{
+			delete localRecP->proxy_builder;
+			
+			localRecP->proxy_builder = NULL;
+		}
+	}
+	
+	if(localRecP->proxy_builder == NULL)
+	{
+		// no room for it, or no thread, maybe next time
+		delete localRecP->proxy;
+		
+		localRecP->proxy = NULL;
+	}
+}
+#endif
+
+
 static const csSDK_int32 ALAC_filetype = 'ALAC';
 
 
+// How opens are going across every clip: how long they take, and how many
+// are running at once.  When a project loads, Premiere opens its files on
+// as many threads as it likes, and they shouldn't be waiting on each other.
+typedef struct
+{
+	uint64_t	opens;
+	uint64_t	failed;
+	double		open_ms;
+	double		max_open_ms;
+	int			open_now;
+	int			max_at_once;
+} OpenStats;
+
+static ALAC_Mutex g_open_mutex;
+static OpenStats g_open_stats = { 0, 0, 0.0, 0.0, 0, 0 };
+
+
+static void
+OpenStarted()
+{
+	ALAC_Lock lock(g_open_mutex);
+	
+	g_open_stats.open_now++;
+	
+	if(g_open_stats.open_now > g_open_stats.max_at_once)
+		g_open_stats.max_at_once = g_open_stats.open_now;
+}
+
+
+static void
+OpenFinished(double ms, bool ok)
+{
+	ALAC_Lock lock(g_open_mutex);
+	
+	g_open_stats.open_now--;
+	
+	if(ok)
+	{
+		g_open_stats.opens++;
+		g_open_stats.open_ms += ms;
+		
+		if(ms > g_open_stats.max_open_ms)
+			g_open_stats.max_open_ms = ms;
+	}
+	else
+		g_open_stats.failed++;
+}
+
+
+static OpenStats
+GetOpenStats()
+{
+	ALAC_Lock lock(g_open_mutex);
+	
+	return g_open_stats;
+}
+
+
 static prMALError 
 SDKInit(
 	imStdParms		*stdParms, 
@@ -258,10 +862,6 @@ SDKInit(
 	importInfo->avoidAudioConform	= kPrTrue;		// If I let Premiere conform the audio, I get silence when
 													// I try to play it in the program.  Seems like a bug to me.
 
-	
-	
-	AP4_DefaultAtomFactory::Instance.AddTypeHandler(new ALAC_TypeHandler);
-	
 
 	return malNoError;
 }
@@ -305,7 +905,190 @@ SDKGetIndFormat(
 			result = imBadFormatIndex;
 	}
 
-	return result;
+	return result;
+}
+
+
+#ifndef PRWIN_ENV
+static bool
+StatPath(const prUTF16Char *path, struct stat &info)
+{
+	uint8_t posix_path[1024];
+	
+	CFStringRef filePathCFSR = CFStringCreateWithCharacters(NULL, path, prUTF16CharLength(path));
+	
+	CFURLRef filePathURL = CFURLCreateWithFileSystemPath(NULL, filePathCFSR, kCFURLPOSIXPathStyle, false);
+	
+	Boolean got_path = false;
+	
+	if(filePathURL != NULL)
+	{
+		got_path = CFURLGetFileSystemRepresentation(filePathURL, true, posix_path, sizeof(posix_path));
+		
+		CFRelease(filePathURL);
+	}
+	
+	CFRelease(filePathCFSR);
+	
+	return (got_path && stat((const char *)posix_path, &info) == 0);
+}
+#endif
+
+
+// Identifies the clip to ALAC_SharedCache, the same in every process.
+// A joined series isn't the same clip as its first file, and any of the
+// later files could be replaced on its own, so they all go in.
+static uint64_t
+SharedFileID(imFileRef fileRef, const ALAC_SegmentFiles &segments, const void *magic_cookie, size_t magic_cookie_size)
+{
+#ifdef PRWIN_ENV
+	BY_HANDLE_FILE_INFORMATION info;
+	
+	if( !GetFileInformationByHandle(fileRef, &info) )
+		return 0;
+	
+	const uint32_t id[7] = {	info.dwVolumeSerialNumber,
+								info.nFileIndexHigh, info.nFileIndexLow,
+								info.nFileSizeHigh, info.nFileSizeLow,
+								info.ftLastWriteTime.dwHighDateTime, info.ftLastWriteTime.dwLowDateTime };
+#else
+	struct stat info;
+	
+	if( !StatPath(segments.GetPath(0), info) )
+		return 0;
+	
+	const int64_t id[4] = { info.st_dev, info.st_ino, info.st_size, info.st_mtime };
+#endif
+
+	uint64_t hash = ALAC_SharedCache::FileID(id, sizeof(id));
+	
+	for(int i=1; i < segments.GetCount(); i++)
+	{
+		const prUTF16Char *path = segments.GetPath(i);
+		
+		hash = ALAC_SharedCache::FileID(path, sizeof(prUTF16Char) * prUTF16CharLength(path), hash);
+		
+	#ifdef PRWIN_ENV
+		WIN32_FILE_ATTRIBUTE_DATA seg_info;
+		
+		if( !GetFileAttributesExW(path, GetFileExInfoStandard, &seg_info) )
+			return 0;
+		
+		const uint32_t seg_id[4] = {	seg_info.nFileSizeHigh, seg_info.nFileSizeLow,
+										seg_info.ftLastWriteTime.dwHighDateTime, seg_info.ftLastWriteTime.dwLowDateTime };
+	#else
+		struct stat seg_info;
+		
+		if( !StatPath(path, seg_info) )
+			return 0;
+		
+		const int64_t seg_id[4] = { seg_info.st_dev, seg_info.st_ino, seg_info.st_size, seg_info.st_mtime };
+	#endif
+	
+		hash = ALAC_SharedCache::FileID(seg_id, sizeof(seg_id), hash);
+	}
+	
+	// throw in the cookie too, just to be safe
+	return ALAC_SharedCache::FileID(magic_cookie, magic_cookie_size, hash);
+}
+
+
+// If our own parser can't make sense of the file, fill in the index with Bento4
+static prMALError
+BentoPacketIndex(AP4_ByteStream &reader, ALAC_PacketIndex &index)
+{
+	// Every open gets its own atom factory.  The factory keeps track of where
+	// it is while parsing, so sharing AP4_DefaultAtomFactory::Instance isn't
+	// safe when Premiere opens files on more than one thread.
+	AP4_DefaultAtomFactory atom_factory;
+	
+	atom_factory.AddTypeHandler(new ALAC_TypeHandler);
+	
+	AP4_File file(reader, atom_factory);
+	
+	AP4_Movie *movie = file.GetMovie();
+	
+	AP4_Track *audio_track = (movie != NULL ? movie->GetTrack(AP4_Track::TYPE_AUDIO) : NULL);
+	
+	if(audio_track == NULL)
+		return imFileHasNoImportableStreams;
+	
+	assert(audio_track->GetSampleDescriptionCount() == 1);
+	
+	AP4_SampleDescription *desc = audio_track->GetSampleDescription(0);
+	
+	if(desc == NULL || desc->GetFormat() != AP4_SAMPLE_FORMAT_ALAC)
+		return imUnsupportedCompression;
+	
+	ALAC_Atom *alac_atom = AP4_DYNAMIC_CAST(ALAC_Atom, desc->GetDetails().GetChild(AP4_SAMPLE_FORMAT_ALAC));
+	
+	if(alac_atom == NULL)
+		return imBadHeader;
+	
+	size_t magic_cookie_size = 0;
+	
+	void *magic_cookie = alac_atom->GetMagicCookie(magic_cookie_size);
+	
+	if(magic_cookie == NULL || magic_cookie_size == 0)
+		return imBadHeader;
+	
+	index.SetFormat(magic_cookie, magic_cookie_size, audio_track->GetMediaTimeScale(), audio_track->GetMediaDuration());
+	
+	const AP4_Cardinal sample_count = audio_track->GetSampleCount();
+	
+	for(AP4_Ordinal i=0; i < sample_count; i++)
+	{
+		AP4_Sample sample;
+		
+		if(audio_track->GetSample(i, sample) != AP4_SUCCESS)
+			return imBadFile;
+		
+		index.AddPacket(sample.GetOffset(), sample.GetSize(), sample.GetDts(), sample.GetDuration());
+	}
+	
+	return malNoError;
+}
+
+
+// If the file is the start of a numbered series, and its sidecar says
+// to join them, tack the rest of the series on to the end of the index.
+// We stop at the first one that's missing or doesn't match.
+static void
+AddSegments(ALAC_PacketIndex &index, ALAC_SegmentFiles &segments)
+{
+	if( !ALAC_SegmentFiles::JoinRequested(segments.GetPath(0)) )
+		return;
+	
+	std::vector<prUTF16Char> next_path;
+	
+	while(segments.GetCount() < ALAC_MAX_SEGMENTS &&
+			ALAC_SegmentFiles::NextPath(segments.GetPath(segments.GetCount() - 1), next_path))
+	{
+		const imFileRef file = ALAC_SegmentFiles::Open(&next_path[0]);
+		
+		if(file == imInvalidHandleValue)
+			break;
+		
+		ALAC_PacketIndex next_index;
+		
+		bool got_index = false;
+		
+		try
+		{
+			My_ByteStream reader(file);
+			
+			got_index = (next_index.Parse(reader) || BentoPacketIndex(reader, next_index) == malNoError);
+		}
+		catch(...) {}
+		
+		// we'll open it again when we need it
+		ALAC_SegmentFiles::Close(file);
+		
+		if(!got_index || !index.Append(next_index))
+			break;
+		
+		segments.AddSegment(&next_path[0]);
+	}
 }
 
 
@@ -316,6 +1099,10 @@ SDKOpenFile8(
 	imFileOpenRec8	*SDKfileOpenRec8)
 {
 	prMALError			result = malNoError;
+	
+	const double opened_at = ALAC_NowMs();
+	
+	OpenStarted();
 
 	ImporterLocalRec8H	localRecH = NULL;
 	ImporterLocalRec8Ptr localRecP = NULL;
@@ -337,11 +1124,29 @@ SDKOpenFile8(
 
 		localRecP = reinterpret_cast<ImporterLocalRec8Ptr>( *localRecH );
 		
-		localRecP->reader = NULL;
-		localRecP->file = NULL;
-		localRecP->audio_track = NULL;
+		localRecP->index = NULL;
+		localRecP->index_ms = 0.0;
+		localRecP->index_native = false;
+		localRecP->segments = NULL;
 		localRecP->alac = NULL;
 		
+		localRecP->cache = NULL;
+		localRecP->magic_cookie = NULL;
+		localRecP->magic_cookie_size = 0;
+		
+		localRecP->last_position = 0;
+		localRecP->warm_start = NULL;
+		
+		localRecP->opened_at = 0.0;
+		localRecP->first_audio_at = 0.0;
+		localRecP->first_audio_ms = 0.0;
+		localRecP->first_audio_packets = 0;
+		localRecP->first_audio_ready = 0;
+		
+		localRecP->scrub_steps = 0;
+		localRecP->proxy = NULL;
+		localRecP->proxy_builder = NULL;
+		
 		localRecP->importerID = SDKfileOpenRec8->inImporterID;
 		localRecP->fileType = SDKfileOpenRec8->fileinfo.filetype;
 	}
@@ -414,55 +1219,85 @@ SDKOpenFile8(
 		
 		try
 		{
-			localRecP->reader = new My_ByteStream(*SDKfileRef);
+			My_ByteStream reader(*SDKfileRef);
 			
-			localRecP->file = new AP4_File(*localRecP->reader);
+			const double index_started = ALAC_NowMs();
 			
+			localRecP->index = new ALAC_PacketIndex;
 			
-			AP4_Track *audio_track = localRecP->file->GetMovie()->GetTrack(AP4_Track::TYPE_AUDIO);
+			localRecP->index_native = localRecP->index->Parse(reader);
 			
-			if(audio_track != NULL)
+			if(!localRecP->index_native)
 			{
-				assert(audio_track->GetSampleDescriptionCount() == 1);
+				// our parser only knows about the files we make, Bento4 knows about everything else
+				delete localRecP->index;
+				
+				localRecP->index = new ALAC_PacketIndex;
 				
-				AP4_SampleDescription *desc = audio_track->GetSampleDescription(0);
+				result = BentoPacketIndex(reader, *localRecP->index);
+			}
+			
+			localRecP->index_ms = ALAC_NowMs() - index_started;
+			
+			if(result == malNoError)
+			{
+				size_t magic_cookie_size = 0;
 				
-				AP4_AudioSampleDescription *audio_desc = AP4_DYNAMIC_CAST(AP4_AudioSampleDescription, desc);
+				void *magic_cookie = localRecP->index->GetMagicCookie(magic_cookie_size);
 				
-				if(desc != NULL && desc->GetFormat() == AP4_SAMPLE_FORMAT_ALAC)
+				if(magic_cookie != NULL && magic_cookie_size > 0 &&
+					localRecP->index->GetTimeScale() > 0 && localRecP->index->GetPacketCount() > 0)
 				{
-					localRecP->audio_track = audio_track;
+					localRecP->segments = new ALAC_SegmentFiles(*SDKfileRef, SDKfileOpenRec8->fileinfo.filepath);
+					
+				#if ALAC_SEGMENTS
+					AddSegments(*localRecP->index, *localRecP->segments);
+				#endif
+				
+					localRecP->alac = new ALACDecoder();
 					
-					ALAC_Atom *alac_atom = AP4_DYNAMIC_CAST(ALAC_Atom, desc->GetDetails().GetChild(AP4_SAMPLE_FORMAT_ALAC));
+					int32_t alac_result = localRecP->alac->Init(magic_cookie, magic_cookie_size);
 					
-					if(alac_atom != NULL)
+					if(alac_result == 0)
 					{
-						size_t magic_cookie_size = 0;
+						const ALACSpecificConfig &config = localRecP->alac->mConfig;
 						
-						void *magic_cookie = alac_atom->GetMagicCookie(magic_cookie_size);
+						localRecP->magic_cookie = magic_cookie;
+						localRecP->magic_cookie_size = magic_cookie_size;
 						
-						if(magic_cookie != NULL && magic_cookie_size > 0)
+						// these stick around until the file is closed
+						if(localRecP->cache == NULL)
 						{
-							localRecP->alac = new ALACDecoder();
+							const uint64_t shared_id = SharedFileID(*SDKfileRef, *localRecP->segments,
+																	magic_cookie, magic_cookie_size);
+						
+							localRecP->cache = new ALAC_PacketCache(config.numChannels, ALAC_CLIP_CACHE_BYTES, shared_id);
 							
-							int32_t alac_result = localRecP->alac->Init(magic_cookie, magic_cookie_size);
+							ALAC_DecodePool::Instance().Retain();
+						}
+						
+					#if ALAC_WARM_START
+						if(config.numChannels <= 2 || config.numChannels == 6)
+						{
+							localRecP->warm_start = new ALAC_WarmStart(*localRecP->segments, *localRecP->index, *localRecP->cache,
+																		magic_cookie, magic_cookie_size, config,
+																		localRecP->last_position);
 							
-							if(alac_result != 0)
+							if( !localRecP->warm_start->Start() )
 							{
-								result = imBadHeader;
+								delete localRecP->warm_start;
+								
+								localRecP->warm_start = NULL;
 							}
 						}
-						else
-							result = imBadHeader;
+					#endif
 					}
 					else
 						result = imBadHeader;
 				}
 				else
-					result = imUnsupportedCompression;
+					result = imBadHeader;
 			}
-			else
-				result = imFileHasNoImportableStreams;
 		}
 		catch(...)
 		{
@@ -475,14 +1310,48 @@ SDKOpenFile8(
 	{
 		if(SDKfileOpenRec8->privatedata)
 		{
+			if(localRecP->proxy_builder)
+				delete localRecP->proxy_builder;
+			
+			if(localRecP->warm_start)
+				delete localRecP->warm_start;
+			
+			if(localRecP->proxy)
+				delete localRecP->proxy;
+			
+			if(localRecP->alac)
+				delete localRecP->alac;
+			
+			if(localRecP->index)
+				delete localRecP->index;
+			
+			if(localRecP->segments)
+				delete localRecP->segments;
+			
+			if(localRecP->cache)
+			{
+				delete localRecP->cache;
+				
+				ALAC_DecodePool::Instance().Release();
+			}
+			
 			stdParms->piSuites->memFuncs->disposeHandle(reinterpret_cast<PrMemoryHandle>(SDKfileOpenRec8->privatedata));
 			SDKfileOpenRec8->privatedata = NULL;
 		}
 	}
 	else
 	{
+		// every open gets its own warm start, so start counting again
+		localRecP->opened_at = opened_at;
+		localRecP->first_audio_at = 0.0;
+		localRecP->first_audio_ms = 0.0;
+		localRecP->first_audio_packets = 0;
+		localRecP->first_audio_ready = 0;
+		
 		stdParms->piSuites->memFuncs->unlockHandle(reinterpret_cast<char**>(SDKfileOpenRec8->privatedata));
 	}
+	
+	OpenFinished(ALAC_NowMs() - opened_at, result == malNoError);
 
 	return result;
 }
@@ -509,21 +1378,42 @@ SDKQuietFile(
 		ImporterLocalRec8Ptr localRecP = reinterpret_cast<ImporterLocalRec8Ptr>( *ldataH );
 
 
-		if(localRecP->file)
+		// background threads have to finish up before we pull the file out from under them
+		if(localRecP->warm_start)
+		{
+			delete localRecP->warm_start;
+			
+			localRecP->warm_start = NULL;
+		}
+		
+		if(localRecP->proxy_builder)
 		{
-			delete localRecP->file;
+			delete localRecP->proxy_builder;
 			
-			localRecP->file = NULL;
+			localRecP->proxy_builder = NULL;
+		}
+		
+		// the proxy can be big, and it gets built again if there's more scrubbing
+		if(localRecP->proxy)
+		{
+			delete localRecP->proxy;
+			
+			localRecP->proxy = NULL;
 		}
 
-		if(localRecP->reader)
+		if(localRecP->index)
 		{
-			delete localRecP->reader;
+			delete localRecP->index;
 			
-			localRecP->reader = NULL;
+			localRecP->index = NULL;
+		}
+		
+		if(localRecP->segments)
+		{
+			delete localRecP->segments;
+			
+			localRecP->segments = NULL;
 		}
-	
-		localRecP->audio_track = NULL;
 		
 		if(localRecP->alac)
 		{
@@ -532,6 +1422,11 @@ SDKQuietFile(
 			localRecP->alac = NULL;
 		}
 		
+		localRecP->magic_cookie = NULL;
+		localRecP->magic_cookie_size = 0;
+		
+		// but hang on to the cache, we might be back
+		
 
 		stdParms->piSuites->memFuncs->unlockHandle(reinterpret_cast<char**>(ldataH));
 
@@ -569,6 +1464,22 @@ SDKCloseFile(
 		stdParms->piSuites->memFuncs->lockHandle(reinterpret_cast<char**>(ldataH));
 
 		ImporterLocalRec8Ptr localRecP = reinterpret_cast<ImporterLocalRec8Ptr>( *ldataH );;
+		
+		if(localRecP->proxy)
+		{
+			delete localRecP->proxy;
+			
+			localRecP->proxy = NULL;
+		}
+		
+		if(localRecP->cache)
+		{
+			delete localRecP->cache;
+			
+			localRecP->cache = NULL;
+			
+			ALAC_DecodePool::Instance().Release();
+		}
 
 		stdParms->piSuites->memFuncs->disposeHandle(reinterpret_cast<PrMemoryHandle>(ldataH));
 	}
@@ -596,6 +1507,94 @@ SDKAnalysis(
 		localRecP->audioSampleRate << " Hz, " <<
 		localRecP->bitDepth << "-bit";
 	
+	
+	// How long decode jobs and reads are waiting compared to how long they
+	// take.  Playback should never be waiting behind the background stuff.
+	std::stringstream stats;
+	
+	// What the packet index cost to build and keep.  Bento4 is the fallback
+	// for files our parser can't read, so it's the one to compare against.
+	if(localRecP->index != NULL)
+	{
+		stats << "\npacket index: " <<
+			localRecP->index->GetPacketCount() << " packets, " <<
+			((localRecP->index->GetMemorySize() + 1023) / 1024) << " KB, " <<
+			localRecP->index_ms << " ms to build with " <<
+			(localRecP->index_native ? "our parser" : "Bento4");
+	}
+	
+	// Time to first audio is how long Premiere waited on the first
+	// imImportAudio7 after the open.  Turn off ALAC_WARM_START to compare.
+	if(localRecP->first_audio_at > 0.0)
+	{
+		stats << "\nfirst audio: asked for " <<
+			(int)(localRecP->first_audio_at - localRecP->opened_at + 0.5) << " ms after open, took " <<
+			localRecP->first_audio_ms << " ms, " <<
+			localRecP->first_audio_ready << " of " << localRecP->first_audio_packets << " packets ready";
+	}
+	
+	const char * const priority_names[ALAC_PRIORITY_COUNT] = { "playback", "render", "background" };
+	
+	for(int p=0; p < ALAC_PRIORITY_COUNT; p++)
+	{
+		ALAC_DecodePool::Stats pool_stats;
+		
+		ALAC_DecodePool::Instance().GetStats((ALAC_Priority)p, pool_stats);
+		
+		if(pool_stats.packets > 0)
+		{
+			stats << "\n" << priority_names[p] << " decode: " <<
+				pool_stats.packets << " packets, " <<
+				(pool_stats.wait_ms / pool_stats.packets) << " ms avg wait, " <<
+				pool_stats.max_wait_ms << " ms max wait, " <<
+				(pool_stats.decode_ms / pool_stats.packets) << " ms avg decode";
+		}
+		
+		ALAC_IOScheduler::Stats io_stats;
+		
+		ALAC_IOScheduler::Instance().GetStats((ALAC_Priority)p, io_stats);
+		
+		if(io_stats.batches > 0)
+		{
+			stats << "\n" << priority_names[p] << " reads: " <<
+				io_stats.ranges << " packets in " << io_stats.batches << " batches, " <<
+				(io_stats.wait_ms / io_stats.batches) << " ms avg wait, " <<
+				io_stats.max_wait_ms << " ms max wait";
+		}
+	}
+	
+	// Opens overlapping is what we want during a project load
+	const OpenStats open_stats = GetOpenStats();
+	
+	if(open_stats.opens > 0)
+	{
+		stats << "\nfile opens: " <<
+			open_stats.opens << " opens, " <<
+			(open_stats.open_ms / open_stats.opens) << " ms avg, " <<
+			open_stats.max_open_ms << " ms max, " <<
+			open_stats.max_at_once << " at once";
+		
+		if(open_stats.failed > 0)
+			stats << ", " << open_stats.failed << " failed";
+	}
+	
+	// How well reads are being merged, and whether files are read side by side
+	ALAC_IOScheduler::ReadStats read_stats;
+	
+	ALAC_IOScheduler::Instance().GetReadStats(read_stats);
+	
+	if(read_stats.reads > 0)
+	{
+		stats << "\nfile reads: " <<
+			read_stats.reads << " reads, " <<
+			(read_stats.bytes / read_stats.reads) << " bytes avg, " <<
+			(read_stats.read_ms / read_stats.reads) << " ms avg, " <<
+			read_stats.max_files << " files at once";
+	}
+	
+	if(SDKAnalysisRec->buffersize > ss.str().size() + stats.str().size())
+		ss << stats.str();
+	
 	if(SDKAnalysisRec->buffersize > ss.str().size())
 		strcpy(SDKAnalysisRec->buffer, ss.str().c_str());
 
@@ -628,73 +1627,34 @@ SDKGetInfo8(
 	SDKFileInfo8->hasAudio = kPrFalse;
 	
 	
-	if(localRecP && localRecP->audio_track && localRecP->alac)
+	if(localRecP && localRecP->index && localRecP->alac)
 	{
-		try
-		{
-			assert(localRecP->reader != NULL);
-			assert(localRecP->file != NULL && localRecP->file->GetMovie() != NULL);
-			
-			assert(localRecP->audio_track->GetSampleDescriptionCount() == 1);
-			
-			AP4_SampleDescription *desc = localRecP->audio_track->GetSampleDescription(0);
-			
-			if(desc != NULL && desc->GetFormat() == AP4_SAMPLE_FORMAT_ALAC)
-			{
-				AP4_AudioSampleDescription *audio_desc = AP4_DYNAMIC_CAST(AP4_AudioSampleDescription, desc);
-				
-				if(audio_desc != NULL)
-				{
-					// Audio information
-					SDKFileInfo8->hasAudio				= kPrTrue;
-					SDKFileInfo8->audInfo.numChannels	= audio_desc->GetChannelCount();
-					SDKFileInfo8->audInfo.sampleRate	= audio_desc->GetSampleRate();
-					
-					if(SDKFileInfo8->audInfo.sampleRate != localRecP->alac->mConfig.sampleRate)
-					{
-						// This appears to be a disturbing Bento4 bug.
-						// Or maybe not?  The ALACs on this page had the same issue:
-						// http://www.linnrecords.com/linn-downloads-testfiles.aspx
-						//
-						// The problem arises when the sample rate is larger than uint16_t,
-						// although the field should be a uint32_t
-						
-						SDKFileInfo8->audInfo.sampleRate = localRecP->alac->mConfig.sampleRate;
-						//assert(false); // not OK?
-					}
-					
-					
-					const AP4_UI16 bitDepth				= audio_desc->GetSampleSize();
-					
-					SDKFileInfo8->audInfo.sampleType	= bitDepth == 8 ? kPrAudioSampleType_8BitInt :
-															bitDepth == 16 ? kPrAudioSampleType_16BitInt :
-															bitDepth == 24 ? kPrAudioSampleType_24BitInt :
-															bitDepth == 32 ? kPrAudioSampleType_32BitInt :
-															bitDepth == 64 ? kPrAudioSampleType_64BitFloat :
-															kPrAudioSampleType_Compressed;
-															
-					SDKFileInfo8->audDuration			= localRecP->audio_track->GetDuration() *
-															SDKFileInfo8->audInfo.sampleRate /
-															localRecP->audio_track->GetMediaTimeScale();
-					
-					
-					localRecP->bitDepth = bitDepth;
-					
-					
-					assert(SDKFileInfo8->audInfo.numChannels == localRecP->alac->mConfig.numChannels);
-					assert(bitDepth == localRecP->alac->mConfig.bitDepth);
-					assert(localRecP->alac->mConfig.frameLength == 4096);
-				}
-				else
-					result = imOtherErr;
-			}
-			else
-				result = imUnsupportedCompression;
-		}
-		catch(...)
-		{
-			result = imBadFile;
-		}
+		// The sample description only has 16 bits for the sample rate,
+		// but the ALAC config has all 32
+		const ALACSpecificConfig &config = localRecP->alac->mConfig;
+		
+		const int bitDepth = config.bitDepth;
+		
+		// Audio information
+		SDKFileInfo8->hasAudio				= kPrTrue;
+		SDKFileInfo8->audInfo.numChannels	= config.numChannels;
+		SDKFileInfo8->audInfo.sampleRate	= config.sampleRate;
+		
+		SDKFileInfo8->audInfo.sampleType	= bitDepth == 8 ? kPrAudioSampleType_8BitInt :
+												bitDepth == 16 ? kPrAudioSampleType_16BitInt :
+												bitDepth == 24 ? kPrAudioSampleType_24BitInt :
+												bitDepth == 32 ? kPrAudioSampleType_32BitInt :
+												kPrAudioSampleType_Compressed;
+		
+		SDKFileInfo8->audDuration			= localRecP->index->GetDuration() *
+												config.sampleRate /
+												localRecP->index->GetTimeScale();
+		
+		localRecP->bitDepth = bitDepth;
+		
+		// we'll take any frame size, within reason
+		if(config.frameLength == 0 || config.frameLength > ALAC_MAX_FRAME_LENGTH)
+			result = imUnsupportedCompression;
 
 
 		localRecP->audioSampleRate			= SDKFileInfo8->audInfo.sampleRate;
@@ -715,62 +1675,6 @@ SDKGetInfo8(
 }
 
 
-template<typename INPUT>
-static void
-CopySamples(const INPUT *in, float **out, int channels, const int swizzle[], int samples, PrAudioSample pos, int skip)
-{
-	const double divisor = (1L << ((sizeof(INPUT) << 3) - 1));
-
-	for(int c=0; c < channels; c++)
-	{
-		for(int i=0; i < samples; i++)
-		{
-			out[swizzle[c]][pos + i] = (double)in[(channels * (skip + i)) + c] / divisor;
-		}
-	}
-}
-
-
-static void
-CopySamples24(const uint8_t *in, float **out, int channels, const int swizzle[], int samples, PrAudioSample pos, int skip, int bitDepth)
-{
-	// Apparently with ALAC, 20-bit and 24-bit audio is packed into 3 bytes.
-	// Put 20/24 bit sample into 32-bits and then convert to float.
-	const int bits_to_fill = 32 - bitDepth;
-	const int rightshift = 31 - bits_to_fill;
-	
-	const double divisor = (1L << (32 - 1));
-	
-	
-	in += 3 * channels * skip;
-	
-
-	for(int i = 0; i < samples; i++)
-	{
-		for(int c=0; c < channels; c++)
-		{
-			int32_t val = 0;
-			
-			uint8_t *buf = (uint8_t *)&val;
-			
-			// This is endian-dependant
-			buf[1] = *in++;
-			buf[2] = *in++;
-			buf[3] = *in++;
-			
-			
-			// fill lower bits with high bits
-			// conversion to unsigned may not be necessary, but...
-			uint32_t *uval = (uint32_t *)&val;
-			
-			*uval |= (*uval & 0x7fffffff) >> rightshift;
-			
-			
-			out[swizzle[c]][i + pos] = (double)val / divisor;
-		}
-	}
-}
-
 
 static prMALError 
 SDKImportAudio7(
@@ -779,6 +1683,8 @@ SDKImportAudio7(
 	imImportAudioRec7	*audioRec7)
 {
 	prMALError		result		= malNoError;
+	
+	const double started = ALAC_NowMs();
 
 	// privateData
 	ImporterLocalRec8H ldataH = reinterpret_cast<ImporterLocalRec8H>(audioRec7->privateData);
@@ -786,11 +1692,8 @@ SDKImportAudio7(
 	ImporterLocalRec8Ptr localRecP = reinterpret_cast<ImporterLocalRec8Ptr>( *ldataH );
 
 
-	if(localRecP && localRecP->audio_track && localRecP->alac)
+	if(localRecP && localRecP->index && localRecP->alac)
 	{
-		assert(localRecP->reader != NULL);
-		assert(localRecP->file != NULL && localRecP->file->GetMovie() != NULL);
-		
 		assert(audioRec7->position >= 0); // Do they really want contiguous samples?
 		
 		assert(audioRec7->position < localRecP->duration);
@@ -809,139 +1712,186 @@ SDKImportAudio7(
 		}
 		
 		
-		const AP4_UI32 timestamp_ms = audioRec7->position * 1000 / localRecP->audioSampleRate;
+		// Premiere doesn't tell us the playback speed, but when it's shuttling
+		// it asks for audio in steps that are much bigger than what it asks for
+		const PrAudioSample step = audioRec7->position - localRecP->last_position;
+		const PrAudioSample step_size = (step < 0 ? -step : step);
 		
+		if(step_size >= (PrAudioSample)audioRec7->size * ALAC_SCRUB_SPEED &&
+			step_size <= (PrAudioSample)localRecP->audioSampleRate * ALAC_SCRUB_WINDOW_SECONDS)
+		{
+			localRecP->scrub_steps++;
+		}
+		else
+			localRecP->scrub_steps = 0;
 		
-		const size_t bytes_per_sample = (localRecP->alac->mConfig.bitDepth <= 16 ? 2 : 4);
+		localRecP->last_position = audioRec7->position;
 		
-		const size_t alac_buf_size = localRecP->alac->mConfig.frameLength * localRecP->alac->mConfig.numChannels *
-										bytes_per_sample + kALACMaxEscapeHeaderBytes;
+	#if ALAC_SCRUB_PROXY
+		if(localRecP->scrub_steps >= 2 && localRecP->proxy == NULL)
+			StartScrubProxy(localRecP);
+	#endif
 		
-		uint8_t *alac_buffer = (uint8_t *)malloc(alac_buf_size);
+		// one big step might just be a seek, a couple in a row is a scrub
+		const bool from_proxy = (localRecP->scrub_steps >= 2 && localRecP->proxy != NULL &&
+									localRecP->proxy->Read(audioRec7->buffer, 0, audioRec7->position, audioRec7->size));
 		
 		
-		AP4_Ordinal sample_index = 0;
+		const ALAC_PacketIndex &index = *localRecP->index;
 		
-		AP4_Result ap4_result = localRecP->audio_track->GetSampleIndexForTimeStampMs(timestamp_ms, sample_index);
+		uint32_t packet_index = 0;
 		
-		if(ap4_result == AP4_SUCCESS)
+		if(from_proxy)
+		{
+			// shuttling, close enough
+		}
+		else if( FindPacket(index, audioRec7->position, localRecP->audioSampleRate, packet_index) )
 		{
-			// for surround channels
-			// Premiere uses Left, Right, Left Rear, Right Rear, Center, LFE
-			// ALAC uses Center, Left, Right, Left Rear, Right Rear, LFE
-			// http://alac.macosforge.org/trac/browser/trunk/ReadMe.txt
-			static const int surround_swizzle[] = {4, 0, 1, 2, 3, 5};
-			static const int stereo_swizzle[] = {0, 1, 2, 3, 4, 5}; // no swizzle, actually
-
-			const int *swizzle = localRecP->numChannels > 2 ? surround_swizzle : stereo_swizzle;
+			const ALACSpecificConfig &config = localRecP->alac->mConfig;
+			
+			// Premiere doesn't say why it wants the audio, but it only asks
+			// for this much at once when it's not trying to keep up with playback
+			const ALAC_Priority priority = (audioRec7->size >= localRecP->audioSampleRate ?
+												ALAC_PRIORITY_RENDER : ALAC_PRIORITY_PLAYBACK);
+			
+			
+			// First find all the packets we need, so the ones that aren't in
+			// the cache can be read and decoded together.
+			std::vector<PacketInfo> packets;
+			
+			const PrAudioSample end_pos = audioRec7->position + audioRec7->size;
+			
+			for(uint32_t p = packet_index; p < index.GetPacketCount(); p++)
+			{
+				PacketInfo packet;
+				
+				GetPacketInfo(index, p, localRecP->audioSampleRate, packet);
+				
+				if(packet.pos >= end_pos)
+					break;
+				
+				packet.fetch = !localRecP->cache->Has(p);
+				
+				packets.push_back(packet);
+			}
+			
+			if(localRecP->first_audio_at == 0.0)
+			{
+				localRecP->first_audio_packets = packets.size();
+				
+				for(std::vector<PacketInfo>::const_iterator i = packets.begin(); i != packets.end(); ++i)
+				{
+					if(!i->fetch)
+						localRecP->first_audio_ready++;
+				}
+			}
+			
+			std::vector<float> decoded, refetched;
+			
+			if( !FetchPackets(*localRecP->segments, localRecP->magic_cookie, localRecP->magic_cookie_size, config,
+								packets, decoded, priority) )
+			{
+				result = imFileReadFailed;
+			}
 			
 			
 			csSDK_uint32 samples_needed = audioRec7->size;
 			PrAudioSample pos = 0;
-		
-			AP4_DataBuffer dataBuffer;
 			
-			while(samples_needed > 0 && ap4_result == AP4_SUCCESS && result == malNoError)
+			for(size_t i=0; i < packets.size() && samples_needed > 0 && result == malNoError; i++)
 			{
-				AP4_Sample sample;
+				PacketInfo &packet = packets[i];
+				
+				const PrAudioSample skip_samples = (audioRec7->position > packet.pos) ? (audioRec7->position - packet.pos) : 0;
 				
-				ap4_result = localRecP->audio_track->ReadSample(sample_index, sample, dataBuffer);
+				long samples_to_read = packet.len - skip_samples;
 				
-				if(ap4_result == AP4_SUCCESS)
+				if(samples_to_read > samples_needed)
+					samples_to_read = samples_needed;
+				else if(samples_to_read < 0)
+					samples_to_read = 0;
+				
+				if(samples_to_read > 0)
 				{
-					const PrAudioSample sample_pos = sample.GetDts() *
-														localRecP->audioSampleRate /
-														localRecP->audio_track->GetMediaTimeScale();
-					
-					const PrAudioSample sample_len = sample.GetDuration() *
-														localRecP->audioSampleRate /
-														localRecP->audio_track->GetMediaTimeScale();
-					
-					const PrAudioSample skip_samples = (audioRec7->position > sample_pos) ? (audioRec7->position - sample_pos) : 0;
-					
-					long samples_to_read = sample_len - skip_samples;
+					int samples_read = -1;
 					
-					if(samples_to_read > samples_needed)
-						samples_to_read = samples_needed;
-					else if(samples_to_read < 0)
-						samples_to_read = 0;
-					
-					if(samples_to_read > 0)
+					if(!packet.fetch)
 					{
-						BitBuffer bits;
-						BitBufferInit(&bits, dataBuffer.UseData(), dataBuffer.GetDataSize());
-		
-						uint32_t outSamples = 0;
+						// we already decoded this one
+						samples_read = localRecP->cache->Read(packet.index, audioRec7->buffer, pos,
+																skip_samples, samples_to_read);
+					}
 					
-						int32_t alac_result = localRecP->alac->Decode(&bits,
-																		alac_buffer, localRecP->alac->mConfig.frameLength, localRecP->numChannels,
-																		&outSamples);
+					if(samples_read < 0)
+					{
+						std::vector<float> *packet_data = &decoded;
+						size_t packet_num = i;
 						
-						if(alac_result == 0)
+						if(!packet.fetch)
 						{
-							bool eos = false;
-						
-							if(samples_to_read > outSamples)
-							{
-								samples_to_read = outSamples;
-								
-								eos = true;
-							}
-						
-							if(localRecP->alac->mConfig.bitDepth == 16)
-							{
-								CopySamples<int16_t>((const int16_t *)alac_buffer, audioRec7->buffer,
-														localRecP->numChannels, swizzle, samples_to_read, pos, skip_samples);
-							}
-							else if(localRecP->alac->mConfig.bitDepth == 32)
+							// it was in the cache a minute ago
+							std::vector<PacketInfo> missing(1, packet);
+							
+							missing[0].fetch = true;
+							
+							if( FetchPackets(*localRecP->segments, localRecP->magic_cookie, localRecP->magic_cookie_size, config,
+												missing, refetched, priority) )
 							{
-								CopySamples<int32_t>((const int32_t *)alac_buffer, audioRec7->buffer,
-														localRecP->numChannels, swizzle, samples_to_read, pos, skip_samples);
+								packet.samples = missing[0].samples;
 							}
 							else
-							{
-								assert(localRecP->alac->mConfig.bitDepth == 20 || localRecP->alac->mConfig.bitDepth == 24);
-								
-								CopySamples24(alac_buffer, audioRec7->buffer,
-												localRecP->numChannels, swizzle, samples_to_read, pos, skip_samples,
-												localRecP->alac->mConfig.bitDepth);
-							}
+								result = imFileReadFailed;
+							
+							packet_data = &refetched;
+							packet_num = 0;
+						}
+						
+						if(packet.samples >= 0)
+						{
+							float *packet_buffers[6];
+							
+							PacketBuffers(config, *packet_data, packet_num, packet_buffers);
+							
+							localRecP->cache->Store(packet.index, packet_buffers, packet.samples);
+							
+							samples_read = packet.samples - skip_samples;
+							
+							if(samples_read > samples_to_read)
+								samples_read = samples_to_read;
+							else if(samples_read < 0)
+								samples_read = 0;
 							
-							if(eos)
+							for(int c=0; c < localRecP->numChannels; c++)
 							{
-								// end of the stream
-								break;
+								memcpy(&audioRec7->buffer[c][pos], &packet_buffers[c][skip_samples], sizeof(float) * samples_read);
 							}
 						}
 						else
 							assert(false);
 					}
 					
-					
-					samples_needed -= samples_to_read;
-					pos += samples_to_read;
-					
-					sample_index++;
+					if(samples_read >= 0 && samples_read < samples_to_read)
+					{
+						// end of the stream
+						break;
+					}
 				}
-				else
-					assert(false);
-			}
-			
-			
-			assert(ap4_result == AP4_SUCCESS);
-			
-			
-			if(ap4_result != AP4_SUCCESS && ap4_result != AP4_ERROR_EOS && ap4_result != AP4_ERROR_OUT_OF_RANGE)
-			{
-				result = imFileReadFailed;
+				
+				
+				samples_needed -= samples_to_read;
+				pos += samples_to_read;
 			}
 		}
 		else
 		{
-			assert(ap4_result == AP4_ERROR_EOS);
+			// past the end of the track, nothing to read
 		}
 		
-		free(alac_buffer);
+		if(localRecP->first_audio_at == 0.0)
+		{
+			localRecP->first_audio_at = started;
+			localRecP->first_audio_ms = ALAC_NowMs() - started;
+		}
 	}
 	
 					
@@ -0,0 +1,266 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Proxy.h"
+
+#include <assert.h>
+#include <math.h>
+
+#ifndef PRWIN_ENV
+#include <sys/mman.h>
+#endif
+
+
+// Plenty to hear what's going on while shuttling
+#define ALAC_PROXY_RATE		8000
+
+// For all the clips' proxies put together
+#define ALAC_PROXY_MAX_BYTES	(512 * 1024 * 1024)
+
+
+static ALAC_Mutex g_proxy_bytes_mutex;
+static uint64_t g_proxy_bytes = 0;
+
+
+static bool
+ReserveProxyBytes(size_t bytes)
+{
+	ALAC_Lock lock(g_proxy_bytes_mutex);
+	
+	if(g_proxy_bytes + bytes > ALAC_PROXY_MAX_BYTES)
+		return false;
+	
+	g_proxy_bytes += bytes;
+	
+	return true;
+}
+
+
+static void
+ReleaseProxyBytes(size_t bytes)
+{
+	ALAC_Lock lock(g_proxy_bytes_mutex);
+	
+	assert(g_proxy_bytes >= bytes);
+	
+	g_proxy_bytes -= bytes;
+}
+
+
+ALAC_ScrubProxy::ALAC_ScrubProxy(int channels, int sample_rate, int64_t duration) :
+	_channels(channels),
+	_sample_rate(sample_rate),
+	_proxy_rate(sample_rate < ALAC_PROXY_RATE ? sample_rate : ALAC_PROXY_RATE),
+	_length(0),
+	_buf(NULL),
+	_buf_size(0),
+#ifdef PRWIN_ENV
+	_mapping(NULL),
+#endif
+	_in_pos(0),
+	_accum_count(0),
+	_ready(0)
+{
+	assert(_channels > 0 && _channels <= 6);
+	
+	for(int c=0; c < 6; c++)
+		_accum[c] = 0.0;
+	
+	if(_channels <= 0 || _channels > 6 || _sample_rate <= 0 || duration <= 0)
+		return;
+	
+	_length = (duration * _proxy_rate / _sample_rate) + 1;
+	
+	const uint64_t buf_size = sizeof(float) * _channels * _length;
+	
+	if(buf_size > ALAC_PROXY_MAX_BYTES || !ReserveProxyBytes(buf_size))
+		return;
+	
+	_buf_size = buf_size;
+	
+#ifdef PRWIN_ENV
+	const uint64_t mapping_size = _buf_size;
+
+	_mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+									(DWORD)(mapping_size >> 32), (DWORD)(mapping_size & 0xffffffff), NULL);
+	
+	if(_mapping != NULL)
+	{
+		_buf = (float *)MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, _buf_size);
+		
+		if(_buf == NULL)
+		{
+			CloseHandle(_mapping);
+			
+			_mapping = NULL;
+		}
+	}
+#else
+	void *buf = mmap(NULL, _buf_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	
+	if(buf != MAP_FAILED)
+		_buf = (float *)buf;
+#endif
+
+	if(_buf == NULL)
+	{
+		ReleaseProxyBytes(_buf_size);
+		
+		_buf_size = 0;
+	}
+}
+
+
+ALAC_ScrubProxy::~ALAC_ScrubProxy()
+{
+	if(_buf)
+	{
+	#ifdef PRWIN_ENV
+		UnmapViewOfFile(_buf);
+		
+		CloseHandle(_mapping);
+	#else
+		munmap(_buf, _buf_size);
+	#endif
+	
+		ReleaseProxyBytes(_buf_size);
+	}
+}
+
+
+int64_t
+ALAC_ScrubProxy::Ready()
+{
+	ALAC_Lock lock(_mutex);
+	
+	return _ready;
+}
+
+
+int64_t
+ALAC_ScrubProxy::NextInputSample()
+{
+	return _in_pos;
+}
+
+
+void
+ALAC_ScrubProxy::Append(const float * const *in, int samples)
+{
+	if(_buf == NULL)
+		return;
+	
+	// Each proxy sample is the average of the full-rate samples that land on it
+	for(int i=0; i < samples; i++)
+	{
+		const int64_t proxy_pos = _in_pos * _proxy_rate / _sample_rate;
+		
+		if(proxy_pos != _ready && _accum_count > 0)
+			Emit();
+		
+		for(int c=0; c < _channels; c++)
+			_accum[c] += in[c][i];
+		
+		_accum_count++;
+		_in_pos++;
+	}
+}
+
+
+void
+ALAC_ScrubProxy::Emit()
+{
+	if(_ready < _length)
+	{
+		for(int c=0; c < _channels; c++)
+		{
+			_buf[(c * _length) + _ready] = _accum[c] / _accum_count;
+		}
+	}
+	
+	for(int c=0; c < _channels; c++)
+		_accum[c] = 0.0;
+	
+	_accum_count = 0;
+	
+	// the lock makes sure readers see the samples before they see the count
+	ALAC_Lock lock(_mutex);
+	
+	_ready++;
+}
+
+
+bool
+ALAC_ScrubProxy::Read(float **out, int64_t out_pos, int64_t position, int samples)
+{
+	if(_buf == NULL || samples <= 0)
+		return false;
+	
+	const double ratio = (double)_proxy_rate / (double)_sample_rate;
+	
+	// proxy sample n is centered on full-rate sample (n + 0.5) / ratio
+	const double last = ((position + samples - 1 + 0.5) * ratio) - 0.5;
+	
+	const int64_t last_needed = (int64_t)floor(last) + 1;
+	
+	if(last_needed >= Ready() || last_needed >= _length)
+		return false;
+	
+	for(int c=0; c < _channels; c++)
+	{
+		const float *proxy = &_buf[c * _length];
+		
+		float *dest = &out[c][out_pos];
+		
+		for(int i=0; i < samples; i++)
+		{
+			double src = ((position + i + 0.5) * ratio) - 0.5;
+			
+			if(src < 0.0)
+				src = 0.0;
+			
+			const int64_t n = (int64_t)src;
+			const float frac = (float)(src - n);
+			
+			dest[i] = proxy[n] + (frac * (proxy[n + 1] - proxy[n]));
+		}
+	}
+	
+	return true;
+}
\ No newline at end of file
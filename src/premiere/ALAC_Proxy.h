@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_PROXY_H
+#define ALAC_PROXY_H
+
+
+#include "ALAC_Thread.h"
+
+#include <stdint.h>
+
+
+// A low sample rate copy of the whole clip, planar float, kept in
+// memory-mapped pages so the OS can page it out if it wants to.
+// When Premiere is shuttling through a clip, we answer from here and
+// never have to touch the decoder.
+//
+// All the proxies together get ALAC_PROXY_MAX_BYTES, one that would go
+// over isn't Valid().
+//
+// One thread appends, any number of threads read.
+
+class ALAC_ScrubProxy
+{
+  public:
+	ALAC_ScrubProxy(int channels, int sample_rate, int64_t duration);
+	~ALAC_ScrubProxy();
+	
+	bool Valid() const { return (_buf != NULL); }
+	
+	int ProxyRate() const { return _proxy_rate; }
+	
+	// how many proxy samples are filled in so far
+	int64_t Ready();
+	
+	// first full-rate sample that hasn't been folded into the proxy yet
+	int64_t NextInputSample();
+	
+	// Takes full-rate audio starting at NextInputSample()
+	void Append(const float * const *in, int samples);
+	
+	// Fills out with full-rate samples interpolated from the proxy.
+	// Returns false if we haven't gotten that far yet.
+	bool Read(float **out, int64_t out_pos, int64_t position, int samples);
+	
+  private:
+	void Emit();
+	
+	const int _channels;
+	const int _sample_rate;
+	const int _proxy_rate;
+	int64_t _length;
+	
+	float *_buf;
+	size_t _buf_size;
+#ifdef PRWIN_ENV
+	HANDLE _mapping;
+#endif
+	
+	// only touched by the appending thread
+	int64_t _in_pos;
+	int _accum_count;
+	double _accum[6];
+	
+	int64_t _ready;
+	ALAC_Mutex _mutex;
+};
+
+
+#endif // ALAC_PROXY_H
\ No newline at end of file
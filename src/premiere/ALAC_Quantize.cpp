@@ -0,0 +1,423 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Quantize.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <limits>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define ALAC_QUANTIZE_SSE2	1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define ALAC_QUANTIZE_SSE2	0
+#endif
+
+
+// Samples converted at a time, per channel
+#define ALAC_QUANTIZE_BLOCK		256
+
+
+static inline int32_t
+AudioClip(double in, unsigned int max_val)
+{
+	// My understanding with audio is that it uses the full signed range.
+	// So an 8-bit sample is allowed to go from -128 to 127.  It's not
+	// balanced in positive and negative, but I guess that's OK?
+	return (in >= 0 ?
+				(in < (max_val - 1) ? (in + 0.5) : (max_val - 1)) :
+				(in > (-(int)max_val) ? (in - 0.5) : (-(int)max_val) )
+			);
+			
+	// BTW, the need to cast max_val into an int before the - operation
+	// was the source of a horrific bug I gave myself.  Sigh.
+}
+
+
+template<typename OUTPUT>
+static void
+CopySamples(OUTPUT *out, float * const *in, int channels, const int swizzle[], int samples, int pos)
+{
+	const double multiplier = (1L << ((sizeof(OUTPUT) << 3) - 1));
+	
+	for(int c=0; c < channels; c++)
+	{
+		for(int i=0; i < samples; i++)
+		{
+			out[(channels * (pos + i)) + c] = AudioClip(in[swizzle[c]][i] * multiplier, multiplier);
+		}
+	}
+}
+
+
+static void
+CopySamples24(uint8_t *out, float * const *in, int channels, const int swizzle[], int samples, int pos, int bitDepth)
+{
+	// Apparently with ALAC, 20-bit and 24-bit audio is packed into 3 bytes.
+	// We will make an int32_t and then copy over the top three bytes
+	const int bits_to_clear = 32 - bitDepth;
+	const uint32_t bitmask = ~((uint32_t)((1L << bits_to_clear) - 1));
+	
+	const double multiplier = (1L << (32 - 1));
+	
+	
+	out += 3 * channels * pos;
+	
+	
+	for(int i=0; i < samples; i++)
+	{
+		for(int c=0; c < channels; c++)
+		{
+			int32_t val = AudioClip(in[swizzle[c]][i] * multiplier, multiplier);
+			
+			// zero out lower bits (might not be necessary)
+			// converting to unsigned (also might not be necessary)
+			uint32_t *uval = (uint32_t *)&val;
+			
+			*uval &= bitmask;
+			
+			
+			uint8_t *buf = (uint8_t *)&val;
+			
+			// endian-dependant
+			*out++ = buf[1];
+			*out++ = buf[2];
+			*out++ = buf[3];
+		}
+	}
+}
+
+
+#if ALAC_QUANTIZE_SSE2
+
+static bool
+HasSSE2()
+{
+#if defined(_M_X64) || defined(__x86_64__) || defined(__APPLE__)
+	return true; // every Intel Mac has it
+#elif defined(_MSC_VER)
+	int info[4];
+	
+	__cpuid(info, 1);
+	
+	return ((info[3] & (1 << 26)) != 0);
+#else
+	return false;
+#endif
+}
+
+
+// AudioClip() for four samples.  The scalar version does its math in double,
+// but scaling a float by a power of two is exact and so is x - trunc(x), so
+// this gets exactly the same answer in float.  Rounds half away from zero,
+// and NaN clips to the bottom just like it does there.
+class QuantizeSSE2
+{
+  public:
+	QuantizeSSE2(double multiplier, unsigned int max_val);
+	
+	__m128i operator () (__m128 in) const;
+	
+  private:
+	__m128 _scale;
+	__m128 _hi;
+	__m128 _lo;
+	__m128i _hi_int;
+	__m128i _lo_int;
+	__m128 _half;
+	__m128 _neg_half;
+};
+
+
+QuantizeSSE2::QuantizeSSE2(double multiplier, unsigned int max_val)
+{
+	// Same limits AudioClip() compares against and returns.  It gets the
+	// bottom one by negating an int, which wraps to the same thing for 2^31.
+	const double hi = (max_val - 1);
+	const double lo = -(double)max_val;
+	
+	// If the limit isn't a float, round it away from zero.  No float is in
+	// between, so the comparisons come out the same.
+	const float hi_f = hi;
+	const float lo_f = lo;
+	
+	assert(hi_f >= hi && lo_f <= lo);
+	
+	_scale = _mm_set1_ps(multiplier);
+	_hi = _mm_set1_ps(hi_f);
+	_lo = _mm_set1_ps(lo_f);
+	_hi_int = _mm_set1_epi32((int32_t)hi);
+	_lo_int = _mm_set1_epi32((int32_t)lo);
+	_half = _mm_set1_ps(0.5f);
+	_neg_half = _mm_set1_ps(-0.5f);
+}
+
+
+inline __m128i
+QuantizeSSE2::operator () (__m128 in) const
+{
+	const __m128 x = _mm_mul_ps(in, _scale);
+	
+	const __m128i t = _mm_cvttps_epi32(x);
+	
+	const __m128 frac = _mm_sub_ps(x, _mm_cvtepi32_ps(t));
+	
+	// masks are -1 where true
+	const __m128i round_up = _mm_castps_si128(_mm_cmpge_ps(frac, _half));
+	const __m128i round_down = _mm_castps_si128(_mm_cmple_ps(frac, _neg_half));
+	
+	const __m128i rounded = _mm_add_epi32(_mm_sub_epi32(t, round_up), round_down);
+	
+	const __m128i clip_hi = _mm_castps_si128(_mm_cmpge_ps(x, _hi));
+	const __m128i clip_lo = _mm_castps_si128(_mm_cmpngt_ps(x, _lo)); // NaN too
+	
+	const __m128i clipped = _mm_or_si128(_mm_and_si128(clip_hi, _hi_int),
+											_mm_andnot_si128(clip_hi, rounded));
+	
+	return _mm_or_si128(_mm_and_si128(clip_lo, _lo_int),
+						_mm_andnot_si128(clip_lo, clipped));
+}
+
+
+static void
+QuantizeChannel(int32_t *out, const float *in, int samples, const QuantizeSSE2 &quantize)
+{
+	int i = 0;
+	
+	for(; i + 4 <= samples; i += 4)
+	{
+		_mm_storeu_si128((__m128i *)&out[i], quantize( _mm_loadu_ps(&in[i]) ));
+	}
+	
+	if(i < samples)
+	{
+		// the last few go through a padded copy
+		float in_tail[4] = {0.f, 0.f, 0.f, 0.f};
+		int32_t out_tail[4];
+		
+		for(int j=0; i + j < samples; j++)
+			in_tail[j] = in[i + j];
+		
+		_mm_storeu_si128((__m128i *)out_tail, quantize( _mm_loadu_ps(in_tail) ));
+		
+		for(int j=0; i + j < samples; j++)
+			out[i + j] = out_tail[j];
+	}
+}
+
+
+static void
+QuantizeSamples(uint8_t *out, float * const *in, int channels, const int swizzle[], int samples, int bitDepth)
+{
+	// the same multipliers CopySamples() and CopySamples24() use
+	const double multiplier = (bitDepth == 16 ? (1L << ((sizeof(int16_t) << 3) - 1)) :
+												(1L << (32 - 1)));
+	
+	const QuantizeSSE2 quantize(multiplier, multiplier);
+	
+	const int bits_to_clear = 32 - bitDepth;
+	const uint32_t bitmask = ~((uint32_t)((1L << bits_to_clear) - 1));
+	
+	int32_t block[6][ALAC_QUANTIZE_BLOCK];
+	
+	assert(channels <= 6);
+	
+	for(int pos=0; pos < samples; pos += ALAC_QUANTIZE_BLOCK)
+	{
+		const int count = (samples - pos < ALAC_QUANTIZE_BLOCK ? samples - pos : ALAC_QUANTIZE_BLOCK);
+		
+		for(int c=0; c < channels; c++)
+		{
+			QuantizeChannel(block[c], in[swizzle[c]] + pos, count, quantize);
+		}
+		
+		// interleave
+		if(bitDepth == 16)
+		{
+			int16_t *out16 = (int16_t *)out + (channels * pos);
+			
+			for(int i=0; i < count; i++)
+				for(int c=0; c < channels; c++)
+					*out16++ = block[c][i];
+		}
+		else if(bitDepth == 32)
+		{
+			int32_t *out32 = (int32_t *)out + (channels * pos);
+			
+			for(int i=0; i < count; i++)
+				for(int c=0; c < channels; c++)
+					*out32++ = block[c][i];
+		}
+		else
+		{
+			// top three bytes, x86 is little-endian
+			uint8_t *out24 = out + (3 * channels * pos);
+			
+			for(int i=0; i < count; i++)
+			{
+				for(int c=0; c < channels; c++)
+				{
+					const uint32_t val = (uint32_t)block[c][i] & bitmask;
+					
+					*out24++ = (val >> 8);
+					*out24++ = (val >> 16);
+					*out24++ = (val >> 24);
+				}
+			}
+		}
+	}
+}
+
+static const bool g_has_sse2 = HasSSE2();
+
+#endif // ALAC_QUANTIZE_SSE2
+
+
+#if ALAC_QUANTIZE_SSE2 && !defined(NDEBUG)
+
+// Debug builds make sure the SSE2 path still matches the scalar one on
+// the samples where they're most likely to disagree.
+static bool
+CheckQuantize()
+{
+	if(!g_has_sse2)
+		return true;
+	
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const float inf = std::numeric_limits<float>::infinity();
+	
+	const int depths[4] = { 16, 20, 24, 32 };
+	
+	for(int d=0; d < 4; d++)
+	{
+		const int bitDepth = depths[d];
+		
+		// one step of the quantizer, and one bit of the output
+		const float step = (bitDepth == 16 ? 1.f / 32768.f : 1.f / 2147483648.f);
+		const float lsb = (bitDepth == 16 ? step : step * (1L << (32 - bitDepth)));
+		
+		const float samples[] = {
+			1.f, -1.f,
+			1.f - step, -(1.f - step),
+			1.f - (0.5f * step), -(1.f - (0.5f * step)),
+			1.f - (1.f / 16777216.f), -(1.f - (1.f / 16777216.f)), // just inside
+			1.f + (1.f / 8388608.f), -(1.f + (1.f / 8388608.f)), // just outside
+			2.f, -2.f,
+			0.5f * step, -0.5f * step,
+			1.5f * step, -1.5f * step,
+			2.5f * step, -2.5f * step,
+			0.5f * lsb, -0.5f * lsb,
+			1.5f * lsb, -1.5f * lsb,
+			0.f, -0.f,
+			nan, -nan,
+			inf, -inf,
+			0.25f, -0.75f, 1.f / 3.f // odd count so there's a tail
+		};
+		
+		const int count = sizeof(samples) / sizeof(samples[0]);
+		
+		// second channel backwards so the swizzle gets a look too
+		float reversed[count];
+		
+		for(int i=0; i < count; i++)
+			reversed[i] = samples[count - 1 - i];
+		
+		float * const in[2] = { (float *)samples, reversed };
+		const int swizzle[2] = { 1, 0 };
+		
+		uint8_t vector_out[2 * sizeof(int32_t) * count];
+		uint8_t scalar_out[2 * sizeof(int32_t) * count];
+		
+		const size_t size = 2 * count * (bitDepth == 16 ? 2 : bitDepth == 32 ? 4 : 3);
+		
+		QuantizeSamples(vector_out, in, 2, swizzle, count, bitDepth);
+		
+		if(bitDepth == 16)
+			CopySamples<int16_t>((int16_t *)scalar_out, in, 2, swizzle, count, 0);
+		else if(bitDepth == 32)
+			CopySamples<int32_t>((int32_t *)scalar_out, in, 2, swizzle, count, 0);
+		else
+			CopySamples24(scalar_out, in, 2, swizzle, count, 0, bitDepth);
+		
+		if(memcmp(vector_out, scalar_out, size) != 0)
+			return false;
+	}
+	
+	return true;
+}
+
+static const bool g_quantize_checked = CheckQuantize();
+
+#endif
+
+
+void
+ALAC_Quantize(uint8_t *out, float * const *in, int channels, const int swizzle[], int samples, int bitDepth)
+{
+#if ALAC_QUANTIZE_SSE2
+	if(g_has_sse2)
+	{
+		assert(g_quantize_checked);
+		
+		QuantizeSamples(out, in, channels, swizzle, samples, bitDepth);
+		
+		return;
+	}
+#endif
+
+	if(bitDepth == 16)
+	{
+		CopySamples<int16_t>((int16_t *)out, in, channels, swizzle, samples, 0);
+	}
+	else if(bitDepth == 32)
+	{
+		CopySamples<int32_t>((int32_t *)out, in, channels, swizzle, samples, 0);
+	}
+	else
+	{
+		assert(bitDepth == 20 || bitDepth == 24);
+		
+		CopySamples24(out, in, channels, swizzle, samples, 0, bitDepth);
+	}
+}
\ No newline at end of file
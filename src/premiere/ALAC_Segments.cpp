@@ -0,0 +1,243 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Segments.h"
+
+#include <assert.h>
+
+
+// Put this on the end of the first file's name to make the sidecar
+#define ALAC_SEGMENTS_SIDECAR	".segments"
+
+
+ALAC_SegmentFiles::ALAC_SegmentFiles(imFileRef first_file, const prUTF16Char *first_path)
+{
+	AddSegment(first_path);
+	
+	_segments[0].file = first_file;
+}
+
+
+ALAC_SegmentFiles::~ALAC_SegmentFiles()
+{
+	// the first one is Premiere's to close
+	for(size_t i=1; i < _segments.size(); i++)
+	{
+		if(_segments[i].file != imInvalidHandleValue)
+			Close(_segments[i].file);
+	}
+}
+
+
+static bool
+IsDigit(prUTF16Char c)
+{
+	return (c >= '0' && c <= '9');
+}
+
+
+bool
+ALAC_SegmentFiles::JoinRequested(const prUTF16Char *path)
+{
+	size_t len = 0;
+	
+	while(path[len] != 0)
+		len++;
+	
+	const char suffix[] = ALAC_SEGMENTS_SIDECAR;
+	
+	std::vector<prUTF16Char> sidecar_path(path, path + len);
+	
+	sidecar_path.insert(sidecar_path.end(), suffix, suffix + sizeof(suffix)); // with the terminator
+	
+	const imFileRef sidecar = Open(&sidecar_path[0]);
+	
+	if(sidecar == imInvalidHandleValue)
+		return false;
+	
+	Close(sidecar);
+	
+	return true;
+}
+
+
+bool
+ALAC_SegmentFiles::NextPath(const prUTF16Char *path, std::vector<prUTF16Char> &next_path)
+{
+	size_t len = 0;
+	
+	while(path[len] != 0)
+		len++;
+	
+	// find the extension, but not in a directory name
+	size_t dot = len;
+	
+	while(dot > 0 && path[dot - 1] != '.' && path[dot - 1] != '/' && path[dot - 1] != '\\')
+		dot--;
+	
+	if(dot == 0 || path[dot - 1] != '.')
+		return false;
+	
+	dot--;
+	
+	
+	// the number is right before the extension, after an underscore
+	size_t digits = dot;
+	
+	while(digits > 0 && IsDigit(path[digits - 1]))
+		digits--;
+	
+	if(digits == dot || digits == 0 || path[digits - 1] != '_')
+		return false;
+	
+	
+	next_path.assign(path, path + len + 1);
+	
+	for(size_t i = dot; i > digits; i--)
+	{
+		prUTF16Char &digit = next_path[i - 1];
+		
+		if(digit == '9')
+		{
+			digit = '0'; // carry
+		}
+		else
+		{
+			digit++;
+			
+			return true;
+		}
+	}
+	
+	return false; // ran out of digits
+}
+
+
+imFileRef
+ALAC_SegmentFiles::Open(const prUTF16Char *path)
+{
+#ifdef PRWIN_ENV
+	return CreateFileW(path,
+						GENERIC_READ,
+						FILE_SHARE_READ,
+						NULL,
+						OPEN_EXISTING,
+						FILE_ATTRIBUTE_NORMAL,
+						NULL);
+#else
+	FSIORefNum refNum = CAST_REFNUM(imInvalidHandleValue);
+			
+	CFStringRef filePathCFSR = CFStringCreateWithCharacters(NULL, path, prUTF16CharLength(path));
+												
+	CFURLRef filePathURL = CFURLCreateWithFileSystemPath(NULL, filePathCFSR, kCFURLPOSIXPathStyle, false);
+	
+	if(filePathURL != NULL)
+	{
+		FSRef fileRef;
+		Boolean success = CFURLGetFSRef(filePathURL, &fileRef);
+		
+		if(success)
+		{
+			HFSUniStr255 dataForkName;
+			FSGetDataForkName(&dataForkName);
+		
+			OSErr err = FSOpenFork(	&fileRef,
+									dataForkName.length,
+									dataForkName.unicode,
+									fsRdPerm,
+									&refNum);
+			
+			if(err != noErr)
+				refNum = CAST_REFNUM(imInvalidHandleValue);
+		}
+									
+		CFRelease(filePathURL);
+	}
+								
+	CFRelease(filePathCFSR);
+	
+	return CAST_FILEREF(refNum);
+#endif
+}
+
+
+void
+ALAC_SegmentFiles::Close(imFileRef file)
+{
+#ifdef PRWIN_ENV
+	CloseHandle(file);
+#else
+	FSCloseFork( CAST_REFNUM(file) );
+#endif
+}
+
+
+void
+ALAC_SegmentFiles::AddSegment(const prUTF16Char *path)
+{
+	size_t len = 0;
+	
+	while(path[len] != 0)
+		len++;
+	
+	Segment segment;
+	
+	segment.path.assign(path, path + len + 1);
+	segment.file = imInvalidHandleValue;
+	
+	ALAC_Lock lock(_mutex);
+	
+	_segments.push_back(segment);
+}
+
+
+imFileRef
+ALAC_SegmentFiles::GetFile(int segment)
+{
+	ALAC_Lock lock(_mutex);
+	
+	assert(segment >= 0 && segment < _segments.size());
+	
+	Segment &seg = _segments[segment];
+	
+	if(seg.file == imInvalidHandleValue)
+		seg.file = Open(&seg.path[0]);
+	
+	return seg.file;
+}
\ No newline at end of file
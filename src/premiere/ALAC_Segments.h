@@ -0,0 +1,104 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_SEGMENTS_H
+#define ALAC_SEGMENTS_H
+
+
+#include "ALAC_Premiere_Import.h"
+
+#include "ALAC_Thread.h"
+
+#include <vector>
+
+
+// Our recorders roll over to a new file every so often, leaving behind
+// take_0001.m4a, take_0002.m4a, etc.  We can play a series like that as
+// one clip.  Premiere hands us the handle for the file it opened, and
+// we open the others the first time somebody needs to read from them.
+//
+// Plenty of numbered files aren't a series (separate takes, album
+// tracks), so a series is only joined if the first file has a sidecar
+// next to it, take_0001.m4a.segments.  What's in it doesn't matter.
+
+class ALAC_SegmentFiles
+{
+  public:
+	ALAC_SegmentFiles(imFileRef first_file, const prUTF16Char *first_path);
+	~ALAC_SegmentFiles();
+	
+	// True if path has a sidecar asking for it to be joined.  Joining is
+	// opt-in: without one, every numbered file imports on its own.
+	//
+	// The sidecar is the full name of the first file in the series with
+	// ".segments" on the end, in the same folder.  We only check that it
+	// exists, so it can be empty and anything in it is ignored.  From the
+	// first file, the number after the last underscore counts up, keeping
+	// its digits (take_0009.m4a -> take_0010.m4a), and the series ends at
+	// the first file that's missing or doesn't have the same format.
+	static bool JoinRequested(const prUTF16Char *path);
+	
+	// take_0001.m4a -> take_0002.m4a, false if the name isn't numbered
+	static bool NextPath(const prUTF16Char *path, std::vector<prUTF16Char> &next_path);
+	
+	static imFileRef Open(const prUTF16Char *path);
+	static void Close(imFileRef file);
+	
+	void AddSegment(const prUTF16Char *path);
+	
+	int GetCount() const { return _segments.size(); }
+	const prUTF16Char * GetPath(int segment) const { return &_segments[segment].path[0]; }
+	
+	// imInvalidHandleValue if it won't open
+	imFileRef GetFile(int segment);
+	
+  private:
+	typedef struct
+	{
+		std::vector<prUTF16Char>	path;
+		imFileRef					file;
+	} Segment;
+	
+	std::vector<Segment> _segments;
+	
+	ALAC_Mutex _mutex;
+};
+
+
+#endif // ALAC_SEGMENTS_H
\ No newline at end of file
@@ -0,0 +1,563 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_SharedCache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PRWIN_ENV
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Turn this off to leave the shared cache out of the build
+#define ALAC_SHARED_CACHE			1
+
+// Or set this environment variable (to anything) to keep every process to itself
+#define ALAC_SHARED_CACHE_OFF		"ALAC_NO_SHARED_CACHE"
+
+// Size of the whole shared segment
+#define ALAC_SHARED_CACHE_BYTES		(64 * 1024 * 1024)
+
+// Each slot holds one 5.1 packet of 4096 samples
+#define ALAC_SHARED_BLOCK_BYTES		(4096 * 6 * sizeof(float))
+
+// A packet can land in this many slots
+#define ALAC_SHARED_PROBE			8
+
+// Change the name and version if the layout changes
+#define ALAC_SHARED_CACHE_VERSION	2
+
+#ifdef PRWIN_ENV
+#define ALAC_SHARED_CACHE_NAME		L"Local\\ALAC_Premiere_Decoded_Cache_2"
+#else
+#define ALAC_SHARED_CACHE_NAME		"/ALAC_Premiere_Decoded_Cache_2"
+#endif
+
+
+enum {
+	STATE_NEW = 0,
+	STATE_SETTING_UP,
+	STATE_READY
+};
+
+
+static inline bool
+CompareAndSwap(volatile int32_t *value, int32_t old_value, int32_t new_value)
+{
+#ifdef PRWIN_ENV
+	return (old_value == InterlockedCompareExchange((volatile LONG *)value, new_value, old_value));
+#else
+	return __sync_bool_compare_and_swap(value, old_value, new_value);
+#endif
+}
+
+
+static inline int32_t
+Increment(volatile int32_t *value)
+{
+#ifdef PRWIN_ENV
+	return InterlockedIncrement((volatile LONG *)value);
+#else
+	return __sync_add_and_fetch(value, 1);
+#endif
+}
+
+
+static inline void
+Barrier()
+{
+#ifdef PRWIN_ENV
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+
+static int32_t
+ProcessID()
+{
+#ifdef PRWIN_ENV
+	return GetCurrentProcessId();
+#else
+	return getpid();
+#endif
+}
+
+
+// True only if we're sure the process isn't running anymore
+static bool
+ProcessGone(int32_t pid)
+{
+	if(pid <= 0)
+		return false;
+	
+#ifdef PRWIN_ENV
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	
+	if(process == NULL)
+		return (GetLastError() == ERROR_INVALID_PARAMETER);
+	
+	const bool gone = (WaitForSingleObject(process, 0) == WAIT_OBJECT_0);
+	
+	CloseHandle(process);
+	
+	return gone;
+#else
+	return (kill(pid, 0) != 0 && errno == ESRCH);
+#endif
+}
+
+
+ALAC_SharedCache ALAC_SharedCache::_instance;
+
+
+ALAC_SharedCache::ALAC_SharedCache() :
+	_header(NULL),
+	_slots(NULL),
+	_blocks(NULL),
+	_mapping(NULL),
+	_mapping_size(0),
+	_pid(0)
+{
+
+}
+
+
+ALAC_SharedCache::~ALAC_SharedCache()
+{
+	if(_header)
+	{
+	#ifdef PRWIN_ENV
+		// Windows gets rid of the memory when the last process lets go
+		UnmapViewOfFile(_header);
+		
+		CloseHandle((HANDLE)_mapping);
+	#else
+		// A POSIX segment stays around until it's unlinked, so the last
+		// process out has to do it.  Somebody who crashed never signed
+		// out, so we check if they're still running.
+		bool last_one = true;
+		
+		for(int i=0; i < ALAC_SHARED_USERS; i++)
+		{
+			volatile int32_t &user = _header->users[i];
+			
+			if(user == _pid)
+				CompareAndSwap(&user, _pid, 0);
+			else if(user != 0 && !ProcessGone(user))
+				last_one = false;
+		}
+		
+		munmap(_header, _mapping_size);
+		
+		if(last_one)
+			shm_unlink(ALAC_SHARED_CACHE_NAME);
+	#endif
+	}
+}
+
+
+uint64_t
+ALAC_SharedCache::FileID(const void *data, size_t size, uint64_t hash)
+{
+	// FNV-1a
+	if(hash == 0)
+		hash = 14695981039346656037ULL;
+	
+	const uint8_t *bytes = (const uint8_t *)data;
+	
+	for(size_t i=0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	
+	return (hash == 0 ? 1 : hash); // 0 means an empty slot
+}
+
+
+uint32_t
+ALAC_SharedCache::Hash(uint64_t file_id, uint32_t packet)
+{
+	uint64_t hash = file_id ^ ((uint64_t)packet * 0x9E3779B97F4A7C15ULL);
+	
+	hash ^= (hash >> 29);
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= (hash >> 32);
+	
+	return (uint32_t)hash;
+}
+
+
+bool
+ALAC_SharedCache::Open()
+{
+	// every lookup comes through here, so only lock the first time
+	if( !_opened.IsSet() )
+	{
+		ALAC_Lock lock(_open_mutex);
+		
+		if( !_opened.IsSet() )
+		{
+			Map();
+			
+			_opened.Set();
+		}
+	}
+	
+	Barrier();
+	
+	return (_header != NULL);
+}
+
+
+void
+ALAC_SharedCache::Map()
+{
+#if ALAC_SHARED_CACHE
+	if(getenv(ALAC_SHARED_CACHE_OFF) != NULL)
+		return;
+	
+	_pid = ProcessID();
+	
+	const uint32_t slot_count = ALAC_SHARED_CACHE_BYTES / (ALAC_SHARED_BLOCK_BYTES + sizeof(Slot));
+	
+	const size_t header_size = 128;
+	
+	assert(sizeof(Header) <= header_size);
+	
+	const size_t mapping_size = header_size + (slot_count * sizeof(Slot)) + (slot_count * ALAC_SHARED_BLOCK_BYTES);
+	
+	
+	void *buf = NULL;
+	
+#ifdef PRWIN_ENV
+	// memory is zeroed the first time, so every slot starts empty
+	const uint64_t size64 = mapping_size;
+
+	HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+										(DWORD)(size64 >> 32), (DWORD)(size64 & 0xffffffff),
+										ALAC_SHARED_CACHE_NAME);
+	
+	if(mapping != NULL)
+	{
+		buf = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mapping_size);
+		
+		if(buf != NULL)
+			_mapping = mapping;
+		else
+			CloseHandle(mapping);
+	}
+#else
+	int fd = shm_open(ALAC_SHARED_CACHE_NAME, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	
+	if(fd >= 0)
+	{
+		// only the first process gets to set the size
+		struct stat info;
+		
+		if(fstat(fd, &info) == 0 && info.st_size == 0)
+			ftruncate(fd, mapping_size);
+		
+		if(fstat(fd, &info) == 0 && (size_t)info.st_size >= mapping_size)
+		{
+			void *map = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			
+			if(map != MAP_FAILED)
+				buf = map;
+		}
+		
+		close(fd);
+	}
+#endif
+
+	if(buf == NULL)
+		return;
+	
+	
+	Header *header = (Header *)buf;
+	
+	if( CompareAndSwap(&header->state, STATE_NEW, STATE_SETTING_UP) )
+	{
+		header->version = ALAC_SHARED_CACHE_VERSION;
+		header->slot_count = slot_count;
+		header->block_bytes = ALAC_SHARED_BLOCK_BYTES;
+		header->clock = 0;
+		
+		Barrier();
+		
+		header->state = STATE_READY;
+	}
+	else
+	{
+		// somebody else is setting it up, won't be long
+		for(int i=0; i < 100 && header->state != STATE_READY; i++)
+		{
+		#ifdef PRWIN_ENV
+			Sleep(10);
+		#else
+			usleep(10000);
+		#endif
+		}
+		
+		Barrier();
+	}
+	
+	
+	if(header->state == STATE_READY &&
+		header->version == ALAC_SHARED_CACHE_VERSION &&
+		header->slot_count == slot_count &&
+		header->block_bytes == ALAC_SHARED_BLOCK_BYTES)
+	{
+		_header = header;
+		_slots = (Slot *)((uint8_t *)buf + header_size);
+		_blocks = (uint8_t *)buf + header_size + (slot_count * sizeof(Slot));
+		_mapping_size = mapping_size;
+		
+	#ifndef PRWIN_ENV
+		// sign in, so whoever leaves last knows to unlink it
+		for(int i=0; i < ALAC_SHARED_USERS; i++)
+		{
+			volatile int32_t &user = header->users[i];
+			
+			const int32_t old_user = user;
+			
+			if((old_user == 0 || ProcessGone(old_user)) && CompareAndSwap(&user, old_user, _pid))
+				break;
+		}
+	#endif
+	}
+	else
+	{
+	#ifdef PRWIN_ENV
+		UnmapViewOfFile(buf);
+		
+		CloseHandle((HANDLE)_mapping);
+		
+		_mapping = NULL;
+	#else
+		munmap(buf, mapping_size);
+	#endif
+	}
+#endif // ALAC_SHARED_CACHE
+}
+
+
+int
+ALAC_SharedCache::MaxSamples(int channels) const
+{
+	return (ALAC_SHARED_BLOCK_BYTES / (sizeof(float) * channels));
+}
+
+
+bool
+ALAC_SharedCache::Has(uint64_t file_id, uint32_t packet, int channels)
+{
+	if(file_id == 0 || !Open())
+		return false;
+	
+	const uint32_t hash = Hash(file_id, packet);
+	
+	for(uint32_t p=0; p < ALAC_SHARED_PROBE; p++)
+	{
+		const Slot &slot = GetSlot(hash + p);
+		
+		const int32_t seq = slot.seq;
+		
+		Barrier();
+		
+		if(!(seq & 1) && slot.file_id == file_id && slot.packet == packet && slot.channels == channels)
+		{
+			Barrier();
+			
+			if(slot.seq == seq)
+				return true;
+		}
+	}
+	
+	return false;
+}
+
+
+int
+ALAC_SharedCache::Read(uint64_t file_id, uint32_t packet, int channels, float **out, int max_samples)
+{
+	if(file_id == 0 || !Open())
+		return -1;
+	
+	const uint32_t hash = Hash(file_id, packet);
+	
+	for(uint32_t p=0; p < ALAC_SHARED_PROBE; p++)
+	{
+		Slot &slot = GetSlot(hash + p);
+		
+		const int32_t seq = slot.seq;
+		
+		Barrier();
+		
+		if(!(seq & 1) && slot.file_id == file_id && slot.packet == packet && slot.channels == channels)
+		{
+			const int samples = slot.samples;
+			
+			if(samples < 0 || samples > max_samples || (size_t)(samples * channels) * sizeof(float) > _header->block_bytes)
+				return -1;
+			
+			const float *block = GetBlock(hash + p);
+			
+			for(int c=0; c < channels; c++)
+			{
+				memcpy(out[c], &block[c * samples], sizeof(float) * samples);
+			}
+			
+			Barrier();
+			
+			// if somebody wrote over it while we were copying, we didn't see anything
+			if(slot.seq != seq)
+				return -1;
+			
+			slot.last_used = Increment(&_header->clock);
+			
+			return samples;
+		}
+	}
+	
+	return -1;
+}
+
+
+void
+ALAC_SharedCache::Store(uint64_t file_id, uint32_t packet, int channels, const float * const *in, int samples)
+{
+	if(file_id == 0 || samples <= 0 || !Open())
+		return;
+	
+	if((size_t)(samples * channels) * sizeof(float) > _header->block_bytes)
+		return;
+	
+	const uint32_t hash = Hash(file_id, packet);
+	
+	// Take the first empty slot, otherwise the one used longest ago
+	uint32_t victim = ALAC_SHARED_PROBE;
+	int32_t victim_used = 0;
+	
+	for(uint32_t p=0; p < ALAC_SHARED_PROBE; p++)
+	{
+		const Slot &slot = GetSlot(hash + p);
+		
+		if(slot.seq & 1)
+		{
+			// A writer that died halfway through leaves the slot odd forever,
+			// so if it's gone, the slot is as good as empty
+			if( ProcessGone(slot.writer) )
+			{
+				victim = p;
+				break;
+			}
+			
+			continue;
+		}
+		
+		if(slot.file_id == file_id && slot.packet == packet && slot.channels == channels)
+			return; // somebody beat us to it
+		
+		if(slot.file_id == 0)
+		{
+			victim = p;
+			break;
+		}
+		
+		// clock wraps, so compare the difference
+		if(victim == ALAC_SHARED_PROBE || (int32_t)(slot.last_used - victim_used) < 0)
+		{
+			victim = p;
+			victim_used = slot.last_used;
+		}
+	}
+	
+	if(victim == ALAC_SHARED_PROBE)
+		return;
+	
+	
+	Slot &slot = GetSlot(hash + victim);
+	
+	const int32_t seq = slot.seq;
+	
+	// taking over from a dead writer, skip ahead to the next odd number
+	const int32_t claimed = ((seq & 1) ? seq + 2 : seq + 1);
+	
+	if(((seq & 1) && !ProcessGone(slot.writer)) || !CompareAndSwap(&slot.seq, seq, claimed))
+		return; // somebody else is writing here
+	
+	slot.writer = _pid;
+	
+	Barrier();
+	
+	slot.file_id = file_id;
+	slot.packet = packet;
+	slot.channels = channels;
+	slot.samples = samples;
+	
+	float *block = GetBlock(hash + victim);
+	
+	for(int c=0; c < channels; c++)
+	{
+		memcpy(&block[c * samples], in[c], sizeof(float) * samples);
+	}
+	
+	slot.last_used = Increment(&_header->clock);
+	
+	// Nobody's writing anymore.  Cleared before the slot is even again, so
+	// the next writer's slot never shows our ID before it puts in its own.
+	slot.writer = 0;
+	
+	Barrier();
+	
+	slot.seq = claimed + 1;
+}
\ No newline at end of file
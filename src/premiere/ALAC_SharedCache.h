@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_SHAREDCACHE_H
+#define ALAC_SHAREDCACHE_H
+
+
+#include "ALAC_Thread.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Decoded packets shared between every process that has us loaded, so when
+// Media Encoder is exporting the same clips we're editing in Premiere,
+// only one of us has to decode them.  Setting ALAC_NO_SHARED_CACHE in the
+// environment turns it off, then every process just has its own cache.
+//
+// It's a named chunk of shared memory cut into fixed-size slots.  A packet
+// hashes to a few neighboring slots and gets the least recently used one.
+// Each slot has a sequence number that's odd while it's being written,
+// so nobody ever takes a lock: a writer that loses the race just gives up
+// and a reader that sees the number change just calls it a miss.  The
+// writer leaves its process ID in the slot, so if it crashes halfway
+// through, the next writer can tell and take the slot back.
+
+class ALAC_SharedCache
+{
+  public:
+	static ALAC_SharedCache & Instance() { return _instance; }
+	
+	// Some bytes that identify a file (volume, inode, size, date...) turned into a key
+	static uint64_t FileID(const void *data, size_t size, uint64_t hash = 0);
+	
+	bool Has(uint64_t file_id, uint32_t packet, int channels);
+	
+	// Returns the number of samples, or -1 if it isn't here
+	int Read(uint64_t file_id, uint32_t packet, int channels, float **out, int max_samples);
+	
+	void Store(uint64_t file_id, uint32_t packet, int channels, const float * const *in, int samples);
+	
+	// biggest packet that fits in a slot
+	int MaxSamples(int channels) const;
+	
+  private:
+	ALAC_SharedCache();
+	~ALAC_SharedCache();
+	
+	enum { ALAC_SHARED_USERS = 16 };
+	
+	typedef struct
+	{
+		volatile int32_t	state;
+		uint32_t			version;
+		uint32_t			slot_count;
+		uint32_t			block_bytes;
+		volatile int32_t	clock;
+		volatile int32_t	users[ALAC_SHARED_USERS];	// process IDs that have it open
+	} Header;
+	
+	typedef struct
+	{
+		volatile int32_t	seq;
+		volatile int32_t	last_used;
+		uint64_t			file_id;
+		uint32_t			packet;
+		int32_t				channels;
+		int32_t				samples;
+		volatile int32_t	writer;		// process ID while seq is odd
+	} Slot;
+	
+	// maps the shared memory the first time, after that it's just a flag check
+	bool Open();
+	void Map();
+	
+	Slot & GetSlot(uint32_t i) { return _slots[i % _header->slot_count]; }
+	float * GetBlock(uint32_t i) { return (float *)(_blocks + ((size_t)(i % _header->slot_count) * _header->block_bytes)); }
+	
+	static uint32_t Hash(uint64_t file_id, uint32_t packet);
+	
+	ALAC_Flag _opened;
+	
+	Header *_header;
+	Slot *_slots;
+	uint8_t *_blocks;
+	
+	void *_mapping;
+	size_t _mapping_size;
+	
+	int32_t _pid;
+	
+	ALAC_Mutex _open_mutex;
+	
+	static ALAC_SharedCache _instance;
+};
+
+
+#endif // ALAC_SHAREDCACHE_H
\ No newline at end of file
@@ -0,0 +1,275 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#include "ALAC_Thread.h"
+
+#include <assert.h>
+
+#ifndef PRWIN_ENV
+#include <mach/mach_time.h>
+#include <unistd.h>
+#endif
+
+
+ALAC_Mutex::ALAC_Mutex()
+{
+#ifdef PRWIN_ENV
+	InitializeCriticalSection(&_mutex);
+#else
+	int err = pthread_mutex_init(&_mutex, NULL);
+	
+	assert(err == 0);
+#endif
+}
+
+
+ALAC_Mutex::~ALAC_Mutex()
+{
+#ifdef PRWIN_ENV
+	DeleteCriticalSection(&_mutex);
+#else
+	pthread_mutex_destroy(&_mutex);
+#endif
+}
+
+
+void
+ALAC_Mutex::Lock()
+{
+#ifdef PRWIN_ENV
+	EnterCriticalSection(&_mutex);
+#else
+	pthread_mutex_lock(&_mutex);
+#endif
+}
+
+
+void
+ALAC_Mutex::Unlock()
+{
+#ifdef PRWIN_ENV
+	LeaveCriticalSection(&_mutex);
+#else
+	pthread_mutex_unlock(&_mutex);
+#endif
+}
+
+
+ALAC_Condition::ALAC_Condition()
+{
+#ifdef PRWIN_ENV
+	InitializeConditionVariable(&_cond);
+#else
+	int err = pthread_cond_init(&_cond, NULL);
+	
+	assert(err == 0);
+#endif
+}
+
+
+ALAC_Condition::~ALAC_Condition()
+{
+#ifdef PRWIN_ENV
+	// nothing to delete on Windows
+#else
+	pthread_cond_destroy(&_cond);
+#endif
+}
+
+
+void
+ALAC_Condition::Wait(ALAC_Mutex &mutex)
+{
+#ifdef PRWIN_ENV
+	SleepConditionVariableCS(&_cond, &mutex._mutex, INFINITE);
+#else
+	pthread_cond_wait(&_cond, &mutex._mutex);
+#endif
+}
+
+
+void
+ALAC_Condition::Signal()
+{
+#ifdef PRWIN_ENV
+	WakeConditionVariable(&_cond);
+#else
+	pthread_cond_signal(&_cond);
+#endif
+}
+
+
+void
+ALAC_Condition::Broadcast()
+{
+#ifdef PRWIN_ENV
+	WakeAllConditionVariable(&_cond);
+#else
+	pthread_cond_broadcast(&_cond);
+#endif
+}
+
+
+ALAC_Thread::ALAC_Thread() :
+	_running(false)
+{
+
+}
+
+
+ALAC_Thread::~ALAC_Thread()
+{
+	assert(!_running); // too late to Join() here, the subclass is already gone
+}
+
+
+bool
+ALAC_Thread::Start()
+{
+	assert(!_running);
+
+#ifdef PRWIN_ENV
+	_thread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	
+	_running = (_thread != NULL);
+#else
+	_running = (0 == pthread_create(&_thread, NULL, ThreadProc, this));
+#endif
+
+	return _running;
+}
+
+
+void
+ALAC_Thread::Join()
+{
+	if(_running)
+	{
+	#ifdef PRWIN_ENV
+		WaitForSingleObject(_thread, INFINITE);
+		
+		CloseHandle(_thread);
+	#else
+		pthread_join(_thread, NULL);
+	#endif
+	
+		_running = false;
+	}
+}
+
+
+int
+ALAC_Thread::Processors()
+{
+#ifdef PRWIN_ENV
+	SYSTEM_INFO info;
+	
+	GetSystemInfo(&info);
+	
+	const int cpus = info.dwNumberOfProcessors;
+#else
+	const int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return (cpus < 1 ? 1 : cpus);
+}
+
+
+#ifdef PRWIN_ENV
+DWORD WINAPI
+ALAC_Thread::ThreadProc(LPVOID param)
+{
+	ALAC_Thread *thread = static_cast<ALAC_Thread *>(param);
+	
+	try
+	{
+		thread->Run();
+	}
+	catch(...) {}
+	
+	return 0;
+}
+#else
+void *
+ALAC_Thread::ThreadProc(void *param)
+{
+	ALAC_Thread *thread = static_cast<ALAC_Thread *>(param);
+	
+	try
+	{
+		thread->Run();
+	}
+	catch(...) {}
+	
+	return NULL;
+}
+#endif
+
+
+double
+ALAC_NowMs()
+{
+#ifdef PRWIN_ENV
+	LARGE_INTEGER count, frequency;
+	
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	
+	return (double)count.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+	static mach_timebase_info_data_t timebase = { 0, 0 };
+	
+	if(timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	
+	return (double)mach_absolute_time() * timebase.numer / timebase.denom / 1000000.0;
+#endif
+}
+
+
+void
+ALAC_Flag::Exchange(long value)
+{
+#ifdef PRWIN_ENV
+	InterlockedExchange(&_value, value);
+#else
+	__sync_lock_test_and_set(&_value, value);
+	__sync_synchronize();
+#endif
+}
\ No newline at end of file
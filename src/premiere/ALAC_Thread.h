@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2014, Brendan Bolles
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+// *	   Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// *	   Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// ------------------------------------------------------------------------
+//
+// ALAC (Apple Lossless) plug-in for Premiere
+//
+// by Brendan Bolles <brendan@fnordware.com>
+//
+// ------------------------------------------------------------------------
+
+
+#ifndef ALAC_THREAD_H
+#define ALAC_THREAD_H
+
+
+#ifdef PRWIN_ENV
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+
+// Who's waiting on the work, most urgent first
+typedef enum
+{
+	ALAC_PRIORITY_PLAYBACK = 0,
+	ALAC_PRIORITY_RENDER,
+	ALAC_PRIORITY_BACKGROUND,
+	
+	ALAC_PRIORITY_COUNT
+} ALAC_Priority;
+
+
+// Just enough threading to do some work in the background.
+// Premiere calls us from its own threads, so everything here has to
+// play nice with that.
+
+class ALAC_Mutex
+{
+  public:
+	ALAC_Mutex();
+	~ALAC_Mutex();
+	
+	void Lock();
+	void Unlock();
+	
+  private:
+	friend class ALAC_Condition;
+	
+#ifdef PRWIN_ENV
+	CRITICAL_SECTION _mutex;
+#else
+	pthread_mutex_t _mutex;
+#endif
+
+	ALAC_Mutex(const ALAC_Mutex &);
+	ALAC_Mutex & operator = (const ALAC_Mutex &);
+};
+
+
+class ALAC_Lock
+{
+  public:
+	ALAC_Lock(ALAC_Mutex &mutex) : _mutex(mutex) { _mutex.Lock(); }
+	~ALAC_Lock() { _mutex.Unlock(); }
+	
+  private:
+	ALAC_Mutex &_mutex;
+	
+	ALAC_Lock(const ALAC_Lock &);
+	ALAC_Lock & operator = (const ALAC_Lock &);
+};
+
+
+class ALAC_Condition
+{
+  public:
+	ALAC_Condition();
+	~ALAC_Condition();
+	
+	// mutex must be locked
+	void Wait(ALAC_Mutex &mutex);
+	
+	void Signal();
+	void Broadcast();
+	
+  private:
+#ifdef PRWIN_ENV
+	CONDITION_VARIABLE _cond;
+#else
+	pthread_cond_t _cond;
+#endif
+
+	ALAC_Condition(const ALAC_Condition &);
+	ALAC_Condition & operator = (const ALAC_Condition &);
+};
+
+
+class ALAC_Thread
+{
+  public:
+	ALAC_Thread();
+	virtual ~ALAC_Thread(); // subclasses should call Join() in their destructor
+	
+	bool Start();
+	void Join();
+	
+	bool Running() const { return _running; }
+	
+	static int Processors();
+	
+  protected:
+	virtual void Run() = 0;
+	
+  private:
+#ifdef PRWIN_ENV
+	HANDLE _thread;
+	static DWORD WINAPI ThreadProc(LPVOID param);
+#else
+	pthread_t _thread;
+	static void *ThreadProc(void *param);
+#endif
+
+	bool _running;
+	
+	ALAC_Thread(const ALAC_Thread &);
+	ALAC_Thread & operator = (const ALAC_Thread &);
+};
+
+
+// Milliseconds since some time or other, for timing things
+double ALAC_NowMs();
+
+
+// A flag one thread sets and another thread checks
+class ALAC_Flag
+{
+  public:
+	ALAC_Flag() : _value(0) {}
+	
+	void Set() { Exchange(1); }
+	void Clear() { Exchange(0); }
+	bool IsSet() const { return (_value != 0); }
+	
+  private:
+	void Exchange(long value);
+	
+	volatile long _value;
+};
+
+
+#endif // ALAC_THREAD_H
\ No newline at end of file